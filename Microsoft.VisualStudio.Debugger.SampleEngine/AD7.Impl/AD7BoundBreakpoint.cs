@@ -29,6 +29,15 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
             m_deleted = false;
         }
 
+        // Send the condition and pass count of the pending breakpoint to the debuggee.
+        public void ApplyCondition()
+        {
+            if (!m_deleted)
+            {
+                m_pendingBreakpoint.ApplyCondition(m_address);
+            }
+        }
+
         #region IDebugBoundBreakpoint2 Members
 
         // Called when the breakpoint is being deleted by the user.
@@ -105,12 +114,10 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
             return 0;
         }
 
-        // The sample engine does not support conditions on breakpoints.
-        // A real-world debugger will use this to specify when a breakpoint will be hit
-        // and when it should be ignored.
+        // Conditions are shared by all breakpoints bound from the same pending breakpoint.
         int IDebugBoundBreakpoint2.SetCondition(BP_CONDITION bpCondition)
         {
-            throw new NotImplementedException();
+            return ((IDebugPendingBreakpoint2)m_pendingBreakpoint).SetCondition(bpCondition);
         }
 
         // The sample engine does not support hit counts on breakpoints. A real-world debugger will want to keep track 
@@ -122,11 +129,10 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
             return 0;
         }
 
-        // The sample engine does not support pass counts on breakpoints.
-        // This is used to specify the breakpoint hit count condition.
+        // This is used to specify the breakpoint hit count condition. It is shared by all breakpoints bound from the same pending breakpoint.
         int IDebugBoundBreakpoint2.SetPassCount(BP_PASSCOUNT bpPassCount)
         {
-            throw new NotImplementedException();
+            return ((IDebugPendingBreakpoint2)m_pendingBreakpoint).SetPassCount(bpPassCount);
         }
 
         #endregion
@@ -12,6 +12,11 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
         // The breakpoint request that resulted in this pending breakpoint being created.
         private IDebugBreakpointRequest2 m_pBPRequest;
         private BP_REQUEST_INFO m_bpRequestInfo; 
+        // The condition and pass count that VS collected for the breakpoint. They are checked by the debuggee.
+        private BP_CONDITION m_bpCondition;
+        private BP_PASSCOUNT m_bpPassCount;
+        // The message of a tracepoint, or null for a normal breakpoint. Tracepoints print it in the debuggee and never stop it.
+        private string m_tracepoint;
         private AD7Engine m_engine;
         private BreakpointManager m_bpManager;
 
@@ -24,8 +29,26 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
         {
             m_pBPRequest = pBPRequest;
             BP_REQUEST_INFO[] requestInfo = new BP_REQUEST_INFO[1];
-            EngineUtils.CheckOk(m_pBPRequest.GetRequestInfo(enum_BPREQI_FIELDS.BPREQI_BPLOCATION, requestInfo));
+            EngineUtils.CheckOk(m_pBPRequest.GetRequestInfo(enum_BPREQI_FIELDS.BPREQI_BPLOCATION | enum_BPREQI_FIELDS.BPREQI_CONDITION | enum_BPREQI_FIELDS.BPREQI_PASSCOUNT, requestInfo));
             m_bpRequestInfo = requestInfo[0]; 
+            if ((m_bpRequestInfo.dwFields & enum_BPREQI_FIELDS.BPREQI_CONDITION) != 0)
+            {
+                m_bpCondition = m_bpRequestInfo.bpCondition;
+            }
+            if ((m_bpRequestInfo.dwFields & enum_BPREQI_FIELDS.BPREQI_PASSCOUNT) != 0)
+            {
+                m_bpPassCount = m_bpRequestInfo.bpPassCount;
+            }
+            IDebugBreakpointRequest3 pBPRequest3 = m_pBPRequest as IDebugBreakpointRequest3;
+            if (pBPRequest3 != null)
+            {
+                BP_REQUEST_INFO2[] requestInfo2 = new BP_REQUEST_INFO2[1];
+                if (pBPRequest3.GetRequestInfo2(enum_BPREQI_FIELDS.BPREQI_TRACEPOINT, requestInfo2) == Constants.S_OK
+                    && (requestInfo2[0].dwFields & enum_BPREQI_FIELDS.BPREQI_TRACEPOINT) != 0 && !String.IsNullOrEmpty(requestInfo2[0].bstrTracepoint))
+                {
+                    m_tracepoint = requestInfo2[0].bstrTracepoint;
+                }
+            }
 
             m_engine = engine;
             m_bpManager = bpManager;
@@ -64,6 +87,26 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
             return new AD7DocumentContext(documentName, startPosition[0], startPosition[0], codeContext);
         }
 
+        // The condition expression, or null if the breakpoint is unconditional. Only "when true" conditions are supported.
+        public string Condition
+        {
+            get
+            {
+                if (m_bpCondition.styleCondition != enum_BP_COND_STYLE.BP_COND_WHEN_TRUE || String.IsNullOrEmpty(m_bpCondition.bstrCondition))
+                {
+                    return null;
+                }
+                return m_bpCondition.bstrCondition;
+            }
+        }
+
+        // Send the condition, pass count and tracepoint message to the debuggee for a bound location of this breakpoint.
+        public void ApplyCondition(uint address)
+        {
+            m_engine.DebuggedProcess.SetBreakpointCondition(address, Condition, (int)m_bpPassCount.stylePassCount, m_bpPassCount.dwPassCount);
+            m_engine.DebuggedProcess.SetBreakpointLogMessage(address, m_tracepoint);
+        }
+
         // Remove all of the bound breakpoints for this pending breakpoint
         public void ClearBoundBreakpoints()
         {
@@ -119,6 +162,7 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
                             AD7BoundBreakpoint boundBreakpoint = new AD7BoundBreakpoint(m_engine, addr, this, breakpointResolution);
                             m_boundBreakpoints.Add(boundBreakpoint);
                             m_engine.DebuggedProcess.SetBreakpoint(addr, boundBreakpoint);
+                            ApplyCondition(addr);
                         }
                     }
                     
@@ -239,16 +283,38 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
             return Constants.S_OK;
         }
 
-        // The sample engine does not support conditions on breakpoints.
+        // Sets the condition of this breakpoint and of all breakpoints bound from it. The condition is evaluated by the debuggee
+        // in the frame that hits the breakpoint, so that hits which do not match never stop the debuggee.
         int IDebugPendingBreakpoint2.SetCondition(BP_CONDITION bpCondition)
         {
-            throw new NotImplementedException();
+            if (bpCondition.styleCondition == enum_BP_COND_STYLE.BP_COND_WHEN_CHANGED)
+            {
+                return Constants.E_NOTIMPL;
+            }
+            lock (m_boundBreakpoints)
+            {
+                m_bpCondition = bpCondition;
+                foreach (AD7BoundBreakpoint bp in m_boundBreakpoints)
+                {
+                    bp.ApplyCondition();
+                }
+            }
+            return Constants.S_OK;
         }
 
-        // The sample engine does not support pass counts on breakpoints.
+        // Sets the hit count predicate of this breakpoint and of all breakpoints bound from it. Hits are counted by the debuggee
+        // after the condition passes.
         int IDebugPendingBreakpoint2.SetPassCount(BP_PASSCOUNT bpPassCount)
         {
-            throw new NotImplementedException();
+            lock (m_boundBreakpoints)
+            {
+                m_bpPassCount = bpPassCount;
+                foreach (AD7BoundBreakpoint bp in m_boundBreakpoints)
+                {
+                    bp.ApplyCondition();
+                }
+            }
+            return Constants.S_OK;
         }
 
         // Toggles the virtualized state of this pending breakpoint. When a pending breakpoint is virtualized, 
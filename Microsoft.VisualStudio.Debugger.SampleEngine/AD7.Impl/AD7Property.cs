@@ -59,7 +59,7 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
                 // The sample does not support writing of values displayed in the debugger, so mark them all as read-only.
                 propertyInfo.dwAttrib = (enum_DBG_ATTRIB_FLAGS)DBG_ATTRIB_FLAGS.DBG_ATTRIB_VALUE_READONLY;
 
-                if (this.m_variableInformation.child != null)
+                if (HasChildren())
                 {
                     propertyInfo.dwAttrib |= (enum_DBG_ATTRIB_FLAGS)DBG_ATTRIB_FLAGS.DBG_ATTRIB_OBJ_IS_EXPANDABLE;
                 }
@@ -68,7 +68,7 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
             // If the debugger has asked for the property, or the property has children (meaning it is a pointer in the sample)
             // then set the pProperty field so the debugger can call back when the chilren are enumerated.
             if (((dwFields & enum_DEBUGPROP_INFO_FLAGS.DEBUGPROP_INFO_PROP) != 0) ||
-                (this.m_variableInformation.child != null))
+                HasChildren())
             {
                 propertyInfo.pProperty = (IDebugProperty2)this;
                 propertyInfo.dwFields =  (enum_DEBUGPROP_INFO_FLAGS)((uint)propertyInfo.dwFields | (uint)(DEBUGPROP_INFO_FLAGS.DEBUGPROP_INFO_PROP));
@@ -77,14 +77,37 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
             return propertyInfo;
         }
 
+        // A pointer has its target as the only child. An NPL table has its entries as children, which are only fetched when it is expanded.
+        private bool HasChildren()
+        {
+            return this.m_variableInformation.child != null || this.m_variableInformation.m_nChildCount > 0;
+        }
+
         #region IDebugProperty2 Members
 
         // Enumerates the children of a property. This provides support for dereferencing pointers, displaying members of an array, or fields of a class or struct.
         // The sample debugger only supports pointer dereferencing as children. This means there is only ever one child.
+        // NPL tables are fetched a page at a time. If a table has more entries, the last child lists the rest when it is expanded.
         public int EnumChildren(enum_DEBUGPROP_INFO_FLAGS dwFields, uint dwRadix, ref System.Guid guidFilter, enum_DBG_ATTRIB_FLAGS dwAttribFilter, string pszNameFilter, uint dwTimeout, out IEnumDebugPropertyInfo2 ppEnum)
         {
             ppEnum = null;
 
+            if (IsDebuggingNPL() && this.m_variableInformation.m_nChildCount > 0)
+            {
+                VariableInformation[] children = this.m_variableInformation.GetChildren();
+                if (children == null)
+                {
+                    return Constants.S_FALSE;
+                }
+                DEBUG_PROPERTY_INFO[] properties = new DEBUG_PROPERTY_INFO[children.Length];
+                for (int i = 0; i < children.Length; i++)
+                {
+                    properties[i] = (new AD7Property(children[i])).ConstructDebugPropertyInfo(dwFields);
+                }
+                ppEnum = new AD7PropertyEnum(properties);
+                return Constants.S_OK;
+            }
+
             if (this.m_variableInformation.child != null)
             {
                 DEBUG_PROPERTY_INFO[] properties = new DEBUG_PROPERTY_INFO[1];
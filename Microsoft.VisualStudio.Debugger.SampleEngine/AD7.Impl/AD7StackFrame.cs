@@ -29,6 +29,9 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
         // An array of this frame's locals
         private VariableInformation[] m_locals;     
 
+        // whether the variables of an NPL frame have been fetched from the debuggee
+        private bool m_fVariablesFetched;
+
 
         public AD7StackFrame(AD7Engine engine, AD7Thread thread, X86ThreadContext threadContext)
         {
@@ -69,6 +72,27 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
 
         #region Non-interface methods
 
+        // NPL variables are not known by address. They are fetched from the debuggee the first time this frame is shown, 
+        // since most stops never show the variables of most frames. Upvalues are shown among the locals.
+        private void EnsureVariables()
+        {
+            if (!IsDebuggingNPL() || m_fVariablesFetched || m_threadContext.nFrameLevel <= 0)
+            {
+                return;
+            }
+            m_fVariablesFetched = true;
+
+            List<VariableInformation> parameters = new List<VariableInformation>();
+            List<VariableInformation> locals = new List<VariableInformation>();
+            if (m_engine.DebuggedProcess.NPL_GetFrameVariables((uint)m_thread.GetDebuggedThread().Id, m_threadContext.nFrameLevel, parameters, locals))
+            {
+                m_parameters = parameters.ToArray();
+                m_locals = locals.ToArray();
+                m_numParameters = (uint)m_parameters.Length;
+                m_numLocals = (uint)m_locals.Length;
+            }
+        }
+
         // Construct a FRAMEINFO for this stack frame with the requested information.
         public void SetFrameInfo(enum_FRAMEINFO_FLAGS dwFieldSpec, out FRAMEINFO frameInfo)
         {
@@ -201,6 +225,7 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
         // Construct an instance of IEnumDebugPropertyInfo2 for the combined locals and parameters.
         private void CreateLocalsPlusArgsProperties(out uint elementsReturned, out IEnumDebugPropertyInfo2 enumObject)
         {
+            EnsureVariables();
             elementsReturned = 0;
 
             int localsLength = 0;
@@ -241,6 +266,11 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
         // Construct an instance of IEnumDebugPropertyInfo2 for the locals collection only.
         private void CreateLocalProperties(out uint elementsReturned, out IEnumDebugPropertyInfo2 enumObject)
         {
+            EnsureVariables();
+            if (m_locals == null)
+            {
+                m_locals = new VariableInformation[0];
+            }
             elementsReturned = (uint)m_locals.Length;
             DEBUG_PROPERTY_INFO[] propInfo = new DEBUG_PROPERTY_INFO[m_locals.Length];
 
@@ -256,6 +286,11 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
         // Construct an instance of IEnumDebugPropertyInfo2 for the parameters collection only.
         private void CreateParameterProperties(out uint elementsReturned, out IEnumDebugPropertyInfo2 enumObject)
         {
+            EnsureVariables();
+            if (m_parameters == null)
+            {
+                m_parameters = new VariableInformation[0];
+            }
             elementsReturned = (uint)m_parameters.Length;
             DEBUG_PROPERTY_INFO[] propInfo = new DEBUG_PROPERTY_INFO[m_parameters.Length];
 
@@ -484,7 +519,7 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
 
             if(IsDebuggingNPL())
             {
-                VariableInformation varInfo = VariableInformation.Create(m_engine.DebuggedProcess, pszCode);
+                VariableInformation varInfo = VariableInformation.Create(m_engine.DebuggedProcess, pszCode, m_threadContext.nFrameLevel);
                 if (varInfo!=null)
                 {
                     ppExpr = new AD7Expression(varInfo);
@@ -98,10 +98,10 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
             } 
         }
 
-        // Get the name of the thread. For the sample engine, the name of the thread is always "Sample Engine Thread"
+        // Get the name of the thread. NPL states other than the main state are shown by their state name.
         int IDebugThread2.GetName(out string threadName)
         {
-            threadName = ThreadNameString;
+            threadName = m_debuggedThread.Name ?? ThreadNameString;
             return Constants.S_OK;
         }
 
@@ -148,7 +148,7 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
                 }
                 if ((dwFields & enum_THREADPROPERTY_FIELDS.TPF_NAME) != 0)
                 {
-                    props.bstrName = ThreadNameString;
+                    props.bstrName = m_debuggedThread.Name ?? ThreadNameString;
                     props.dwFields |= enum_THREADPROPERTY_FIELDS.TPF_NAME;
                 }
                 if ((dwFields & enum_THREADPROPERTY_FIELDS.TPF_LOCATION) != 0)
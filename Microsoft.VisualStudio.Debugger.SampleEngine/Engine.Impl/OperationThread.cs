@@ -123,13 +123,31 @@ namespace Microsoft.VisualStudio.Debugger.SampleEngine
 
             while (!fQuit)
             {
-                if ((m_debuggedProcess != null) && (m_debuggedProcess.IsPumpingDebugEvents))
+                if (m_debuggedProcess != null)
+                {
+                    // breakpoints bound or removed in break mode are sent here in a single batch.
+                    m_debuggedProcess.FlushPendingBreakpoints();
+                }
+
+                bool fIsPumping = (m_debuggedProcess != null) && (m_debuggedProcess.IsPumpingDebugEvents);
+                if (fIsPumping)
                 {
                     m_debuggedProcess.WaitForAndDispatchDebugEvent(ResumeEventPumpFlags.ResumeWithExceptionHandled);
+                    fIsPumping = m_debuggedProcess.IsPumpingDebugEvents;
                 }
 
-                // If the other thread is dispatching a command, execute it now.
-                bool fReceivedCommand = m_opSet.WaitOne(new TimeSpan(0, 0, 0, 0, 100), false);
+                // If the other thread is dispatching a command, execute it now. While pumping, we also wake up
+                // as soon as the debuggee posts a debug event. The timeout is only a fallback.
+                bool fReceivedCommand;
+                if (fIsPumping)
+                {
+                    WaitHandle[] waitHandles = new WaitHandle[] { m_opSet, m_debuggedProcess.DebugEventWaitHandle };
+                    fReceivedCommand = (WaitHandle.WaitAny(waitHandles, new TimeSpan(0, 0, 0, 0, 100), false) == 0);
+                }
+                else
+                {
+                    fReceivedCommand = m_opSet.WaitOne(new TimeSpan(0, 0, 0, 0, 100), false);
+                }
 
                 if (fReceivedCommand)
                 {
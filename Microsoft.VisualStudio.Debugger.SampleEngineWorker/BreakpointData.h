@@ -10,6 +10,13 @@ public:
 	initonly BYTE OriginalData;
 	initonly ObjectList^ Clients;
 	initonly DWORD Address;
+	// NPL only: the condition expression, nullptr if none. It is evaluated by the debuggee. 
+	String^ Condition;
+	// NPL only: enum_BP_PASSCOUNT_STYLE of the hit count predicate, 0 if none. 
+	int PassCountStyle;
+	unsigned int PassCount;
+	// NPL only: the message template of a logpoint, nullptr if it is a normal breakpoint. Logpoints print the message in the debuggee and never stop it. 
+	String^ LogMessage;
 
 	BreakpointData(DWORD dwAddress, BYTE originalData, Object^ client)
 	{
@@ -17,6 +24,8 @@ public:
 		OriginalData = originalData;
 		Clients = gcnew ObjectList();
 		Clients->AddLast(client);
+		PassCountStyle = 0;
+		PassCount = 0;
 	}
 };
 
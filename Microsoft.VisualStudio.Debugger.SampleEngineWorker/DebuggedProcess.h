@@ -11,6 +11,8 @@
 #include "BreakpointData.h"
 #include "SymbolEngine.h"
 #include "VariableInformation.h"
+#include "NPLSourceTable.h"
+#include "NPLDebugLane.h"
 
 BEGIN_NAMESPACE
 
@@ -20,6 +22,7 @@ ref class DebuggedModule;
 ref class DebuggedThread;
 ref class ModuleResolver;
 ref class X86ThreadContext;
+class CNPLFileIdStore;
 
 // If the engine is launching or attaching.
 enum DEBUG_METHOD
@@ -59,17 +62,6 @@ public enum class ResumeEventPumpFlags
 	ResumeWithExceptionHandled = 0x2
 };
 
-public ref class StackInfo sealed
-{
-public:
-	StackInfo(unsigned int nAddress, String^ sName) {
-		m_nAddress = nAddress;
-		m_sName = sName;
-	}
-	unsigned int m_nAddress;
-	String^ m_sName;
-};
-
 // Constants for exception types that are interesting to the sample engine.
 // BreakpointExceptionCode is when the debuggee executes and int3. 
 // SingleStepExceptionCode is sent when the processor is in trace mode and has completed
@@ -131,103 +123,72 @@ private:
 
 #pragma region NPL Symbol API
 private:
-	// id, string map is used by NPL debugger only. 
-	// mapping from file id to full path of file name
-	static Collections::Generic::Dictionary<unsigned int, String^>^ m_id_to_string = gcnew Collections::Generic::Dictionary<unsigned int, String^>();
-	// mapping from both relative and full path to file id. 
-	static Collections::Generic::Dictionary<String^, unsigned int>^ m_string_to_id = gcnew Collections::Generic::Dictionary<String^, unsigned int>();
-	
-	String^ GetRelativeFilePath(String^ filePath)
-	{
-		filePath = filePath->Replace("\\", "/");
-		filePath = filePath->ToLower();
-		// Add lower cased and stripping working directory path as well. This is relative path used by NPL runtime. 
-		int nIndex = filePath->IndexOf(m_workingDir);
-		if(nIndex == 0)
-		{
-			return filePath->Substring(m_workingDir->Length);
-		}
-		return filePath;
-	}
+	// file names and source locations, see NPLSourceTable. They belong to the process being debugged, so each attach or launch starts with an empty table. 
+	initonly NPLSourceTable^ m_sourceTable = gcnew NPLSourceTable();
 
+	String^ GetRelativeFilePath(String^ filePath){
+		return m_sourceTable->GetRelativeFilePath(filePath);
+	}
 	unsigned int GetIdByString(String^ str){
-		if(String::IsNullOrEmpty(str))
-			return 0;
-		unsigned int out = 0;
-		str = str->ToLower();
-		if(m_string_to_id->TryGetValue(str, out)){
-			return out;
-		}
-		else{
-			// add both full path and relative to working dir path to string map. 
-			static unsigned int s_last_file_id = 0;
-			String^ fullpath = str;
-			
-			str = str->Replace("\\", "/");
-			bool isFullPath = str->IndexOf(":") > 0;
-			if (isFullPath)
-			{
-				// add relative path used by NPL runtime as well. 
-				int nIndex = str->IndexOf(m_workingDir);
-				if (nIndex == 0)
-				{
-					// stripping working directory
-					str = str->Substring(m_workingDir->Length);
-					m_string_to_id[str] = s_last_file_id;
-				}
-				else
-				{
-					// get relative path by finding the first "script/" or "source/" or "src/"
-					nIndex = str->IndexOf("script/");
-					if (nIndex < 0)
-					{
-						nIndex = str->IndexOf("source/");
-						if (nIndex < 0)
-							nIndex = str->IndexOf("src/");
-					}
-					if (nIndex >= 0)
-					{
-						// add relative path. 
-						str = str->Substring(nIndex);
-						m_string_to_id[str] = s_last_file_id;
-					}
-				}
-			}
-			// add full path as used by visual studio to locate file path
-			m_id_to_string[s_last_file_id] = fullpath;
-			m_string_to_id[fullpath] = s_last_file_id;
-			out = s_last_file_id;
-			s_last_file_id = s_last_file_id + 1;
-		}
-		return out;
+		return m_sourceTable->GetIdByString(str);
 	}
 	String^ GetStringById( unsigned int id) {
-		String^ out = "";
-		if(m_id_to_string->TryGetValue(id, out)){
-			return out;
-		}
-		return out;
+		return m_sourceTable->GetStringById(id);
+	}
+	unsigned int GetAddressByFileLine(String^ filename, int line, int column){
+		return m_sourceTable->GetAddressByFileLine(filename, line, column);
 	}
-
-	// return an unsigned int address from filename and line number
-	// this will roughly simulate a symbol server and compatible with native debugger address
 	unsigned int GetAddressByFileLine(String^ filename, int line){
-		return (line)*10000 + GetIdByString(filename);
+		return m_sourceTable->GetAddressByFileLine(filename, line, 0);
+	}
+	void GetFileLineByAddress(unsigned int address, String^% filename, int% line, int% column){
+		m_sourceTable->GetFileLineByAddress(address, filename, line, column);
 	}
-	
-	// get filename and line number from unsigned int address
-	// this will roughly simulate a symbol server and compatible with native debugger address
 	void GetFileLineByAddress(unsigned int address, String^% filename, int% line){
-		line = (int)(address/10000);
-		filename = GetStringById(address % 10000);
+		m_sourceTable->GetFileLineByAddress(address, filename, line);
 	}
 	void NPL_Suspend();
 	void NPL_Resume();
 	void NPL_SetBreakPoint(unsigned int addr);
 	void NPL_RemoveBreakPoint(unsigned int addr);
+	void NPL_AppendBreakpoint(std::string& out, unsigned int addr);
+	/** append "filename|line|passcountstyle|passcount|condition\n" if the breakpoint at the given address has a condition or hit count. */
+	void NPL_AppendBreakpointCondition(std::string& out, unsigned int addr);
+	/** append "filename|line|message\n" if the breakpoint at the given address is a logpoint. */
+	void NPL_AppendLogMessage(std::string& out, unsigned int addr);
+	/** send breakpoints in a single "setbs" message. 
+	* @param bFullTable: true to replace all breakpoints in the debuggee with m_breakpointMap, false to send m_pendingBreakpointDelta only. 
+	* @param lane: the state to send to, nullptr for all states. */
+	void NPL_SendBreakpoints(bool bFullTable, NPLDebugLane^ lane);
+
+	/** get the lane of a message by its m_from. Messages from unknown queues are from the main lane. */
+	NPLDebugLane^ NPL_GetLane(const std::string& sQueueName);
+	/** get the lane that is shown as the given thread, nullptr if not found. */
+	NPLDebugLane^ NPL_GetLaneByThread(DWORD dwThreadId);
+	/** start debugging another NPL state reported by the main lane. It sends "Attach" to the state, which replies "Attached" on its own lane. */
+	void NPL_AddLane(String^ sName, String^ sQueueName);
+	/** send a message to the given state, or to all states if lane is nullptr. */
+	int NPL_SendToLane(NPLDebugLane^ lane, int nOpcode, int nParam1, int nParam2, const char* code);
 	
 	bool TranslateNPLMsgToDebugEvent(LPDEBUG_EVENT lpDebugEvent, ParaEngine::InterProcessMessage& msg_in);
+	/** parse a "BP" message in the NPL text table format into the break location and m_curStackInfos. */
+	bool NPL_ParseBreakpointText(const std::string& sCode, String^% filename, int% line);
+	/** fetch the frames of the stopped lane that were not sent in its "BP" message with "stackrange". */
+	void NPL_FetchStackFrames(NPLDebugLane^ lane);
+	/** send a request to a stopped lane and wait for the reply. 
+	* @param sReplyName: message name of the reply, such as "FrameVars"
+	* @return false if the lane is not stopped, did not reply in time, or has resumed since the request was sent. */
+	bool NPL_RequestStoppedLane(NPLDebugLane^ lane, int nOpcode, const char* sReplyName, const std::string& sCode, std::string& sReply);
+	/** forget the evaluation results of the last stop. The cache hits and misses of the stop are reported to the output window if NPL_DEBUG_STATS is set. 
+	* It is called whenever a state resumes. */
+	void NPL_ClearEvaluationCache();
+	/** get the persistent file id table of a state. @return NULL if the state did not accept one. */
+	CNPLFileIdStore* NPL_GetFileStore(NPLDebugLane^ lane);
 	bool WaitForNPLDebugEvent( LPDEBUG_EVENT lpDebugEvent, DWORD dwMilliseconds );
+	/** report errors of the transport, and the replay summary if NPL_DEBUG_STATS is set, to the output window. It is called on the poll thread. */
+	void NPL_ReportTransportStatus();
+	/** send merged output to the output window, and return nOutputCredits to the debuggee with "OutputAck". */
+	void NPL_FlushOutput(const std::string& sOutput, int nOutputCredits);
 	BOOL ContinueNPLDebugEvent( DWORD dwProcessId, DWORD dwThreadId, DWORD dwContinueStatus );
 
 	bool DispatchNPLDebugEvent(bool& fContinue);
@@ -242,25 +203,64 @@ private:
 	bool NPLDetachProcess();
 	unsigned int m_curBreakpointAddress;
 
+	// call stack of the lane that stopped last, it is one of NPLDebugLane::m_stackInfos. 
 	Collections::Generic::List<StackInfo^>^ m_curStackInfos = gcnew Collections::Generic::List<StackInfo^>();
+	// NPL states being debugged. Its lock also guards the queues and file id tables of the lanes in WorkerAPI.cpp. 
+	NPLLaneTable^ m_lanes;
+	// the same as m_lanes->MainLane
+	NPLDebugLane^ m_mainLane;
+
+	// results of NPL_InspectVariable() in the current stop, since hover, watch and autos evaluate the same names several times per stop. 
+	// The key is "thread|stop epoch|frame|expression". Expressions that are executed are never cached. The map must be locked to read or write. 
+	Collections::Generic::Dictionary<String^, VariableInformation^>^ m_evaluationCache = gcnew Collections::Generic::Dictionary<String^, VariableInformation^>();
+	// cache hits and misses in the current stop, and since the process is debugged. They are guarded by the lock of m_evaluationCache. 
+	int m_nEvaluationCacheHits;
+	int m_nEvaluationCacheMisses;
+	int m_nTotalEvaluationCacheHits;
+	int m_nTotalEvaluationCacheMisses;
+
+	// breakpoints added(true) or removed(false) since the last "setbs" message. It is guarded by the lock of m_breakpointMap. 
+	Collections::Generic::Dictionary<DWORD_PTR, bool>^ m_pendingBreakpointDelta = gcnew Collections::Generic::Dictionary<DWORD_PTR, bool>();
 	
-	// lower cased forward slash /, that ends with /
-	String^ m_workingDir;
-	// whether we are expecting a step into/over/out breakpoints from NPL 
-	bool m_bExpectingStepBreakpoint;
 	bool m_bNPLProcDetachRequested;
+	// wraps the event of the input mailbox, created on first use. 
+	System::Threading::WaitHandle^ m_debugEventWaitHandle;
 	
 public:
 	bool NPL_EvaluateExpressionSync(String^ sExpression, String^% sOutputValue);
 
+	/** list the locals and upvalues of a frame of a stopped NPL state with "framevars". Upvalues are appended to locals. 
+	* Values that can be expanded have a nonzero VariableInformation::m_nHandle, which is valid until the state resumes. 
+	* @param dwThreadId: the thread of the state
+	* @param nFrameLevel: index of the frame, starting from 1 for the top frame, see X86ThreadContext::nFrameLevel
+	* @return false if the state is not stopped or did not reply in time. */
+	bool NPL_GetFrameVariables(DWORD dwThreadId, int nFrameLevel, Collections::Generic::List<VariableInformation^>^ parameters, Collections::Generic::List<VariableInformation^>^ locals);
+
+	/** list the value of a variable name or a dotted path, such as "a.b.1", in the NPL state that stopped last with "children". 
+	* Results are cached until the state resumes, see m_evaluationCache. 
+	* @param nFrameLevel: the frame whose locals and upvalues the name is looked up in, see X86ThreadContext::nFrameLevel. 
+	*	If it is 0, the name is looked up in the current level of the state, which "set" may change. 
+	* @return nullptr if the state is not stopped or did not reply in time. */
+	VariableInformation^ NPL_InspectVariable(String^ sName, int nFrameLevel);
+
+	/** fetch a page of NPL_CHILDREN_PAGE_SIZE children of a table with "children", starting from parent->m_nChildFrom. 
+	* If there are more, a node that lists the rest is appended, see VariableInformation::GetChildren(). 
+	* @return nullptr if the state has resumed since the parent was listed, or did not reply in time. */
+	cli::array<VariableInformation^>^ NPL_GetChildren(VariableInformation^ parent);
+
+	/** send breakpoint changes since the last call in a single message, so that bulk edits do not cost one message per breakpoint. 
+	* It is called regularly by the poll thread and before the debuggee is resumed. */
+	void FlushPendingBreakpoints();
+
+	/** signaled whenever an NPL debug message is waiting to be dispatched. 
+	* The poll thread waits on it together with engine commands, instead of polling on a timer. */
+	property System::Threading::WaitHandle^ DebugEventWaitHandle
+	{
+		System::Threading::WaitHandle^ get();
+	}
+
 	void SetWorkingDir(String^ workingDir) { 
-		m_workingDir = workingDir; 
-		m_workingDir = m_workingDir->Replace("\\", "/");
-		if(!m_workingDir->EndsWith("/"))
-		{
-			m_workingDir += "/";
-		}
-		m_workingDir = m_workingDir->ToLower();
+		m_sourceTable->SetWorkingDir(workingDir);
 	}
 
 	/** Step over, into, out debugging commands 
@@ -297,6 +297,13 @@ public:
 
 	void SetBreakpoint(DWORD_PTR address, Object^ client);
 	void RemoveBreakpoint(DWORD_PTR address, Object^ client);
+	/** set the condition and hit count predicate of a bound NPL breakpoint. They are checked in the debuggee, which only stops if both pass.
+	* @param condition: an NPL expression, nullptr or empty for none. 
+	* @param nPassCountStyle: enum_BP_PASSCOUNT_STYLE, i.e. 0 for none, 1 for hit count equal to, 2 for greater or equal to, 3 for a multiple of nPassCount. */
+	void SetBreakpointCondition(DWORD_PTR address, String^ condition, int nPassCountStyle, unsigned int nPassCount);
+	/** turn a bound NPL breakpoint into a logpoint, which formats the message in the debuggee and prints it to the output window instead of stopping. 
+	* @param message: the message template, where {expression} is replaced by the value of the expression in the frame that hits it. nullptr or empty to stop as a normal breakpoint. */
+	void SetBreakpointLogMessage(DWORD_PTR address, String^ message);
 
 	cli::array<byte>^ ReadMemory(DWORD_PTR base, DWORD size);
 	unsigned int ReadMemoryUInt(DWORD_PTR base);
@@ -19,6 +19,8 @@ public:
 	initonly IntPtr Handle;
 	initonly int Id;
 	initonly DWORD_PTR StartAddress;
+	// display name of the thread, such as the NPL state name. It is nullptr if the thread has no name. 
+	String^ Name;
 	
 	void Close()
 	{
@@ -0,0 +1,46 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: readers of the binary fields of NPL debug messages, such as "BP", "StackFrames" and "FrameVars". 
+* The writers are bp_write_varint() and bp_write_string() in script/ide/Debugger/IPCDebugger.lua, keep them in sync.
+*/
+#pragma managed(off)
+#include <string>
+
+#pragma managed(on)
+
+BEGIN_NAMESPACE
+
+#pragma managed(off)
+
+/** read a varint of the binary "BP" format: 6 bits per byte, least significant group first. 
+* Bit 7 of every byte is set, so that the encoded message never contains '\0'. Bit 6 is set on all but the last byte. */
+inline bool NPLReadVarint(const char*& pData, const char* pEnd, unsigned int& nValue)
+{
+	nValue = 0;
+	for(int nShift = 0; pData < pEnd && nShift < 32; nShift += 6)
+	{
+		unsigned char c = (unsigned char)*(pData++);
+		if((c & 0x80) == 0)
+			return false;
+		nValue |= (unsigned int)(c & 0x3F) << nShift;
+		if((c & 0x40) == 0)
+			return true;
+	}
+	return false;
+}
+
+/** a string is a varint length followed by the bytes. */
+inline bool NPLReadString(const char*& pData, const char* pEnd, std::string& str)
+{
+	unsigned int nSize = 0;
+	if(!NPLReadVarint(pData, pEnd, nSize) || (unsigned int)(pEnd - pData) < nSize)
+		return false;
+	str.assign(pData, nSize);
+	pData += nSize;
+	return true;
+}
+
+#pragma managed(on)
+
+END_NAMESPACE
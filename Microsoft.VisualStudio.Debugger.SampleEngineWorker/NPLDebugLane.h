@@ -0,0 +1,239 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: NPL runtime states being debugged. Each state has its own debug hook and its own input queue (lane), and is shown as a thread in the debugger.
+* Messages from a state carry its queue name in m_from, which NPLLaneTable maps back to the lane.
+* Each lane decodes the stack of its binary "BP" messages and "StackFrames" replies, since they refer to files interned by the state.
+* It is used by DebuggedProcess, and by the native tests in Tests/.
+*/
+#include "NPLDebugCodec.h"
+#include "NPLFileIdStore.h"
+#include "NPLSourceTable.h"
+
+BEGIN_NAMESPACE
+
+public ref class StackInfo sealed
+{
+public:
+	StackInfo(unsigned int nAddress, String^ sName) {
+		m_nAddress = nAddress;
+		m_sName = sName;
+	}
+	unsigned int m_nAddress;
+	String^ m_sName;
+};
+
+/** an NPL runtime state being debugged. The main lane is the state that we attach to first. */
+public ref class NPLDebugLane sealed
+{
+public:
+	NPLDebugLane(String^ sName, String^ sQueueName, DWORD dwThreadId) {
+		m_sName = sName;
+		m_sQueueName = sQueueName;
+		m_dwThreadId = dwThreadId;
+		m_stackInfos = gcnew Collections::Generic::List<StackInfo^>();
+		m_fileNames = gcnew Collections::Generic::Dictionary<int, String^>();
+		m_bStopped = false;
+		m_bExpectingStep = false;
+		m_nStackDepth = 0;
+		m_nStopEpoch = 0;
+	}
+
+	// called when the state breaks. Requests sent to the state before it returns belong to an earlier stop, and their replies are discarded. 
+	// return the epoch of the new stop
+	int OnBreak() {
+		m_bStopped = true;
+		return ++m_nStopEpoch;
+	}
+
+internal:
+	/** decode a "BP" message in the binary format (NPL_BP_FORMAT_BINARY) into the break location, m_stackInfos and m_nStackDepth. 
+	* layout: varint line+1, file ref, the frames (see DecodeStackFrames), and an optional varint stack depth if the debuggee only sent the top frames. 
+	* @param sourceTable: binds the frames to addresses
+	* @param pFileStore: the persistent file id table of the state, or NULL
+	* @return false if the message is truncated or refers to an unknown file id. */
+	bool DecodeBreakpoint(const std::string& sCode, NPLSourceTable^ sourceTable, CNPLFileIdStore* pFileStore, String^% filename, int% line)
+	{
+		const char* pData = sCode.c_str();
+		const char* pEnd = pData + sCode.size();
+		m_stackInfos->Clear();
+		m_nStackDepth = 0;
+		unsigned int nLine = 0;
+		if(!NPLReadVarint(pData, pEnd, nLine) || !ReadFileRef(pData, pEnd, pFileStore, filename))
+			return false;
+		line = (int)nLine - 1;
+
+		bool bDecoded = DecodeStackFrames(pData, pEnd, sourceTable, pFileStore, m_stackInfos);
+		m_nStackDepth = m_stackInfos->Count;
+		if(!bDecoded)
+			return false;
+		unsigned int nDepth = 0;
+		if(pData < pEnd && NPLReadVarint(pData, pEnd, nDepth) && (int)nDepth > m_nStackDepth)
+			m_nStackDepth = (int)nDepth;
+		return true;
+	}
+
+	/** append the frames of a "StackFrames" reply to "stackrange": varint from, followed by the frames. 
+	* The reply is discarded if the state has resumed or broken again since the request, or if it does not continue m_stackInfos. 
+	* @param nStopEpoch: m_nStopEpoch when the request was sent
+	* @return false if the reply is malformed. */
+	bool AddStackFrames(int nStopEpoch, const std::string& sReply, NPLSourceTable^ sourceTable, CNPLFileIdStore* pFileStore)
+	{
+		if(m_nStopEpoch != nStopEpoch || !m_bStopped)
+			return true;
+		const char* pData = sReply.c_str();
+		const char* pEnd = pData + sReply.size();
+		unsigned int nFrom = 0;
+		Collections::Generic::List<StackInfo^>^ stackInfos = gcnew Collections::Generic::List<StackInfo^>();
+		if(!NPLReadVarint(pData, pEnd, nFrom) || (int)nFrom != m_stackInfos->Count + 1 || !DecodeStackFrames(pData, pEnd, sourceTable, pFileStore, stackInfos))
+			return false;
+		m_stackInfos->AddRange(stackInfos);
+		// the stack may be shorter than counted, do not ask again in this stop
+		m_nStackDepth = m_stackInfos->Count;
+		return true;
+	}
+
+private:
+	/** a file reference is a varint (id*2 + bDefine). If bDefine is 1, the file name string follows and the id is bound to it until the next "Attached". 
+	* If the state accepted a persistent file id table in "Attached", ids that are never defined in messages are read from the table. */
+	bool ReadFileRef(const char*& pData, const char* pEnd, CNPLFileIdStore* pFileStore, String^% filename)
+	{
+		unsigned int nRef = 0;
+		if(!NPLReadVarint(pData, pEnd, nRef))
+			return false;
+		int nFileId = (int)(nRef >> 1);
+		if((nRef & 1) != 0)
+		{
+			std::string filename_;
+			if(!NPLReadString(pData, pEnd, filename_))
+				return false;
+			filename = gcnew String(filename_.c_str());
+			msclr::lock lock(m_fileNames);
+			m_fileNames[nFileId] = filename;
+			return true;
+		}
+		msclr::lock lock(m_fileNames);
+		if(m_fileNames->TryGetValue(nFileId, filename))
+			return true;
+		std::string filename_;
+		if(pFileStore != NULL && pFileStore->GetFileName((unsigned int)nFileId, filename_))
+		{
+			filename = gcnew String(filename_.c_str());
+			m_fileNames[nFileId] = filename;
+			return true;
+		}
+		return false;
+	}
+
+	/** layout: varint frame count, and for each frame: file ref, varint currentline+1, string name. 
+	* Lines are offset by 1, since currentline is -1 for C functions. */
+	bool DecodeStackFrames(const char*& pData, const char* pEnd, NPLSourceTable^ sourceTable, CNPLFileIdStore* pFileStore, Collections::Generic::List<StackInfo^>^ stackInfos)
+	{
+		unsigned int nFrameCount = 0;
+		if(!NPLReadVarint(pData, pEnd, nFrameCount))
+			return false;
+		std::string name_;
+		for (unsigned int i = 0; i < nFrameCount; ++i)
+		{
+			String^ source;
+			unsigned int nCurrentLine = 0;
+			if(!ReadFileRef(pData, pEnd, pFileStore, source) || !NPLReadVarint(pData, pEnd, nCurrentLine) || !NPLReadString(pData, pEnd, name_))
+				return false;
+			unsigned int dwStackAddress = sourceTable->GetAddressByFileLine(source, (int)nCurrentLine - 1);
+			stackInfos->Add(gcnew StackInfo(dwStackAddress, gcnew String(name_.c_str())));
+		}
+		return true;
+	}
+
+public:
+
+	// NPL state name, such as "main"
+	String^ m_sName;
+	// input queue of the state, such as "NPLDebug". Messages from the state carry it in m_from. 
+	String^ m_sQueueName;
+	// key in m_threadIdMap
+	DWORD m_dwThreadId;
+	// call stack of the last break in this state. It may only have the top frames, the others are fetched with "stackrange" and kept until the next break. 
+	Collections::Generic::List<StackInfo^>^ m_stackInfos;
+	// number of frames of the last break, which is larger than m_stackInfos->Count until the other frames are fetched
+	int m_nStackDepth;
+	// incremented on each break, so that frames fetched for an earlier break are discarded
+	int m_nStopEpoch;
+	// file names interned by the state in binary "BP" messages, mapping from debuggee file id to file name. It is reset on "Attached". 
+	// It must be locked to read or write, since "stackrange" replies are decoded on the UI thread, while the poll thread decodes messages of other lanes. 
+	Collections::Generic::Dictionary<int, String^>^ m_fileNames;
+	// whether the state is in its debugger loop waiting for commands
+	bool m_bStopped;
+	// whether we are expecting a step into/over/out breakpoint from the state
+	bool m_bExpectingStep;
+};
+
+/** the NPL states being debugged, mapping from input queue name to lane. The main lane is shown as thread 0, 
+* and the other lanes get thread ids from 1 in the order they are added. 
+* All methods are thread safe. Lock the table to iterate over Lanes, or to use a lane together with data that is keyed by its queue name. */
+public ref class NPLLaneTable sealed
+{
+public:
+	NPLLaneTable(String^ sMainQueueName) {
+		m_mainLane = gcnew NPLDebugLane("main", sMainQueueName, 0);
+		m_lanes->Add(sMainQueueName, m_mainLane);
+		m_nextThreadId = 1;
+	}
+
+	property NPLDebugLane^ MainLane
+	{
+		NPLDebugLane^ get() { return m_mainLane; }
+	}
+
+	// all lanes including the main lane. The table must be locked while they are iterated. 
+	property Collections::Generic::IEnumerable<NPLDebugLane^>^ Lanes
+	{
+		Collections::Generic::IEnumerable<NPLDebugLane^>^ get() { return m_lanes->Values; }
+	}
+
+	// get the lane of a message by its m_from. Messages from unknown queues are from the main lane. 
+	NPLDebugLane^ GetLane(String^ sQueueName) {
+		msclr::lock lock(this);
+		NPLDebugLane^ lane;
+		if(!String::IsNullOrEmpty(sQueueName) && m_lanes->TryGetValue(sQueueName, lane))
+			return lane;
+		return m_mainLane;
+	}
+
+	// get the lane that is shown as the given thread, nullptr if not found. 
+	NPLDebugLane^ GetLaneByThread(DWORD dwThreadId) {
+		msclr::lock lock(this);
+		for each (NPLDebugLane^ lane in m_lanes->Values)
+		{
+			if(lane->m_dwThreadId == dwThreadId)
+				return lane;
+		}
+		return nullptr;
+	}
+
+	// return the new lane, or nullptr if the queue name is empty or already has a lane. 
+	NPLDebugLane^ AddLane(String^ sName, String^ sQueueName) {
+		msclr::lock lock(this);
+		if(String::IsNullOrEmpty(sQueueName) || m_lanes->ContainsKey(sQueueName))
+			return nullptr;
+		NPLDebugLane^ lane = gcnew NPLDebugLane(sName, sQueueName, m_nextThreadId++);
+		m_lanes->Add(sQueueName, lane);
+		return lane;
+	}
+
+	// the main lane is never removed, its state exits as the process. 
+	bool RemoveLane(NPLDebugLane^ lane) {
+		msclr::lock lock(this);
+		if(lane == m_mainLane)
+			return false;
+		return m_lanes->Remove(lane->m_sQueueName);
+	}
+
+private:
+	Collections::Generic::Dictionary<String^, NPLDebugLane^>^ m_lanes = gcnew Collections::Generic::Dictionary<String^, NPLDebugLane^>();
+	NPLDebugLane^ m_mainLane;
+	// the thread id of the next lane
+	DWORD m_nextThreadId;
+};
+
+END_NAMESPACE
@@ -0,0 +1,216 @@
+/**
+* Date: 2026.10.17
+* Desc: see NPLDebugMailbox.h
+*/
+#include "stdafx.h"
+#include "NPLDebugMailbox.h"
+
+#pragma managed(off)
+
+using namespace ParaEngine;
+
+CNPLDebugMailbox::CNPLDebugMailbox()
+	: m_nLastRequestId(0), m_bStopRequested(0), m_pRecorder(NULL)
+{
+	InitializeCriticalSection(&m_lock);
+	// manual reset: it stays signaled until the last message is popped.
+	m_hNotEmpty = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+CNPLDebugMailbox::~CNPLDebugMailbox()
+{
+	Stop();
+	for(std::map<int, PendingRequest*>::iterator itCur = m_pendingRequests.begin(); itCur != m_pendingRequests.end(); ++itCur)
+	{
+		CloseHandle(itCur->second->m_hCompleted);
+		delete itCur->second;
+	}
+	m_pendingRequests.clear();
+	if(m_hNotEmpty)
+	{
+		CloseHandle(m_hNotEmpty);
+		m_hNotEmpty = NULL;
+	}
+	DeleteCriticalSection(&m_lock);
+}
+
+bool CNPLDebugMailbox::AddTransport(INPLDebugTransport* pTransport)
+{
+	if(pTransport == NULL || m_bStopRequested != 0)
+		return false;
+	ReceiverInfo* pReceiver = new ReceiverInfo();
+	pReceiver->m_pMailbox = this;
+	pReceiver->m_pTransport = pTransport;
+	pReceiver->m_bStopRequested = 0;
+	pReceiver->m_hThread = ::CreateThread(NULL, 0, ReceiverThreadProc, pReceiver, 0, NULL);
+	if(pReceiver->m_hThread == NULL)
+	{
+		delete pReceiver;
+		return false;
+	}
+	m_receivers.push_back(pReceiver);
+	return true;
+}
+
+void CNPLDebugMailbox::Stop()
+{
+	if(m_receivers.empty())
+		return;
+	InterlockedExchange(&m_bStopRequested, 1);
+
+	for(size_t i = 0; i < m_receivers.size(); ++i)
+	{
+		InterlockedExchange(&(m_receivers[i]->m_bStopRequested), 1);
+		// the receiver thread is blocked in Receive()
+		m_receivers[i]->m_pTransport->WakeUp();
+	}
+	for(size_t i = 0; i < m_receivers.size(); ++i)
+	{
+		ReceiverInfo* pReceiver = m_receivers[i];
+		if(WaitForSingleObject(pReceiver->m_hThread, 2000) != WAIT_OBJECT_0)
+		{
+			// should never happen, unless the transport is broken. Terminating the thread could leave the locks it holds 
+			// (such as the heap's) orphaned, so the thread and pReceiver are leaked instead. It exits on its own when Receive() returns.
+			CloseHandle(pReceiver->m_hThread);
+			continue;
+		}
+		CloseHandle(pReceiver->m_hThread);
+		delete pReceiver;
+	}
+	m_receivers.clear();
+	Clear();
+	// transports can be added again, such as when the debugger attaches again after a detach
+	InterlockedExchange(&m_bStopRequested, 0);
+}
+
+DWORD WINAPI CNPLDebugMailbox::ReceiverThreadProc(LPVOID lpParam)
+{
+	ReceiverInfo* pReceiver = (ReceiverInfo*)lpParam;
+	pReceiver->m_pMailbox->ReceiverLoop(pReceiver);
+	return 0;
+}
+
+void CNPLDebugMailbox::ReceiverLoop(ReceiverInfo* pReceiver)
+{
+	INPLDebugTransport* pTransport = pReceiver->m_pTransport;
+	while(pReceiver->m_bStopRequested == 0)
+	{
+		InterProcessMessagePtr msg(new InterProcessMessage());
+		if(pTransport->Receive(*msg) == 0)
+		{
+			if(pReceiver->m_bStopRequested != 0)
+				break;
+			Push(msg);
+		}
+		else if(pReceiver->m_bStopRequested == 0)
+		{
+			// the transport reports an error, do not spin on it.
+			Sleep(10);
+		}
+	}
+}
+
+void CNPLDebugMailbox::Push(const InterProcessMessagePtr& msg)
+{
+	if(m_pRecorder)
+		m_pRecorder->Record(NPL_DEBUG_DIR_FROM_DEBUGGEE, *msg);
+	EnterCriticalSection(&m_lock);
+	if(!RouteReply(*msg))
+	{
+		m_messages.push_back(msg);
+		SetEvent(m_hNotEmpty);
+	}
+	LeaveCriticalSection(&m_lock);
+}
+
+bool CNPLDebugMailbox::RouteReply(const InterProcessMessage& msg)
+{
+	if(msg.m_nParam1 == 0)
+		return false;
+	std::map<int, PendingRequest*>::iterator itCur = m_pendingRequests.find(msg.m_nParam1);
+	if(itCur == m_pendingRequests.end() || itCur->second->m_sReplyName != msg.m_filename)
+		return false;
+	PendingRequest* pRequest = itCur->second;
+	pRequest->m_sReply += msg.m_code;
+	if(msg.m_nParam2 != 0)
+		SetEvent(pRequest->m_hCompleted);
+	return true;
+}
+
+int CNPLDebugMailbox::BeginRequest(const char* sReplyName)
+{
+	PendingRequest* pRequest = new PendingRequest();
+	pRequest->m_sReplyName = sReplyName;
+	pRequest->m_hCompleted = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	int nRequestId = 0;
+	while(nRequestId == 0)
+		nRequestId = (int)InterlockedIncrement(&m_nLastRequestId);
+
+	EnterCriticalSection(&m_lock);
+	m_pendingRequests[nRequestId] = pRequest;
+	LeaveCriticalSection(&m_lock);
+	return nRequestId;
+}
+
+bool CNPLDebugMailbox::WaitForReply(int nRequestId, DWORD dwMilliseconds, std::string& sReply)
+{
+	PendingRequest* pRequest = NULL;
+	EnterCriticalSection(&m_lock);
+	std::map<int, PendingRequest*>::iterator itCur = m_pendingRequests.find(nRequestId);
+	if(itCur != m_pendingRequests.end())
+		pRequest = itCur->second;
+	LeaveCriticalSection(&m_lock);
+	if(pRequest == NULL)
+		return false;
+
+	bool bCompleted = (WaitForSingleObject(pRequest->m_hCompleted, dwMilliseconds) == WAIT_OBJECT_0);
+
+	// late replies of a timed out request are treated as ordinary messages.
+	EnterCriticalSection(&m_lock);
+	m_pendingRequests.erase(nRequestId);
+	sReply = pRequest->m_sReply;
+	LeaveCriticalSection(&m_lock);
+
+	CloseHandle(pRequest->m_hCompleted);
+	delete pRequest;
+	return bCompleted;
+}
+
+bool CNPLDebugMailbox::Pop(InterProcessMessagePtr& msg, DWORD dwMilliseconds)
+{
+	DWORD dwStartTime = GetTickCount();
+	while(true)
+	{
+		EnterCriticalSection(&m_lock);
+		if(!m_messages.empty())
+		{
+			msg = m_messages.front();
+			m_messages.pop_front();
+			if(m_messages.empty())
+				ResetEvent(m_hNotEmpty);
+			LeaveCriticalSection(&m_lock);
+			return true;
+		}
+		LeaveCriticalSection(&m_lock);
+
+		DWORD dwTimeLeft = INFINITE;
+		if(dwMilliseconds != INFINITE)
+		{
+			DWORD dwElapsed = GetTickCount() - dwStartTime;
+			if(dwElapsed >= dwMilliseconds)
+				return false;
+			dwTimeLeft = dwMilliseconds - dwElapsed;
+		}
+		if(WaitForSingleObject(m_hNotEmpty, dwTimeLeft) != WAIT_OBJECT_0)
+			return false;
+	}
+}
+
+void CNPLDebugMailbox::Clear()
+{
+	EnterCriticalSection(&m_lock);
+	m_messages.clear();
+	ResetEvent(m_hNotEmpty);
+	LeaveCriticalSection(&m_lock);
+}
@@ -0,0 +1,106 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: dedicated receiver threads that block on the NPL debug transports and store incoming messages in a local mailbox.
+* The poll thread waits on the mailbox's event handle (together with engine commands), so that debug events are dispatched
+* as soon as they arrive, instead of being polled on a fixed timer.
+* Replies to requests (i.e. with a pending request id in param1) are routed to the waiting requester instead of the mailbox.
+*/
+#pragma managed(off)
+#include <deque>
+#include <vector>
+#include <map>
+#include "PETypes.h"
+#include "InterprocessQueue.hpp"
+
+#pragma managed(on)
+
+#include "NPLDebugTransport.h"
+#include "NPLDebugRecorder.h"
+
+BEGIN_NAMESPACE
+
+#pragma managed(off)
+
+class CNPLDebugMailbox
+{
+public:
+	CNPLDebugMailbox();
+	~CNPLDebugMailbox();
+
+	/** start a receiver thread on the given transport. Messages from all transports are merged in arrival order.
+	* @param pTransport: the transport to read from. The mailbox does not own it, and it must outlive Stop().
+	*/
+	bool AddTransport(INPLDebugTransport* pTransport);
+
+	/** stop all receiver threads. It is safe to call it multiple times. 
+	* A receiver thread that does not return from Receive() within 2 seconds after WakeUp() is left running rather than terminated. */
+	void Stop();
+
+	/** pop the next message in arrival order.
+	* @param dwMilliseconds: 0 to return immediately, INFINITE to wait forever.
+	* @return false if no message arrived within dwMilliseconds.
+	*/
+	bool Pop(ParaEngine::InterProcessMessagePtr& msg, DWORD dwMilliseconds);
+
+	/** remove all pending messages. */
+	void Clear();
+
+	/** record all received messages, including replies to requests. 
+	* @param pRecorder: NULL to stop recording. The mailbox does not own it, and it must outlive Stop(). */
+	void SetRecorder(CNPLDebugRecorder* pRecorder) { m_pRecorder = pRecorder; }
+
+	/** a manual reset event that is signaled whenever the mailbox is not empty. */
+	HANDLE GetWaitHandle() { return m_hNotEmpty; }
+
+	/** register a request before sending it to the debuggee. The debuggee echoes the id in param1 of each reply message, 
+	* and sets param2 to 1 in the last one.
+	* @param sReplyName: the message name (filename) of the reply, such as "ExpValue"
+	* @return the request id, which is never 0.
+	*/
+	int BeginRequest(const char* sReplyName);
+
+	/** wait until the last reply of the request is received. Replies can be waited for concurrently from different threads. 
+	* The request is always unregistered when this function returns.
+	* @param sReply: the code of all reply messages in arrival order.
+	* @return false if timed out.
+	*/
+	bool WaitForReply(int nRequestId, DWORD dwMilliseconds, std::string& sReply);
+
+private:
+	struct PendingRequest
+	{
+		std::string m_sReplyName;
+		std::string m_sReply;
+		HANDLE m_hCompleted;
+	};
+	/** return true if msg is a reply to a pending request. */
+	bool RouteReply(const ParaEngine::InterProcessMessage& msg);
+
+	struct ReceiverInfo
+	{
+		CNPLDebugMailbox* m_pMailbox;
+		INPLDebugTransport* m_pTransport;
+		HANDLE m_hThread;
+		// per receiver, so that a receiver that Stop() gave up on still sees it after transports are added again. 
+		volatile LONG m_bStopRequested;
+	};
+	static DWORD WINAPI ReceiverThreadProc(LPVOID lpParam);
+	void ReceiverLoop(ReceiverInfo* pReceiver);
+	void Push(const ParaEngine::InterProcessMessagePtr& msg);
+
+	std::vector<ReceiverInfo*> m_receivers;
+	std::deque<ParaEngine::InterProcessMessagePtr> m_messages;
+	// mapping from request id to pending request. 
+	std::map<int, PendingRequest*> m_pendingRequests;
+	volatile LONG m_nLastRequestId;
+	// guards m_messages and m_pendingRequests
+	CRITICAL_SECTION m_lock;
+	HANDLE m_hNotEmpty;
+	volatile LONG m_bStopRequested;
+	CNPLDebugRecorder* m_pRecorder;
+};
+
+#pragma managed(on)
+
+END_NAMESPACE
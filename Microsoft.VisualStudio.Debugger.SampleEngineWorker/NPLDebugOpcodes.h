@@ -0,0 +1,76 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: opcodes of NPL debug messages, carried in InterProcessMessage::m_nMsgType (the "type" field on the NPL side).
+* The same table is defined in script/ide/Debugger/IPCDebugger.lua, keep them in sync.
+* Message names (m_filename) are always sent as well. Messages with opcode 0 are from older debuggees and are dispatched by name.
+*/
+#include <string>
+
+BEGIN_NAMESPACE
+
+enum NPLDebugOpcode
+{
+	NPL_DEBUG_OP_NONE = 0,
+	// debuggee to debug engine
+	NPL_DEBUG_OP_BP = 1,
+	NPL_DEBUG_OP_OUTPUT = 2,
+	NPL_DEBUG_OP_DEBUGGER_OUTPUT = 3,
+	NPL_DEBUG_OP_EXP_VALUE = 4,
+	NPL_DEBUG_OP_ATTACHED = 5,
+	// both directions
+	NPL_DEBUG_OP_DETACH = 6,
+	// debuggee to debug engine: another NPL state started its debug engine after "Attached"
+	NPL_DEBUG_OP_STATE_STARTED = 7,
+	// debuggee to debug engine: reply to "stackrange"
+	NPL_DEBUG_OP_STACK_FRAMES = 8,
+	// debuggee to debug engine: reply to "framevars"
+	NPL_DEBUG_OP_FRAME_VARS = 9,
+	// debuggee to debug engine: reply to "children"
+	NPL_DEBUG_OP_CHILDREN = 10,
+	// debug engine to debuggee
+	NPL_DEBUG_OP_ATTACH = 16,
+	NPL_DEBUG_OP_BREAK = 17,
+	NPL_DEBUG_OP_SETB = 18,
+	NPL_DEBUG_OP_DELB = 19,
+	NPL_DEBUG_OP_SETBS = 20,
+	NPL_DEBUG_OP_CONTINUE = 21,
+	NPL_DEBUG_OP_STEP = 22,
+	NPL_DEBUG_OP_OVER = 23,
+	NPL_DEBUG_OP_OUT = 24,
+	NPL_DEBUG_OP_DUMP = 25,
+	NPL_DEBUG_OP_EXEC = 26,
+	NPL_DEBUG_OP_OUTPUT_ACK = 27,
+	NPL_DEBUG_OP_STACK_RANGE = 28,
+	NPL_DEBUG_OP_GET_FRAME_VARS = 29,
+	NPL_DEBUG_OP_GET_CHILDREN = 30,
+	NPL_DEBUG_OP_COUNT,
+};
+
+/** get the message name of an opcode. @return NULL if the opcode is unknown. */
+inline const char* NPLDebugOpcodeToName(int nOpcode)
+{
+	static const char* s_names[NPL_DEBUG_OP_COUNT] = {
+		NULL, "BP", "Output", "DebuggerOutput", "ExpValue", "Attached", "Detach", "StateStarted",
+		"StackFrames", "FrameVars", "Children", NULL, NULL, NULL, NULL, NULL,
+		"Attach", "Break", "setb", "delb", "setbs", "continue", "step", "over",
+		"out", "dump", "exec", "OutputAck", "stackrange", "framevars", "children",
+	};
+	return (nOpcode > 0 && nOpcode < NPL_DEBUG_OP_COUNT) ? s_names[nOpcode] : NULL;
+}
+
+/** the opcode of a received message. It is only looked up by name if the sender did not set one. */
+inline int NPLDebugGetOpcode(int nMsgType, const std::string& sName)
+{
+	if(nMsgType > 0 && nMsgType < NPL_DEBUG_OP_COUNT)
+		return nMsgType;
+	for (int i = 1; i < NPL_DEBUG_OP_COUNT; ++i)
+	{
+		const char* sOpName = NPLDebugOpcodeToName(i);
+		if(sOpName != NULL && sName == sOpName)
+			return i;
+	}
+	return NPL_DEBUG_OP_NONE;
+}
+
+END_NAMESPACE
@@ -0,0 +1,196 @@
+/**
+* Date: 2026.10.17
+* Desc: see NPLDebugRecorder.h
+*/
+#include "stdafx.h"
+#include "NPLDebugRecorder.h"
+
+#pragma managed(off)
+
+using namespace ParaEngine;
+
+#define NPL_RECORD_MAGIC "NPLDREC1"
+#define NPL_RECORD_MAGIC_SIZE 8
+/** uint32 payload size, uint8 direction, uint64 time */
+#define NPL_RECORD_HEADER_SIZE 13
+
+static unsigned __int64 GetMicroseconds(const LARGE_INTEGER& nStartTime, const LARGE_INTEGER& nFrequency)
+{
+	LARGE_INTEGER nNow;
+	QueryPerformanceCounter(&nNow);
+	return (unsigned __int64)(nNow.QuadPart - nStartTime.QuadPart) * 1000000 / (unsigned __int64)nFrequency.QuadPart;
+}
+
+#pragma region CNPLDebugRecorder
+
+CNPLDebugRecorder::CNPLDebugRecorder()
+	: m_pFile(NULL)
+{
+	InitializeCriticalSection(&m_lock);
+	QueryPerformanceFrequency(&m_nFrequency);
+	m_nStartTime.QuadPart = 0;
+}
+
+CNPLDebugRecorder::~CNPLDebugRecorder()
+{
+	Close();
+	DeleteCriticalSection(&m_lock);
+}
+
+bool CNPLDebugRecorder::Open(const char* sFileName)
+{
+	Close();
+	EnterCriticalSection(&m_lock);
+	m_pFile = fopen(sFileName, "wb");
+	if(m_pFile)
+	{
+		fwrite(NPL_RECORD_MAGIC, 1, NPL_RECORD_MAGIC_SIZE, m_pFile);
+		QueryPerformanceCounter(&m_nStartTime);
+	}
+	LeaveCriticalSection(&m_lock);
+	return m_pFile != NULL;
+}
+
+void CNPLDebugRecorder::Close()
+{
+	EnterCriticalSection(&m_lock);
+	if(m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+	LeaveCriticalSection(&m_lock);
+}
+
+void CNPLDebugRecorder::Record(int nDirection, const InterProcessMessage& msg)
+{
+	EnterCriticalSection(&m_lock);
+	if(m_pFile)
+	{
+		unsigned __int64 nTime = GetMicroseconds(m_nStartTime, m_nFrequency);
+		NPLEncodeMessage(msg, m_buffer);
+		DWORD nSize = (DWORD)m_buffer.size();
+		unsigned char nDirection_ = (unsigned char)nDirection;
+		fwrite(&nSize, sizeof(DWORD), 1, m_pFile);
+		fwrite(&nDirection_, 1, 1, m_pFile);
+		fwrite(&nTime, sizeof(nTime), 1, m_pFile);
+		fwrite(m_buffer.c_str(), 1, nSize, m_pFile);
+	}
+	LeaveCriticalSection(&m_lock);
+}
+
+#pragma endregion CNPLDebugRecorder
+
+#pragma region CNPLReplayTransport
+
+CNPLReplayTransport::CNPLReplayTransport()
+	: m_nNextRecord(0), m_bRecordedPace(false), m_nFinished(0), m_nElapsedMs(0)
+{
+	m_hWakeUpEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	QueryPerformanceFrequency(&m_nFrequency);
+	m_nStartTime.QuadPart = 0;
+}
+
+CNPLReplayTransport::~CNPLReplayTransport()
+{
+	if(m_hWakeUpEvent)
+	{
+		CloseHandle(m_hWakeUpEvent);
+		m_hWakeUpEvent = NULL;
+	}
+}
+
+bool CNPLReplayTransport::Open(const char* sFileName, bool bRecordedPace)
+{
+	m_records.clear();
+	m_nNextRecord = 0;
+	m_bRecordedPace = bRecordedPace;
+
+	FILE* pFile = fopen(sFileName, "rb");
+	if(pFile == NULL)
+		return false;
+	std::string sData;
+	char buf[4096];
+	size_t nRead;
+	while((nRead = fread(buf, 1, sizeof(buf), pFile)) > 0)
+		sData.append(buf, nRead);
+	fclose(pFile);
+
+	if(sData.size() < NPL_RECORD_MAGIC_SIZE || memcmp(sData.c_str(), NPL_RECORD_MAGIC, NPL_RECORD_MAGIC_SIZE) != 0)
+		return false;
+	const char* pData = sData.c_str() + NPL_RECORD_MAGIC_SIZE;
+	const char* pEnd = sData.c_str() + sData.size();
+	while(pEnd - pData >= NPL_RECORD_HEADER_SIZE)
+	{
+		DWORD nSize = 0;
+		unsigned __int64 nTime = 0;
+		memcpy(&nSize, pData, sizeof(DWORD));
+		unsigned char nDirection = (unsigned char)pData[sizeof(DWORD)];
+		memcpy(&nTime, pData + sizeof(DWORD) + 1, sizeof(nTime));
+		pData += NPL_RECORD_HEADER_SIZE;
+		if((DWORD)(pEnd - pData) < nSize)
+		{
+			// the recording was cut off, keep what we have
+			break;
+		}
+		// only messages from the debuggee are replayed, the worker sends its own.
+		if(nDirection == NPL_DEBUG_DIR_FROM_DEBUGGEE)
+		{
+			ReplayRecord record;
+			record.m_nTime = nTime;
+			record.m_sPayload.assign(pData, nSize);
+			m_records.push_back(record);
+		}
+		pData += nSize;
+	}
+	return true;
+}
+
+int CNPLReplayTransport::Receive(InterProcessMessage& msg)
+{
+	if(WaitForSingleObject(m_hWakeUpEvent, 0) == WAIT_OBJECT_0)
+		return -1;
+	if(m_nNextRecord >= m_records.size())
+	{
+		// the session is over
+		WaitForSingleObject(m_hWakeUpEvent, INFINITE);
+		return -1;
+	}
+	if(m_nNextRecord == 0)
+	{
+		QueryPerformanceCounter(&m_nStartTime);
+	}
+	const ReplayRecord& record = m_records[m_nNextRecord];
+	if(m_bRecordedPace)
+	{
+		unsigned __int64 nDueTime = record.m_nTime - m_records[0].m_nTime;
+		unsigned __int64 nNow = GetMicroseconds(m_nStartTime, m_nFrequency);
+		if(nDueTime > nNow && WaitForSingleObject(m_hWakeUpEvent, (DWORD)((nDueTime - nNow) / 1000)) == WAIT_OBJECT_0)
+			return -1;
+	}
+	++m_nNextRecord;
+	int nResult = NPLDecodeMessage(record.m_sPayload.c_str(), record.m_sPayload.size(), msg) ? 0 : -1;
+
+	if(m_nNextRecord == m_records.size())
+	{
+		m_nElapsedMs = (int)(GetMicroseconds(m_nStartTime, m_nFrequency) / 1000);
+		InterlockedExchange(&m_nFinished, 1);
+	}
+	return nResult;
+}
+
+bool CNPLReplayTransport::PopSummary(int& nMessages, int& nMilliseconds)
+{
+	if(InterlockedCompareExchange(&m_nFinished, 2, 1) != 1)
+		return false;
+	nMessages = (int)m_records.size();
+	nMilliseconds = m_nElapsedMs;
+	return true;
+}
+
+void CNPLReplayTransport::WakeUp()
+{
+	SetEvent(m_hWakeUpEvent);
+}
+
+#pragma endregion CNPLReplayTransport
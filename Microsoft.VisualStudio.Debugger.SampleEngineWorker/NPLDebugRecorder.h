@@ -0,0 +1,105 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: record and replay of NPL debug sessions, so that the worker's event pump can be measured without a live NPL process.
+* - CNPLDebugRecorder: writes every message sent to or received from the debuggee with a timestamp to a file.
+*	It is enabled with the environment variable NPL_DEBUG_RECORD=filename of visual studio.
+* - CNPLReplayTransport: plays the messages received in a recorded session back into the worker, as if they were sent by the debuggee.
+*	It is selected with NPL_DEBUG_TRANSPORT=replay://filename. Messages are replayed as fast as possible, or at the recorded pace if NPL_DEBUG_REPLAY_PACE=recorded.
+*	The replay time is reported to the output window if NPL_DEBUG_STATS=1.
+* The file is "NPLDREC1" followed by records of: uint32 payload size, uint8 direction, uint64 microseconds since the recording started,
+* and the payload in the layout of NPLEncodeMessage().
+*/
+#pragma managed(off)
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "PETypes.h"
+#include "InterprocessQueue.hpp"
+
+#pragma managed(on)
+
+#include "NPLDebugTransport.h"
+
+BEGIN_NAMESPACE
+
+#pragma managed(off)
+
+/** direction of a recorded message */
+enum NPLDebugDirection
+{
+	NPL_DEBUG_DIR_TO_DEBUGGEE = 0,
+	NPL_DEBUG_DIR_FROM_DEBUGGEE = 1,
+};
+
+class CNPLDebugRecorder
+{
+public:
+	CNPLDebugRecorder();
+	~CNPLDebugRecorder();
+
+	/** create the file and start the clock. @return false if the file can not be created. */
+	bool Open(const char* sFileName);
+	void Close();
+
+	/** append a message. It can be called from any thread.
+	* @param nDirection: see NPLDebugDirection */
+	void Record(int nDirection, const ParaEngine::InterProcessMessage& msg);
+
+private:
+	FILE* m_pFile;
+	LARGE_INTEGER m_nFrequency;
+	LARGE_INTEGER m_nStartTime;
+	// guards m_pFile and m_buffer
+	CRITICAL_SECTION m_lock;
+	// reused to avoid allocating for every message.
+	std::string m_buffer;
+};
+
+/** a transport that returns the messages received in a recorded session. */
+class CNPLReplayTransport : public INPLDebugTransport
+{
+public:
+	CNPLReplayTransport();
+	virtual ~CNPLReplayTransport();
+
+	/** load a recorded session.
+	* @param bRecordedPace: true to wait between messages as long as in the recorded session, false to replay as fast as possible.
+	* @return false if the file is missing or malformed. */
+	bool Open(const char* sFileName, bool bRecordedPace);
+
+	virtual const char* GetName() { return "replay"; }
+	/** messages to the debuggee are discarded. */
+	virtual int Send(const ParaEngine::InterProcessMessage& msg, unsigned int nPriority) { return 0; }
+	/** return the next received message of the session. After the last one, it blocks until WakeUp() is called. */
+	virtual int Receive(ParaEngine::InterProcessMessage& msg);
+	virtual void WakeUp();
+
+	/** get the number of replayed messages and the time it took, once the last message is replayed. 
+	* @return true only the first time it is called after the session is over. */
+	bool PopSummary(int& nMessages, int& nMilliseconds);
+
+private:
+	struct ReplayRecord
+	{
+		// microseconds since the recording started
+		unsigned __int64 m_nTime;
+		// in the layout of NPLEncodeMessage(), it is decoded on replay as a live transport does.
+		std::string m_sPayload;
+	};
+	std::vector<ReplayRecord> m_records;
+	size_t m_nNextRecord;
+	bool m_bRecordedPace;
+	HANDLE m_hWakeUpEvent;
+	LARGE_INTEGER m_nFrequency;
+	// set when the first message is replayed
+	LARGE_INTEGER m_nStartTime;
+	// 1 when the last message is replayed, 2 after PopSummary() returned it
+	volatile LONG m_nFinished;
+	// time from the first to the last replayed message
+	int m_nElapsedMs;
+};
+
+#pragma managed(on)
+
+END_NAMESPACE
@@ -0,0 +1,351 @@
+/**
+* Date: 2026.10.17
+* Desc: see NPLDebugTransport.h
+*/
+#include "stdafx.h"
+#include "NPLDebugTransport.h"
+
+#pragma managed(off)
+
+using namespace ParaEngine;
+
+/** milliseconds to wait before connecting again, when the debuggee is not listening. */
+#define NPL_SOCKET_RETRY_INTERVAL 500
+/** milliseconds to wait for a connection to a host that does not answer, such as a machine that is turned off. */
+#define NPL_SOCKET_CONNECT_TIMEOUT 3000
+/** frames larger than this are treated as a broken stream. */
+#define NPL_SOCKET_MAX_FRAME (64*1024*1024)
+/** max bytes of messages kept for sending before the connection is established, such as "Attach". */
+#define NPL_SOCKET_MAX_PENDING (1024*1024)
+
+#pragma region message codec
+
+static void WriteInt32(std::string& out, int nValue)
+{
+	out.append((const char*)&nValue, sizeof(int));
+}
+
+static void WriteString(std::string& out, const std::string& str)
+{
+	DWORD nSize = (DWORD)str.size();
+	out.append((const char*)&nSize, sizeof(DWORD));
+	out.append(str);
+}
+
+static bool ReadInt32(const char*& pData, const char* pEnd, int& nValue)
+{
+	if(pEnd - pData < (int)sizeof(int))
+		return false;
+	memcpy(&nValue, pData, sizeof(int));
+	pData += sizeof(int);
+	return true;
+}
+
+static bool ReadString(const char*& pData, const char* pEnd, std::string& str)
+{
+	DWORD nSize = 0;
+	if(pEnd - pData < (int)sizeof(DWORD))
+		return false;
+	memcpy(&nSize, pData, sizeof(DWORD));
+	pData += sizeof(DWORD);
+	if((DWORD)(pEnd - pData) < nSize)
+		return false;
+	str.assign(pData, nSize);
+	pData += nSize;
+	return true;
+}
+
+void NPLEncodeMessage(const InterProcessMessage& msg, std::string& out)
+{
+	out.clear();
+	WriteInt32(out, msg.m_nMsgType);
+	WriteInt32(out, msg.m_nParam1);
+	WriteInt32(out, msg.m_nParam2);
+	WriteString(out, msg.m_method);
+	WriteString(out, msg.m_from);
+	WriteString(out, msg.m_filename);
+	WriteString(out, msg.m_code);
+}
+
+bool NPLDecodeMessage(const char* pData, size_t nSize, InterProcessMessage& msg)
+{
+	const char* pEnd = pData + nSize;
+	int nMsgType = 0, nParam1 = 0, nParam2 = 0;
+	if(ReadInt32(pData, pEnd, nMsgType) && ReadInt32(pData, pEnd, nParam1) && ReadInt32(pData, pEnd, nParam2) &&
+		ReadString(pData, pEnd, msg.m_method) && ReadString(pData, pEnd, msg.m_from) &&
+		ReadString(pData, pEnd, msg.m_filename) && ReadString(pData, pEnd, msg.m_code))
+	{
+		msg.m_nMsgType = nMsgType;
+		msg.m_nParam1 = nParam1;
+		msg.m_nParam2 = nParam2;
+		return true;
+	}
+	return false;
+}
+
+#pragma endregion message codec
+
+#pragma region CNPLQueueTransport
+
+CNPLQueueTransport::CNPLQueueTransport(const char* sInputName, const char* sOutputName)
+	: m_sInputName(sInputName), m_bWakeUp(0)
+{
+	// always create the queue instead of IPQU_open_or_create, IPQU_create_only.
+	m_pOutputQueue = new CInterprocessQueue(sOutputName, IPQU_open_or_create);
+	m_pOutputQueue->Clear();
+	m_pInputQueue = new CInterprocessQueue(sInputName, IPQU_open_or_create);
+	m_pInputQueue->Clear();
+}
+
+CNPLQueueTransport::~CNPLQueueTransport()
+{
+	SAFE_DELETE(m_pOutputQueue);
+	SAFE_DELETE(m_pInputQueue);
+}
+
+int CNPLQueueTransport::Send(const InterProcessMessage& msg, unsigned int nPriority)
+{
+	return m_pOutputQueue->try_send(msg, nPriority);
+}
+
+int CNPLQueueTransport::Receive(InterProcessMessage& msg)
+{
+	unsigned int nPriority = 0;
+	int nResult = m_pInputQueue->receive(msg, nPriority);
+	// skip "quit" messages that WakeUp() posted to an earlier session of this queue, since the queue outlives the transport.
+	while(nResult == 0 && m_bWakeUp == 0 && msg.m_method == "quit")
+		nResult = m_pInputQueue->receive(msg, nPriority);
+	if(m_bWakeUp != 0)
+		return -1;
+	return nResult;
+}
+
+void CNPLQueueTransport::WakeUp()
+{
+	InterlockedExchange(&m_bWakeUp, 1);
+	// the receiver is blocked in receive(), post a dummy message to our own input queue to wake it up.
+	CInterprocessQueue wakeQueue(m_sInputName.c_str(), IPQU_open_or_create);
+	InterProcessMessage msg_wake;
+	msg_wake.m_method = "quit";
+	wakeQueue.try_send(msg_wake, 0);
+}
+
+void CNPLQueueTransport::Clear()
+{
+	m_pOutputQueue->Clear();
+	m_pInputQueue->Clear();
+}
+
+#pragma endregion CNPLQueueTransport
+
+#pragma region CNPLSocketTransport
+
+CNPLSocketTransport::CNPLSocketTransport(const char* sAddress)
+	: m_socket(INVALID_SOCKET)
+{
+	std::string sAddress_ = sAddress;
+	size_t nPos = sAddress_.rfind(':');
+	if(nPos != std::string::npos)
+	{
+		m_sHost = sAddress_.substr(0, nPos);
+		m_sPort = sAddress_.substr(nPos + 1);
+	}
+	else
+	{
+		m_sHost = sAddress_;
+	}
+	WSADATA wsaData;
+	m_bWSAStarted = (WSAStartup(MAKEWORD(2, 2), &wsaData) == 0);
+	InitializeCriticalSection(&m_lock);
+	m_hWakeUpEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+CNPLSocketTransport::~CNPLSocketTransport()
+{
+	Disconnect();
+	if(m_hWakeUpEvent)
+	{
+		CloseHandle(m_hWakeUpEvent);
+		m_hWakeUpEvent = NULL;
+	}
+	DeleteCriticalSection(&m_lock);
+	if(m_bWSAStarted)
+		WSACleanup();
+}
+
+bool CNPLSocketTransport::Connect()
+{
+	if(!m_bWSAStarted || m_sHost.empty() || m_sPort.empty())
+		return false;
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	addrinfo* pResult = NULL;
+	if(getaddrinfo(m_sHost.c_str(), m_sPort.c_str(), &hints, &pResult) != 0)
+		return false;
+
+	SOCKET s = INVALID_SOCKET;
+	for(addrinfo* pAddr = pResult; pAddr != NULL && s == INVALID_SOCKET && WaitForSingleObject(m_hWakeUpEvent, 0) != WAIT_OBJECT_0; pAddr = pAddr->ai_next)
+	{
+		s = ConnectAddress(pAddr);
+	}
+	freeaddrinfo(pResult);
+	if(s == INVALID_SOCKET)
+		return false;
+
+	// messages are small and latency sensitive, never wait to coalesce them. 
+	BOOL bNoDelay = TRUE;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&bNoDelay, sizeof(bNoDelay));
+
+	EnterCriticalSection(&m_lock);
+	m_socket = s;
+	if(!m_pendingOutput.empty())
+	{
+		// messages sent before the debuggee was listening
+		SendAll(m_pendingOutput.c_str(), (int)m_pendingOutput.size());
+		m_pendingOutput.clear();
+	}
+	LeaveCriticalSection(&m_lock);
+	return true;
+}
+
+SOCKET CNPLSocketTransport::ConnectAddress(const addrinfo* pAddr)
+{
+	SOCKET s = socket(pAddr->ai_family, pAddr->ai_socktype, pAddr->ai_protocol);
+	if(s == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	bool bConnected = false;
+	WSAEVENT hConnectEvent = WSACreateEvent();
+	// WSAEventSelect() also makes the socket non-blocking, so that connect() returns at once. 
+	if(hConnectEvent != WSA_INVALID_EVENT && WSAEventSelect(s, hConnectEvent, FD_CONNECT) == 0)
+	{
+		if(connect(s, pAddr->ai_addr, (int)pAddr->ai_addrlen) == 0)
+		{
+			bConnected = true;
+		}
+		else if(WSAGetLastError() == WSAEWOULDBLOCK)
+		{
+			HANDLE handles[2] = {m_hWakeUpEvent, hConnectEvent};
+			WSANETWORKEVENTS events;
+			bConnected = (WaitForMultipleObjects(2, handles, FALSE, NPL_SOCKET_CONNECT_TIMEOUT) == WAIT_OBJECT_0 + 1) 
+				&& WSAEnumNetworkEvents(s, hConnectEvent, &events) == 0
+				&& (events.lNetworkEvents & FD_CONNECT) != 0 && events.iErrorCode[FD_CONNECT_BIT] == 0;
+		}
+		// back to blocking mode for SendAll() and ReceiveAll(). The event must be deselected before FIONBIO can be cleared. 
+		u_long nNonBlocking = 0;
+		if(bConnected && (WSAEventSelect(s, hConnectEvent, 0) != 0 || ioctlsocket(s, FIONBIO, &nNonBlocking) != 0))
+			bConnected = false;
+	}
+	if(hConnectEvent != WSA_INVALID_EVENT)
+		WSACloseEvent(hConnectEvent);
+	if(!bConnected)
+	{
+		closesocket(s);
+		s = INVALID_SOCKET;
+	}
+	return s;
+}
+
+void CNPLSocketTransport::Disconnect()
+{
+	EnterCriticalSection(&m_lock);
+	if(m_socket != INVALID_SOCKET)
+	{
+		closesocket(m_socket);
+		m_socket = INVALID_SOCKET;
+	}
+	LeaveCriticalSection(&m_lock);
+}
+
+bool CNPLSocketTransport::SendAll(const char* pData, int nSize)
+{
+	while(nSize > 0)
+	{
+		int nSent = send(m_socket, pData, nSize, 0);
+		if(nSent <= 0)
+			return false;
+		pData += nSent;
+		nSize -= nSent;
+	}
+	return true;
+}
+
+int CNPLSocketTransport::Send(const InterProcessMessage& msg, unsigned int nPriority)
+{
+	// the stream is strictly FIFO, priority is ignored.
+	int nResult = -1;
+	EnterCriticalSection(&m_lock);
+	// the frame is sent with a single send() call, so that the size is not sent in a packet of its own. 
+	NPLEncodeMessage(msg, m_sendBuffer);
+	DWORD nSize = (DWORD)m_sendBuffer.size();
+	m_sendBuffer.insert(0, (const char*)&nSize, sizeof(DWORD));
+	if(m_socket != INVALID_SOCKET)
+	{
+		nResult = SendAll(m_sendBuffer.c_str(), (int)m_sendBuffer.size()) ? 0 : -1;
+	}
+	else if(m_pendingOutput.size() + m_sendBuffer.size() <= NPL_SOCKET_MAX_PENDING)
+	{
+		// sent by Connect()
+		m_pendingOutput.append(m_sendBuffer);
+		nResult = 0;
+	}
+	LeaveCriticalSection(&m_lock);
+	return nResult;
+}
+
+bool CNPLSocketTransport::ReceiveAll(SOCKET s, char* pData, int nSize)
+{
+	while(nSize > 0)
+	{
+		int nReceived = recv(s, pData, nSize, 0);
+		if(nReceived <= 0)
+			return false;
+		pData += nReceived;
+		nSize -= nReceived;
+	}
+	return true;
+}
+
+int CNPLSocketTransport::Receive(InterProcessMessage& msg)
+{
+	while(WaitForSingleObject(m_hWakeUpEvent, 0) != WAIT_OBJECT_0)
+	{
+		// only this thread replaces the socket, so it can be read without the lock. 
+		SOCKET s = m_socket;
+		if(s == INVALID_SOCKET)
+		{
+			if(!Connect())
+			{
+				// the debuggee is not listening yet
+				WaitForSingleObject(m_hWakeUpEvent, NPL_SOCKET_RETRY_INTERVAL);
+			}
+			continue;
+		}
+		DWORD nSize = 0;
+		if(ReceiveAll(s, (char*)&nSize, sizeof(DWORD)) && nSize <= NPL_SOCKET_MAX_FRAME)
+		{
+			m_receiveBuffer.resize(nSize);
+			if(nSize == 0 || ReceiveAll(s, &m_receiveBuffer[0], (int)nSize))
+			{
+				return NPLDecodeMessage(m_receiveBuffer.c_str(), m_receiveBuffer.size(), msg) ? 0 : -1;
+			}
+		}
+		// the debuggee closed the connection, wait for it to listen again. 
+		Disconnect();
+	}
+	return -1;
+}
+
+void CNPLSocketTransport::WakeUp()
+{
+	SetEvent(m_hWakeUpEvent);
+	// unblock recv() in the receiver thread
+	EnterCriticalSection(&m_lock);
+	if(m_socket != INVALID_SOCKET)
+		shutdown(m_socket, SD_BOTH);
+	LeaveCriticalSection(&m_lock);
+}
+
+#pragma endregion CNPLSocketTransport
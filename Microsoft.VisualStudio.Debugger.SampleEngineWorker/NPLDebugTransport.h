@@ -0,0 +1,109 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: transports that carry NPL debug messages between the debug engine worker and the debuggee.
+* - CNPLQueueTransport: the default, a pair of CInterprocessQueue, i.e. "NPLDebug"(to debuggee) and "VSDebug"(from debuggee)
+* - CNPLSocketTransport: a TCP connection to a debuggee on another machine, selected with NPL_DEBUG_TRANSPORT=tcp://host:port.
+*/
+#pragma managed(off)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <string>
+#include "PETypes.h"
+#include "InterprocessQueue.hpp"
+
+#pragma managed(on)
+
+BEGIN_NAMESPACE
+
+#pragma managed(off)
+
+/** serialize a message into a flat buffer. The layout is used by the recording file and the socket transport:
+* int32 type, int32 param1, int32 param2, followed by method, from, filename, code, each as uint32 length + bytes.
+*/
+void NPLEncodeMessage(const ParaEngine::InterProcessMessage& msg, std::string& out);
+/** @return false if the buffer is truncated. */
+bool NPLDecodeMessage(const char* pData, size_t nSize, ParaEngine::InterProcessMessage& msg);
+
+class INPLDebugTransport
+{
+public:
+	virtual ~INPLDebugTransport() {}
+	virtual const char* GetName() = 0;
+	/** send without blocking. return 0 if succeed, the same as CInterprocessQueue::try_send. */
+	virtual int Send(const ParaEngine::InterProcessMessage& msg, unsigned int nPriority) = 0;
+	/** block until a message is received or WakeUp() is called. return 0 if a message is received. */
+	virtual int Receive(ParaEngine::InterProcessMessage& msg) = 0;
+	/** make any pending and future Receive() calls return immediately. */
+	virtual void WakeUp() = 0;
+	/** remove pending messages in both directions. */
+	virtual void Clear() {}
+};
+
+/** the default transport using boost message queues. */
+class CNPLQueueTransport : public INPLDebugTransport
+{
+public:
+	/** @param sInputName: queue to read from. @param sOutputName: queue to write to.*/
+	CNPLQueueTransport(const char* sInputName, const char* sOutputName);
+	virtual ~CNPLQueueTransport();
+
+	virtual const char* GetName() { return "queue"; }
+	virtual int Send(const ParaEngine::InterProcessMessage& msg, unsigned int nPriority);
+	virtual int Receive(ParaEngine::InterProcessMessage& msg);
+	virtual void WakeUp();
+	virtual void Clear();
+
+private:
+	std::string m_sInputName;
+	ParaEngine::CInterprocessQueue* m_pInputQueue;
+	ParaEngine::CInterprocessQueue* m_pOutputQueue;
+	volatile LONG m_bWakeUp;
+};
+
+/** a TCP connection to the debug listener of the debuggee, see script/ide/Debugger/IPCSocketTransport.lua. 
+* Each message is framed as uint32 size + NPLEncodeMessage(). Nagle's algorithm is disabled, so that small control messages 
+* such as "step" are sent immediately. The connection is (re)established by the receiver thread. 
+*/
+class CNPLSocketTransport : public INPLDebugTransport
+{
+public:
+	/** @param sAddress: "host:port" of the debuggee */
+	CNPLSocketTransport(const char* sAddress);
+	virtual ~CNPLSocketTransport();
+
+	virtual const char* GetName() { return "tcp"; }
+	/** messages sent before the connection is established are kept and sent on connect. */
+	virtual int Send(const ParaEngine::InterProcessMessage& msg, unsigned int nPriority);
+	/** connect on demand, and keep retrying until the debuggee is listening or WakeUp() is called. 
+	* WakeUp() also interrupts a connection attempt that is in progress. */
+	virtual int Receive(ParaEngine::InterProcessMessage& msg);
+	virtual void WakeUp();
+
+private:
+	bool Connect();
+	/** connect to a single resolved address without blocking beyond NPL_SOCKET_CONNECT_TIMEOUT or WakeUp(). 
+	* @return the connected socket in blocking mode, or INVALID_SOCKET. */
+	SOCKET ConnectAddress(const addrinfo* pAddr);
+	void Disconnect();
+	/** the caller should lock m_lock. */
+	bool SendAll(const char* pData, int nSize);
+	bool ReceiveAll(SOCKET s, char* pData, int nSize);
+
+	std::string m_sHost;
+	std::string m_sPort;
+	bool m_bWSAStarted;
+	// only replaced by the receiver thread. It is guarded by m_lock, since messages are sent from other threads. 
+	SOCKET m_socket;
+	HANDLE m_hWakeUpEvent;
+	CRITICAL_SECTION m_lock;
+	// reused to avoid allocating for every message. 
+	std::string m_sendBuffer;
+	std::string m_receiveBuffer;
+	// frames waiting for the connection. It is guarded by m_lock. 
+	std::string m_pendingOutput;
+};
+
+#pragma managed(on)
+
+END_NAMESPACE
@@ -0,0 +1,165 @@
+/**
+* Date: 2026.10.17
+* Desc: see NPLFileIdStore.h
+*/
+#include "stdafx.h"
+#include "NPLFileIdStore.h"
+
+#pragma managed(off)
+
+#define NPL_FILE_STORE_HEADER "NPLFIDS1\n"
+#define NPL_FILE_STORE_HEADER_SIZE 9
+
+#pragma region CNPLFileIdStore
+
+CNPLFileIdStore::CNPLFileIdStore()
+	: m_hFile(INVALID_HANDLE_VALUE), m_hMapping(NULL), m_pView(NULL), m_nMappedSize(0), m_nParsedSize(0)
+{
+	InitializeCriticalSection(&m_lock);
+}
+
+CNPLFileIdStore::~CNPLFileIdStore()
+{
+	CloseUnlocked();
+	DeleteCriticalSection(&m_lock);
+}
+
+bool CNPLFileIdStore::Open(const char* sFileName)
+{
+	EnterCriticalSection(&m_lock);
+	CloseUnlocked();
+	// the debuggee keeps appending to the file while we map it
+	m_hFile = ::CreateFileA(sFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	bool bOpened = (m_hFile != INVALID_HANDLE_VALUE);
+	if(bOpened && (!Refresh() || m_nMappedSize < NPL_FILE_STORE_HEADER_SIZE || memcmp(m_pView, NPL_FILE_STORE_HEADER, NPL_FILE_STORE_HEADER_SIZE) != 0))
+	{
+		CloseUnlocked();
+		bOpened = false;
+	}
+	LeaveCriticalSection(&m_lock);
+	return bOpened;
+}
+
+void CNPLFileIdStore::Close()
+{
+	EnterCriticalSection(&m_lock);
+	CloseUnlocked();
+	LeaveCriticalSection(&m_lock);
+}
+
+bool CNPLFileIdStore::IsOpen()
+{
+	EnterCriticalSection(&m_lock);
+	bool bOpen = (m_hFile != INVALID_HANDLE_VALUE);
+	LeaveCriticalSection(&m_lock);
+	return bOpen;
+}
+
+unsigned int CNPLFileIdStore::GetCount()
+{
+	EnterCriticalSection(&m_lock);
+	unsigned int nCount = (unsigned int)m_lines.size();
+	LeaveCriticalSection(&m_lock);
+	return nCount;
+}
+
+void CNPLFileIdStore::CloseUnlocked()
+{
+	if(m_pView)
+	{
+		UnmapViewOfFile(m_pView);
+		m_pView = NULL;
+	}
+	if(m_hMapping)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+	}
+	if(m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+	m_nMappedSize = 0;
+	m_nParsedSize = 0;
+	m_lines.clear();
+}
+
+bool CNPLFileIdStore::Refresh()
+{
+	if(m_hFile == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD nFileSize = ::GetFileSize(m_hFile, NULL);
+	if(nFileSize == INVALID_FILE_SIZE || nFileSize == 0)
+		return false;
+	if(nFileSize < m_nParsedSize)
+	{
+		// the debuggee truncated the table on a new attach, the ids of the old one are gone
+		m_lines.clear();
+		m_nParsedSize = 0;
+	}
+	if(nFileSize != m_nMappedSize)
+	{
+		if(m_pView)
+		{
+			UnmapViewOfFile(m_pView);
+			m_pView = NULL;
+		}
+		if(m_hMapping)
+		{
+			CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+		}
+		m_nMappedSize = 0;
+		m_hMapping = ::CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, nFileSize, NULL);
+		if(m_hMapping == NULL)
+			return false;
+		m_pView = (const char*)::MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, nFileSize);
+		if(m_pView == NULL)
+			return false;
+		m_nMappedSize = nFileSize;
+	}
+
+	if(m_nParsedSize == 0)
+	{
+		// skip the header, which is checked by Open()
+		m_nParsedSize = (m_nMappedSize < NPL_FILE_STORE_HEADER_SIZE) ? m_nMappedSize : NPL_FILE_STORE_HEADER_SIZE;
+	}
+	DWORD nLineStart = m_nParsedSize;
+	for (DWORD i = m_nParsedSize; i < m_nMappedSize; ++i)
+	{
+		if(m_pView[i] == '\n')
+		{
+			LineRef line;
+			line.m_nOffset = nLineStart;
+			line.m_nSize = i - nLineStart;
+			if(line.m_nSize > 0 && m_pView[i - 1] == '\r')
+				--line.m_nSize;
+			m_lines.push_back(line);
+			nLineStart = i + 1;
+		}
+	}
+	m_nParsedSize = nLineStart;
+	return true;
+}
+
+bool CNPLFileIdStore::GetFileName(unsigned int nFileId, std::string& sFileName)
+{
+	if(nFileId == 0)
+		return false;
+	EnterCriticalSection(&m_lock);
+	bool bFound = true;
+	if(nFileId > m_lines.size() || m_pView == NULL)
+	{
+		bFound = Refresh() && nFileId <= m_lines.size();
+	}
+	if(bFound)
+	{
+		const LineRef& line = m_lines[nFileId - 1];
+		sFileName.assign(m_pView + line.m_nOffset, line.m_nSize);
+	}
+	LeaveCriticalSection(&m_lock);
+	return bFound;
+}
+
+#pragma endregion CNPLFileIdStore
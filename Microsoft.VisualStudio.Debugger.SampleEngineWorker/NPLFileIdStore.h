@@ -0,0 +1,67 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: the file id table of a debuggee NPL state, so that binary "BP" messages can refer to files by bare ids.
+* The debuggee owns the file: it is "temp/debugger/<queue name>.fileids" in its working directory, and the debuggee appends a file name
+* before it sends the first id of that file. It is an append-only file that both sides open, rather than a shared memory mapping,
+* since the debuggee can only write files from lua. The debuggee truncates it on every attach, so the worker closes its mapping before sending "Attach",
+* and parses the table from the start whenever the file is shorter than what it has parsed.
+* The layout is the header line "NPLFIDS1" followed by one file name per line, the id of a file is its line number after the header (starting from 1).
+* The worker maps the file read only, and maps it again whenever an id beyond the parsed lines is seen.
+* All methods are thread safe, since the poll thread and the UI thread both resolve ids.
+*/
+#pragma managed(off)
+#include <string>
+#include <vector>
+#include "PETypes.h"
+
+#pragma managed(on)
+
+BEGIN_NAMESPACE
+
+#pragma managed(off)
+
+class CNPLFileIdStore
+{
+public:
+	CNPLFileIdStore();
+	~CNPLFileIdStore();
+
+	/** map the file written by the debuggee, closing the previous one. @return false if the file is missing or has no valid header. */
+	bool Open(const char* sFileName);
+	void Close();
+	bool IsOpen();
+
+	/** get the file name of an id. If the id is not parsed yet, the file is mapped again to read the lines appended since.
+	* @return false if the debuggee never wrote the id. */
+	bool GetFileName(unsigned int nFileId, std::string& sFileName);
+
+	/** number of file ids parsed so far */
+	unsigned int GetCount();
+
+private:
+	/** map the whole file again if it has grown, and parse complete lines after m_nParsedSize. The caller must hold m_lock. */
+	bool Refresh();
+	/** the caller must hold m_lock. */
+	void CloseUnlocked();
+
+	struct LineRef
+	{
+		// offset and length in the file, since the view moves when the file is mapped again.
+		DWORD m_nOffset;
+		DWORD m_nSize;
+	};
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	const char* m_pView;
+	DWORD m_nMappedSize;
+	// bytes of complete lines parsed, the debuggee may be in the middle of writing the last line.
+	DWORD m_nParsedSize;
+	// m_lines[id-1]
+	std::vector<LineRef> m_lines;
+	CRITICAL_SECTION m_lock;
+};
+
+#pragma managed(on)
+
+END_NAMESPACE
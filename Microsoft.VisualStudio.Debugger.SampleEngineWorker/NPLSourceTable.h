@@ -0,0 +1,212 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: file names and source locations of the NPL debugger, which roughly simulate a symbol server.
+* NPL source locations are bound to addresses, so that breakpoints and stack frames can be shown by the native debugger interfaces.
+* It is used by DebuggedProcess, and by the native tests in Tests/.
+*/
+
+BEGIN_NAMESPACE
+
+public ref class NPLSourceTable sealed
+{
+public:
+	NPLSourceTable() {
+		m_workingDir = "";
+	}
+
+	// return the file name relative to the working directory, lower cased with forward slashes, as used by the NPL runtime.
+	String^ GetRelativeFilePath(String^ filePath)
+	{
+		if(String::IsNullOrEmpty(filePath))
+			return "";
+		msclr::lock lock(m_raw_string_to_id);
+		String^ out;
+		if(!m_raw_to_relative_path->TryGetValue(filePath, out)){
+			out = MakeRelativeFilePath(filePath);
+			m_raw_to_relative_path->Add(filePath, out);
+		}
+		return out;
+	}
+
+	// return the file id of a full or relative file name, which is interned on first use. 0 is the empty file name.
+	unsigned int GetIdByString(String^ str){
+		if(String::IsNullOrEmpty(str))
+			return 0;
+		msclr::lock lock(m_raw_string_to_id);
+		unsigned int out = 0;
+		if(!m_raw_string_to_id->TryGetValue(str, out)){
+			out = InternFileName(str);
+			m_raw_string_to_id->Add(str, out);
+		}
+		return out;
+	}
+
+	String^ GetStringById( unsigned int id) {
+		if(id < (unsigned int)m_id_to_string->Count){
+			return m_id_to_string[id];
+		}
+		return "";
+	}
+
+	// number of file ids, including 0 for the empty file name
+	property int FileCount
+	{
+		int get() {
+			msclr::lock lock(m_raw_string_to_id);
+			return m_id_to_string->Count;
+		}
+	}
+
+	// return an unsigned int address from filename, line and column number. Address 0 is never used.
+	// this will roughly simulate a symbol server and compatible with native debugger address
+	unsigned int GetAddressByFileLine(String^ filename, int line, int column){
+		// lines beyond 24 bits and columns beyond 8 bits are clamped
+		UInt64 nLine = (UInt64)Math::Min(Math::Max(line, 0), 0xFFFFFF);
+		UInt64 nColumn = (UInt64)Math::Min(Math::Max(column, 0), 0xFF);
+		UInt64 location = ((UInt64)GetIdByString(filename) << 32) | (nLine << 8) | nColumn;
+		msclr::lock lock(m_location_to_address);
+		unsigned int address = 0;
+		if(!m_location_to_address->TryGetValue(location, address)){
+			m_address_to_location->Add(location);
+			address = (unsigned int)m_address_to_location->Count;
+			m_location_to_address->Add(location, address);
+		}
+		return address;
+	}
+	unsigned int GetAddressByFileLine(String^ filename, int line){
+		return GetAddressByFileLine(filename, line, 0);
+	}
+
+	// get filename, line and column number from unsigned int address
+	// this will roughly simulate a symbol server and compatible with native debugger address
+	void GetFileLineByAddress(unsigned int address, String^% filename, int% line, int% column){
+		UInt64 location = 0;
+		{
+			msclr::lock lock(m_location_to_address);
+			if(address > 0 && address <= (unsigned int)m_address_to_location->Count)
+				location = m_address_to_location[address - 1];
+		}
+		filename = GetStringById((unsigned int)(location >> 32));
+		line = (int)((location >> 8) & 0xFFFFFF);
+		column = (int)(location & 0xFF);
+	}
+	void GetFileLineByAddress(unsigned int address, String^% filename, int% line){
+		int column = 0;
+		GetFileLineByAddress(address, filename, line, column);
+	}
+
+	void SetWorkingDir(String^ workingDir) {
+		workingDir = workingDir->Replace("\\", "/");
+		if(!workingDir->EndsWith("/"))
+		{
+			workingDir += "/";
+		}
+		workingDir = workingDir->ToLower();
+
+		msclr::lock lock(m_raw_string_to_id);
+		if(!String::Equals(m_workingDir, workingDir))
+		{
+			// relative paths depend on the working directory, so all names are mapped again.
+			// file ids are kept, since addresses of bound breakpoints and frames refer to them.
+			m_workingDir = workingDir;
+			m_raw_string_to_id->Clear();
+			m_raw_to_relative_path->Clear();
+			m_string_to_id->Clear();
+			for (int i = 1; i < m_id_to_string->Count; ++i)
+			{
+				AddFileNames(m_id_to_string[i], (unsigned int)i);
+			}
+		}
+	}
+
+private:
+	String^ MakeRelativeFilePath(String^ filePath)
+	{
+		filePath = filePath->Replace("\\", "/");
+		filePath = filePath->ToLower();
+		// Add lower cased and stripping working directory path as well. This is relative path used by NPL runtime.
+		int nIndex = filePath->IndexOf(m_workingDir);
+		if(nIndex == 0)
+		{
+			return filePath->Substring(m_workingDir->Length);
+		}
+		return filePath;
+	}
+
+	// the caller should lock m_raw_string_to_id
+	unsigned int InternFileName(String^ str){
+		unsigned int out = 0;
+		str = str->ToLower();
+		if(m_string_to_id->TryGetValue(str, out)){
+			return out;
+		}
+		else{
+			unsigned int nFileId = (unsigned int)m_id_to_string->Count;
+			// add full path as used by visual studio to locate file path
+			m_id_to_string->Add(str);
+			AddFileNames(str, nFileId);
+			out = nFileId;
+		}
+		return out;
+	}
+
+	// add both full path and relative to working dir path of a lower cased file name to m_string_to_id.
+	// the caller should lock m_raw_string_to_id
+	void AddFileNames(String^ fullpath, unsigned int nFileId){
+		String^ str = fullpath->Replace("\\", "/");
+		bool isFullPath = str->IndexOf(":") > 0;
+		if (isFullPath)
+		{
+			// add relative path used by NPL runtime as well.
+			int nIndex = str->IndexOf(m_workingDir);
+			if (nIndex == 0)
+			{
+				// stripping working directory
+				str = str->Substring(m_workingDir->Length);
+				m_string_to_id[str] = nFileId;
+			}
+			else
+			{
+				// get relative path by finding the first "script/" or "source/" or "src/"
+				nIndex = str->IndexOf("script/");
+				if (nIndex < 0)
+				{
+					nIndex = str->IndexOf("source/");
+					if (nIndex < 0)
+						nIndex = str->IndexOf("src/");
+				}
+				if (nIndex >= 0)
+				{
+					// add relative path.
+					str = str->Substring(nIndex);
+					m_string_to_id[str] = nFileId;
+				}
+			}
+		}
+		m_string_to_id[fullpath] = nFileId;
+	}
+
+	// full path of file name indexed by file id. ids are dense, so reverse lookup is O(1) and the number of files is not limited.
+	// id 0 is the empty file name, which is also returned for unknown ids.
+	Collections::Generic::List<String^>^ m_id_to_string = gcnew Collections::Generic::List<String^>(gcnew cli::array<String^>{ "" });
+	// mapping from both relative and full path to file id.
+	Collections::Generic::Dictionary<String^, unsigned int>^ m_string_to_id = gcnew Collections::Generic::Dictionary<String^, unsigned int>();
+	// NPL source locations indexed by address - 1, each packed as file id(32 bits) | line(24 bits) | column(8 bits).
+	// Addresses must fit in the 32 bits Eip of X86ThreadContext, so they are dense indices into this table instead of the packed locations.
+	Collections::Generic::List<UInt64>^ m_address_to_location = gcnew Collections::Generic::List<UInt64>();
+	// mapping from packed location to address. It also guards m_address_to_location, since addresses are bound on both the poll and UI threads.
+	Collections::Generic::Dictionary<UInt64, unsigned int>^ m_location_to_address = gcnew Collections::Generic::Dictionary<UInt64, unsigned int>();
+
+	// file names as received from the debuggee or visual studio, mapping to file id. Names repeat for every frame of every stop,
+	// so lookups by the raw string avoid allocating canonical paths on hits. It has the same lifetime as m_string_to_id,
+	// and both are rebuilt when the working directory changes, see SetWorkingDir(). Its lock guards all file name tables.
+	Collections::Generic::Dictionary<String^, unsigned int>^ m_raw_string_to_id = gcnew Collections::Generic::Dictionary<String^, unsigned int>(StringComparer::Ordinal);
+	// the same for GetRelativeFilePath(), it is guarded by the lock of m_raw_string_to_id.
+	Collections::Generic::Dictionary<String^, String^>^ m_raw_to_relative_path = gcnew Collections::Generic::Dictionary<String^, String^>(StringComparer::Ordinal);
+
+	// lower cased forward slash /, that ends with /
+	String^ m_workingDir;
+};
+
+END_NAMESPACE
@@ -0,0 +1,24 @@
+/**
+* Date: 2026.10.17
+* Desc: native tests of the debug engine worker that do not need visual studio or a debuggee.
+* They are built by NPLDebugEngineTests.vcxproj in this folder as a console program with the include paths of the worker project, 
+* and run in this folder, since some tests read recorded sessions in data/. 
+* Tests of the managed classes of the worker are compiled with /clr. The program returns the number of failed checks.
+*/
+#include "stdafx.h"
+#include "NPLTest.h"
+
+int g_nFailedChecks = 0;
+
+int main(int argc, char** argv)
+{
+	TestNPLDebugCodec();
+	TestNPLFileIdStore();
+	TestNPLSocketTransport();
+	TestNPLReplay();
+	TestNPLDebugMailbox();
+	TestNPLSourceTable();
+	TestNPLDebugLane();
+	printf("%d checks failed\n", g_nFailedChecks);
+	return g_nFailedChecks;
+}
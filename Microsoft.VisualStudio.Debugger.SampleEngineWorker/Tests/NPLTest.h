@@ -0,0 +1,20 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: a minimal check macro for the native tests of the debug engine worker, see NPLDebugEngineTests.cpp
+*/
+#include <stdio.h>
+
+/** number of failed checks of the current run. */
+extern int g_nFailedChecks;
+
+#define NPL_CHECK(expr) \
+	do { if(!(expr)) { ++g_nFailedChecks; printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); } } while(0)
+
+void TestNPLDebugCodec();
+void TestNPLFileIdStore();
+void TestNPLSocketTransport();
+void TestNPLReplay();
+void TestNPLDebugMailbox();
+void TestNPLSourceTable();
+void TestNPLDebugLane();
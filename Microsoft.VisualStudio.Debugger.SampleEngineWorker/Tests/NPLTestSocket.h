@@ -0,0 +1,62 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: a plain loopback socket standing in for the debuggee of CNPLSocketTransport, which is shared by the tests of the transport, the mailbox and the lanes.
+* The caller should call WSAStartup() first.
+*/
+#include "NPLDebugTransport.h"
+
+#pragma managed(off)
+
+/** listen on an ephemeral loopback port. */
+inline SOCKET Listen(int& nPort)
+{
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	int nSize = sizeof(addr);
+	if(bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 1) != 0 || getsockname(s, (sockaddr*)&addr, &nSize) != 0)
+	{
+		closesocket(s);
+		return INVALID_SOCKET;
+	}
+	nPort = ntohs(addr.sin_port);
+	return s;
+}
+
+inline bool ReceiveAll(SOCKET s, char* pData, int nSize)
+{
+	while(nSize > 0)
+	{
+		int nReceived = recv(s, pData, nSize, 0);
+		if(nReceived <= 0)
+			return false;
+		pData += nReceived;
+		nSize -= nReceived;
+	}
+	return true;
+}
+
+/** read a frame of the transport: uint32 size followed by the message in the layout of NPLEncodeMessage(). */
+inline bool ReceiveFrame(SOCKET s, ParaEngine::InterProcessMessage& msg)
+{
+	DWORD nSize = 0;
+	if(!ReceiveAll(s, (char*)&nSize, sizeof(DWORD)))
+		return false;
+	std::string payload(nSize, '\0');
+	return (nSize == 0 || ReceiveAll(s, &payload[0], (int)nSize)) && NPLDecodeMessage(payload.c_str(), payload.size(), msg);
+}
+
+inline bool SendFrame(SOCKET s, const ParaEngine::InterProcessMessage& msg)
+{
+	std::string payload;
+	NPLEncodeMessage(msg, payload);
+	DWORD nSize = (DWORD)payload.size();
+	payload.insert(0, (const char*)&nSize, sizeof(DWORD));
+	return send(s, payload.c_str(), (int)payload.size(), 0) == (int)payload.size();
+}
+
+#pragma managed(on)
@@ -0,0 +1,57 @@
+#pragma once
+/**
+* Date: 2026.10.17
+* Desc: writers of binary "BP" and "StackFrames" messages for the tests, the same as bp_write_varint(), bp_write_string(), bp_write_file() 
+* and bp_write_frames() in script/ide/Debugger/IPCDebugger.lua.
+*/
+#pragma managed(off)
+#include <string>
+#include <map>
+
+/** the same as bp_write_varint() in IPCDebugger.lua */
+inline void WriteVarint(std::string& out, unsigned int nValue)
+{
+	while(nValue >= 64)
+	{
+		out += (char)(0xC0 + nValue % 64);
+		nValue /= 64;
+	}
+	out += (char)(0x80 + nValue);
+}
+
+inline void WriteString(std::string& out, const std::string& str)
+{
+	WriteVarint(out, (unsigned int)str.size());
+	out += str;
+}
+
+/** file ids of a debuggee state, which sends the file name with the first reference of each file. */
+class CNPLTestFileIds
+{
+public:
+	void WriteFile(std::string& out, const std::string& sFileName)
+	{
+		std::map<std::string, unsigned int>::iterator itCur = m_fileIds.find(sFileName);
+		if(itCur != m_fileIds.end())
+		{
+			WriteVarint(out, itCur->second * 2);
+			return;
+		}
+		unsigned int nFileId = (unsigned int)m_fileIds.size() + 1;
+		m_fileIds[sFileName] = nFileId;
+		WriteVarint(out, nFileId * 2 + 1);
+		WriteString(out, sFileName);
+	}
+
+	void WriteFrame(std::string& out, const std::string& sFileName, int nCurrentLine, const std::string& sName)
+	{
+		WriteFile(out, sFileName);
+		WriteVarint(out, (unsigned int)(nCurrentLine + 1));
+		WriteString(out, sName);
+	}
+
+private:
+	std::map<std::string, unsigned int> m_fileIds;
+};
+
+#pragma managed(on)
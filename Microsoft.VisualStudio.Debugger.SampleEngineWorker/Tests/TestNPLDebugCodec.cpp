@@ -0,0 +1,88 @@
+/**
+* Date: 2026.10.17
+* Desc: the varint and string readers of binary "BP" messages, against bytes written the way IPCDebugger.lua writes them.
+*/
+#include "stdafx.h"
+#include "NPLDebugCodec.h"
+#include "NPLTest.h"
+#include "NPLTestWriter.h"
+
+namespace
+{
+	bool ReadVarint(const std::string& data, unsigned int& nValue, size_t& nRead)
+	{
+		const char* pData = data.c_str();
+		bool bResult = NPLReadVarint(pData, data.c_str() + data.size(), nValue);
+		nRead = pData - data.c_str();
+		return bResult;
+	}
+
+	void TestVarint()
+	{
+		unsigned int nValue = 0;
+		size_t nRead = 0;
+		NPL_CHECK(ReadVarint("\x80", nValue, nRead) && nValue == 0 && nRead == 1);
+		NPL_CHECK(ReadVarint("\xBF", nValue, nRead) && nValue == 63 && nRead == 1);
+		NPL_CHECK(ReadVarint("\xC0\x81", nValue, nRead) && nValue == 64 && nRead == 2);
+		// 1000 = 40 + 15*64
+		NPL_CHECK(ReadVarint("\xE8\x8F", nValue, nRead) && nValue == 1000 && nRead == 2);
+		// only the first varint is read
+		NPL_CHECK(ReadVarint("\x81\x82", nValue, nRead) && nValue == 1 && nRead == 1);
+
+		const unsigned int values[] = {0, 1, 63, 64, 65, 4095, 4096, 262143, 262144, 0x7FFFFFFF, 0xFFFFFFFF};
+		for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+		{
+			std::string data;
+			WriteVarint(data, values[i]);
+			NPL_CHECK(data.find('\0') == std::string::npos);
+			NPL_CHECK(ReadVarint(data, nValue, nRead) && nValue == values[i] && nRead == data.size());
+		}
+	}
+
+	void TestMalformedVarint()
+	{
+		unsigned int nValue = 0;
+		size_t nRead = 0;
+		NPL_CHECK(!ReadVarint("", nValue, nRead));
+		// bit 7 is never clear
+		NPL_CHECK(!ReadVarint("\x01", nValue, nRead));
+		// the message ends before the last byte
+		NPL_CHECK(!ReadVarint("\xC0", nValue, nRead));
+		NPL_CHECK(!ReadVarint("\xC0\xC0", nValue, nRead));
+		// more than 32 bits
+		NPL_CHECK(!ReadVarint("\xC0\xC0\xC0\xC0\xC0\xC0\x81", nValue, nRead));
+	}
+
+	void TestString()
+	{
+		std::string data;
+		WriteVarint(data, 3);
+		data += "abc";
+		WriteVarint(data, 0);
+		WriteVarint(data, 100);
+		data += std::string(100, 'x');
+
+		const char* pData = data.c_str();
+		const char* pEnd = pData + data.size();
+		std::string str;
+		NPL_CHECK(NPLReadString(pData, pEnd, str) && str == "abc");
+		NPL_CHECK(NPLReadString(pData, pEnd, str) && str.empty());
+		NPL_CHECK(NPLReadString(pData, pEnd, str) && str == std::string(100, 'x'));
+		NPL_CHECK(pData == pEnd);
+		NPL_CHECK(!NPLReadString(pData, pEnd, str));
+
+		// the length is longer than the rest of the message
+		std::string truncated;
+		WriteVarint(truncated, 4);
+		truncated += "abc";
+		pData = truncated.c_str();
+		NPL_CHECK(!NPLReadString(pData, pData + truncated.size(), str));
+	}
+}
+
+void TestNPLDebugCodec()
+{
+	TestVarint();
+	TestMalformedVarint();
+	TestString();
+}
@@ -0,0 +1,297 @@
+/**
+* Date: 2026.10.17
+* Desc: NPLLaneTable, and 16 NPL states breaking through the mailbox over a loopback CNPLSocketTransport. 
+* Each message is routed to its lane by m_from as the poll thread does, and each lane counts its own stops.
+* A lane decodes a "BP" message with the top frames of the stack, and the other frames of the "stackrange" reply of the same stop.
+* It is compiled as managed code, see NPLDebugEngineTests.vcxproj.
+*/
+#include "stdafx.h"
+#include "ProjInclude.h"
+#include "NPLDebugMailbox.h"
+#include "NPLDebugLane.h"
+#include "NPLTest.h"
+#include "NPLTestSocket.h"
+#include "NPLTestWriter.h"
+
+using namespace ParaEngine;
+
+namespace
+{
+	const int g_nLaneCount = 16;
+	const int g_nRounds = 50;
+	const char* g_sMainQueue = "NPLDebug";
+	// frames in "BP" messages, the same as NPL_STACK_PAGE_SIZE of WorkerAPI.cpp
+	const int g_nStackPage = 16;
+	const int g_nStackDepth = 50;
+
+	/** the main lane is state 0, the others use NPL_MAIN_LANE_QUEUE + "_" + state name as the worker expects. */
+	std::string GetQueueName(int nState)
+	{
+		if(nState == 0)
+			return g_sMainQueue;
+		char sQueueName[64];
+		_snprintf(sQueueName, sizeof(sQueueName), "%s_state%d", g_sMainQueue, nState);
+		return sQueueName;
+	}
+
+	bool SendFromState(SOCKET debuggee, const std::string& sQueueName, int nMsgType, const char* sName, int nParam1, int nParam2, const char* sCode)
+	{
+		InterProcessMessage msg;
+		msg.m_method = "debug";
+		msg.m_from = sQueueName;
+		msg.m_filename = sName;
+		msg.m_nMsgType = nMsgType;
+		msg.m_nParam1 = nParam1;
+		msg.m_nParam2 = nParam2;
+		msg.m_code = sCode;
+		return SendFrame(debuggee, msg);
+	}
+
+	NPLLaneTable^ CreateLanes()
+	{
+		NPLLaneTable^ lanes = gcnew NPLLaneTable(gcnew String(g_sMainQueue));
+		for(int i = 1; i < g_nLaneCount; ++i)
+		{
+			std::string sQueueName = GetQueueName(i);
+			lanes->AddLane(String::Format("state{0}", i), gcnew String(sQueueName.c_str()));
+		}
+		return lanes;
+	}
+
+	void TestLaneTable()
+	{
+		NPLLaneTable^ lanes = CreateLanes();
+		NPL_CHECK(lanes->MainLane->m_dwThreadId == 0 && String::Equals(lanes->MainLane->m_sName, "main"));
+		for(int i = 1; i < g_nLaneCount; ++i)
+		{
+			NPLDebugLane^ lane = lanes->GetLane(gcnew String(GetQueueName(i).c_str()));
+			NPL_CHECK(lane != lanes->MainLane && lane->m_dwThreadId == (DWORD)i);
+			NPL_CHECK(lanes->GetLaneByThread((DWORD)i) == lane);
+		}
+		// unknown queues are the main lane
+		NPL_CHECK(lanes->GetLane(nullptr) == lanes->MainLane);
+		NPL_CHECK(lanes->GetLane("") == lanes->MainLane);
+		NPL_CHECK(lanes->GetLane("NPLDebug_unknown") == lanes->MainLane);
+		NPL_CHECK(lanes->GetLaneByThread(g_nLaneCount) == nullptr);
+		// a queue has one lane
+		NPL_CHECK(lanes->AddLane("again", gcnew String(GetQueueName(1).c_str())) == nullptr);
+		NPL_CHECK(lanes->AddLane("empty", "") == nullptr);
+
+		NPLDebugLane^ lane = lanes->GetLaneByThread(1);
+		NPL_CHECK(!lanes->RemoveLane(lanes->MainLane));
+		NPL_CHECK(lanes->RemoveLane(lane));
+		NPL_CHECK(lanes->GetLane(lane->m_sQueueName) == lanes->MainLane && lanes->GetLaneByThread(1) == nullptr);
+		// thread ids are not reused, since the debugger may still show the thread of the removed lane
+		NPLDebugLane^ added = lanes->AddLane("state1", lane->m_sQueueName);
+		NPL_CHECK(added != nullptr && added->m_dwThreadId == (DWORD)g_nLaneCount);
+	}
+
+	/** pop the "BP" messages of a round, and break the lanes they are routed to. 
+	* Each message has the stop count of its state in param1, which the lane must count the same. 
+	* @return the number of messages that went to the wrong lane or stop. */
+	int BreakLanes(CNPLDebugMailbox& mailbox, NPLLaneTable^ lanes, int nMessages)
+	{
+		int nMismatches = 0;
+		for(int i = 0; i < nMessages; ++i)
+		{
+			InterProcessMessagePtr msg;
+			if(!mailbox.Pop(msg, 5000) || !msg)
+				return nMismatches + nMessages - i;
+			NPLDebugLane^ lane = lanes->GetLane(gcnew String(msg->m_from.c_str()));
+			if(msg->m_filename != "BP" || !String::Equals(lane->m_sQueueName, gcnew String(msg->m_from.c_str())) || lane->OnBreak() != msg->m_nParam1)
+				++nMismatches;
+		}
+		return nMismatches;
+	}
+
+	/** frame i (0 is the top) of the stopped stack, which is in one of 3 files. */
+	void WriteTestFrame(CNPLTestFileIds& fileIds, std::string& out, int i)
+	{
+		char sFileName[64], sName[64];
+		_snprintf(sFileName, sizeof(sFileName), "script/f%d.lua", i % 3);
+		_snprintf(sName, sizeof(sName), "func%d", i);
+		fileIds.WriteFrame(out, sFileName, i + 10, sName);
+	}
+
+	/** the "BP" message of a break at script/f0.lua:10, with the top frames and the stack depth. */
+	std::string WriteBreakpoint(CNPLTestFileIds& fileIds)
+	{
+		std::string sCode;
+		WriteVarint(sCode, 10 + 1);
+		fileIds.WriteFile(sCode, "script/f0.lua");
+		WriteVarint(sCode, g_nStackPage);
+		for(int i = 0; i < g_nStackPage; ++i)
+			WriteTestFrame(fileIds, sCode, i);
+		WriteVarint(sCode, g_nStackDepth);
+		return sCode;
+	}
+
+	/** the "StackFrames" reply to "stackrange" for the frames after the top ones. */
+	std::string WriteStackRange(CNPLTestFileIds& fileIds)
+	{
+		std::string sReply;
+		WriteVarint(sReply, g_nStackPage + 1);
+		WriteVarint(sReply, g_nStackDepth - g_nStackPage);
+		for(int i = g_nStackPage; i < g_nStackDepth; ++i)
+			WriteTestFrame(fileIds, sReply, i);
+		return sReply;
+	}
+
+	/** @return the number of frames that are not at the location of WriteTestFrame(). */
+	int CountWrongFrames(NPLDebugLane^ lane, NPLSourceTable^ sourceTable)
+	{
+		int nWrongFrames = 0;
+		for(int i = 0; i < lane->m_stackInfos->Count; ++i)
+		{
+			String^ filename;
+			int line = 0;
+			sourceTable->GetFileLineByAddress(lane->m_stackInfos[i]->m_nAddress, filename, line);
+			if(!String::Equals(filename, String::Format("script/f{0}.lua", i % 3)) || line != i + 10 || !String::Equals(lane->m_stackInfos[i]->m_sName, String::Format("func{0}", i)))
+				++nWrongFrames;
+		}
+		return nWrongFrames;
+	}
+
+	/** the frames of "stackrange" complete the stack of the "BP" message, and they may refer to files defined in it. 
+	* A reply to a request of an earlier stop, or of a resumed state, is discarded. */
+	void TestStackRange()
+	{
+		NPLSourceTable^ sourceTable = gcnew NPLSourceTable();
+		sourceTable->SetWorkingDir("C:/Work");
+		NPLDebugLane^ lane = gcnew NPLDebugLane("main", gcnew String(g_sMainQueue), 0);
+		CNPLTestFileIds fileIds;
+
+		int nStopEpoch = lane->OnBreak();
+		String^ filename;
+		int line = 0;
+		NPL_CHECK(lane->DecodeBreakpoint(WriteBreakpoint(fileIds), sourceTable, NULL, filename, line));
+		NPL_CHECK(String::Equals(filename, "script/f0.lua") && line == 10);
+		NPL_CHECK(lane->m_stackInfos->Count == g_nStackPage && lane->m_nStackDepth == g_nStackDepth);
+		NPL_CHECK(CountWrongFrames(lane, sourceTable) == 0);
+
+		std::string sReply = WriteStackRange(fileIds);
+		NPL_CHECK(lane->AddStackFrames(nStopEpoch, sReply, sourceTable, NULL));
+		NPL_CHECK(lane->m_stackInfos->Count == g_nStackDepth && lane->m_nStackDepth == g_nStackDepth);
+		NPL_CHECK(CountWrongFrames(lane, sourceTable) == 0);
+		// the stack is complete, a second reply does not continue it
+		NPL_CHECK(!lane->AddStackFrames(nStopEpoch, sReply, sourceTable, NULL));
+		NPL_CHECK(lane->m_stackInfos->Count == g_nStackDepth);
+
+		// the state breaks again before the reply to the request of the last stop arrives
+		nStopEpoch = lane->OnBreak();
+		NPL_CHECK(lane->DecodeBreakpoint(WriteBreakpoint(fileIds), sourceTable, NULL, filename, line));
+		NPL_CHECK(lane->m_stackInfos->Count == g_nStackPage && lane->m_nStackDepth == g_nStackDepth);
+		NPL_CHECK(lane->AddStackFrames(nStopEpoch - 1, sReply, sourceTable, NULL));
+		NPL_CHECK(lane->m_stackInfos->Count == g_nStackPage && lane->m_nStackDepth == g_nStackDepth);
+
+		// and resumes before the reply of this stop arrives
+		lane->m_bStopped = false;
+		NPL_CHECK(lane->AddStackFrames(nStopEpoch, sReply, sourceTable, NULL));
+		NPL_CHECK(lane->m_stackInfos->Count == g_nStackPage);
+		lane->m_bStopped = true;
+
+		// a truncated reply, and a reply that does not start after the frames of "BP" are malformed
+		NPL_CHECK(!lane->AddStackFrames(nStopEpoch, sReply.substr(0, sReply.size() - 1), sourceTable, NULL));
+		std::string sSkipped;
+		WriteVarint(sSkipped, g_nStackPage + 2);
+		WriteVarint(sSkipped, 0);
+		NPL_CHECK(!lane->AddStackFrames(nStopEpoch, sSkipped, sourceTable, NULL));
+		NPL_CHECK(lane->m_stackInfos->Count == g_nStackPage);
+
+		NPL_CHECK(lane->AddStackFrames(nStopEpoch, sReply, sourceTable, NULL));
+		NPL_CHECK(lane->m_stackInfos->Count == g_nStackDepth && CountWrongFrames(lane, sourceTable) == 0);
+
+		// file ids that the lane forgot on "Attached", and that are not in a file id table
+		{
+			msclr::lock lock(lane->m_fileNames);
+			lane->m_fileNames->Clear();
+		}
+		lane->OnBreak();
+		NPL_CHECK(!lane->DecodeBreakpoint(WriteBreakpoint(fileIds), sourceTable, NULL, filename, line));
+	}
+
+	void TestLanesThroughMailbox()
+	{
+		int nPort = 0;
+		SOCKET listener = Listen(nPort);
+		NPL_CHECK(listener != INVALID_SOCKET);
+		if(listener == INVALID_SOCKET)
+			return;
+		char sAddress[64];
+		_snprintf(sAddress, sizeof(sAddress), "127.0.0.1:%d", nPort);
+		CNPLSocketTransport transport(sAddress);
+		CNPLDebugMailbox mailbox;
+		NPL_CHECK(mailbox.AddTransport(&transport));
+		SOCKET debuggee = accept(listener, NULL, NULL);
+		NPL_CHECK(debuggee != INVALID_SOCKET);
+
+		NPLLaneTable^ lanes = CreateLanes();
+		int nStops[g_nLaneCount] = { 0 };
+
+		// output of a state that is not debugged yet goes to the main lane
+		NPL_CHECK(SendFromState(debuggee, "NPLDebug_unknown", 3, "DebuggerOutput", 0, 1, "hello\n"));
+		InterProcessMessagePtr output;
+		NPL_CHECK(mailbox.Pop(output, 5000) && output && output->m_filename == "DebuggerOutput");
+		if(output)
+			NPL_CHECK(lanes->GetLane(gcnew String(output->m_from.c_str())) == lanes->MainLane);
+
+		int nMismatches = 0;
+		NPLDebugLane^ requested = lanes->GetLaneByThread(7);
+		for(int nRound = 1; nRound <= g_nRounds; ++nRound)
+		{
+			// in the middle, a request to a stopped lane is answered after all lanes broke again
+			bool bRequest = (nRound == g_nRounds / 2);
+			int nRequestStop = requested->m_nStopEpoch;
+			int nRequestId = bRequest ? mailbox.BeginRequest("StackFrames") : 0;
+
+			// states break in a different order in each round, and some of them keep running
+			int nMessages = 0;
+			for(int i = 0; i < g_nLaneCount; ++i)
+			{
+				int nState = (i * 7 + nRound) % g_nLaneCount;
+				if((nState + nRound) % 3 == 0)
+					continue;
+				NPL_CHECK(SendFromState(debuggee, GetQueueName(nState), 1, "BP", ++nStops[nState], 0, ""));
+				++nMessages;
+			}
+			if(bRequest)
+			{
+				NPL_CHECK(SendFromState(debuggee, GetQueueName(7), 8, "StackFrames", nRequestId, 1, "frames"));
+				std::string sReply;
+				NPL_CHECK(mailbox.WaitForReply(nRequestId, 5000, sReply) && sReply == "frames");
+			}
+			nMismatches += BreakLanes(mailbox, lanes, nMessages);
+			if(bRequest)
+			{
+				// the reply arrived after the lane broke again, so it belongs to an earlier stop
+				NPL_CHECK(requested->m_nStopEpoch != nRequestStop);
+			}
+		}
+		NPL_CHECK(nMismatches == 0);
+		for(int i = 0; i < g_nLaneCount; ++i)
+		{
+			NPLDebugLane^ lane = lanes->GetLane(gcnew String(GetQueueName(i).c_str()));
+			NPL_CHECK(lane->m_nStopEpoch == nStops[i] && lane->m_bStopped);
+		}
+		InterProcessMessagePtr msg;
+		NPL_CHECK(!mailbox.Pop(msg, 0));
+
+		mailbox.Stop();
+		closesocket(debuggee);
+		closesocket(listener);
+	}
+}
+
+void TestNPLDebugLane()
+{
+	TestLaneTable();
+	TestStackRange();
+	WSADATA wsaData;
+	if(WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		NPL_CHECK(!"WSAStartup");
+		return;
+	}
+	TestLanesThroughMailbox();
+	WSACleanup();
+}
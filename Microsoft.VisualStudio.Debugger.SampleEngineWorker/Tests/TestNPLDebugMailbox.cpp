@@ -0,0 +1,219 @@
+/**
+* Date: 2026.10.17
+* Desc: CNPLDebugMailbox over a loopback CNPLSocketTransport, with a plain socket standing in for the debuggee.
+* Replies are matched to requests by the request id in param1 and the reply name, anything else is an ordinary message.
+* The benchmark measures the round trip of a "step" command to the "BP" message that the debuggee replies with, and prints the average and the maximum.
+*/
+#include "stdafx.h"
+#include "NPLDebugMailbox.h"
+#include "NPLTest.h"
+#include "NPLTestSocket.h"
+
+using namespace ParaEngine;
+
+namespace
+{
+	const int g_nRoundTrips = 1000;
+
+	/** a mailbox that receives from a debuggee socket, as the worker does with NPL_DEBUG_TRANSPORT=tcp://host:port. */
+	class CLoopbackSession
+	{
+	public:
+		CLoopbackSession() : m_listener(INVALID_SOCKET), m_debuggee(INVALID_SOCKET), m_pTransport(NULL) {}
+		~CLoopbackSession()
+		{
+			// the receiver thread must be gone before the transport is destroyed
+			m_mailbox.Stop();
+			if(m_debuggee != INVALID_SOCKET)
+				closesocket(m_debuggee);
+			if(m_listener != INVALID_SOCKET)
+				closesocket(m_listener);
+			delete m_pTransport;
+		}
+
+		bool Open()
+		{
+			int nPort = 0;
+			m_listener = Listen(nPort);
+			if(m_listener == INVALID_SOCKET)
+				return false;
+			char sAddress[64];
+			_snprintf(sAddress, sizeof(sAddress), "127.0.0.1:%d", nPort);
+			m_pTransport = new CNPLSocketTransport(sAddress);
+			if(!m_mailbox.AddTransport(m_pTransport))
+				return false;
+			m_debuggee = accept(m_listener, NULL, NULL);
+			return m_debuggee != INVALID_SOCKET;
+		}
+
+		SOCKET m_listener;
+		SOCKET m_debuggee;
+		CNPLSocketTransport* m_pTransport;
+		CNPLDebugMailbox m_mailbox;
+	};
+
+	void MakeMessage(InterProcessMessage& msg, const char* sFrom, int nMsgType, const char* sName, int nParam1, int nParam2, const char* sCode)
+	{
+		msg.m_method = "debug";
+		msg.m_from = sFrom;
+		msg.m_filename = sName;
+		msg.m_nMsgType = nMsgType;
+		msg.m_nParam1 = nParam1;
+		msg.m_nParam2 = nParam2;
+		msg.m_code = sCode;
+	}
+
+	bool SendReply(CLoopbackSession& session, int nRequestId, const char* sName, bool bLast, const char* sCode)
+	{
+		InterProcessMessage msg;
+		MakeMessage(msg, "NPLDebug", 4, sName, nRequestId, bLast ? 1 : 0, sCode);
+		return SendFrame(session.m_debuggee, msg);
+	}
+
+	/** @return true if the next message in the mailbox is the given reply. */
+	bool PopReply(CLoopbackSession& session, int nRequestId, const char* sName, const char* sCode)
+	{
+		InterProcessMessagePtr msg;
+		return session.m_mailbox.Pop(msg, 5000) && msg && msg->m_nParam1 == nRequestId && msg->m_filename == sName && msg->m_code == sCode;
+	}
+
+	/** a reply with another request id or another name does not complete the request, and stays in the mailbox. 
+	* A reply in several messages is complete with the one that has param2 set. */
+	void TestStaleReply()
+	{
+		CLoopbackSession session;
+		NPL_CHECK(session.Open());
+		if(session.m_debuggee == INVALID_SOCKET)
+			return;
+		CNPLDebugMailbox& mailbox = session.m_mailbox;
+		int nRequestId = mailbox.BeginRequest("ExpValue");
+		NPL_CHECK(nRequestId != 0);
+		NPL_CHECK(SendReply(session, nRequestId + 1000, "ExpValue", true, "{stale=1}"));
+		NPL_CHECK(SendReply(session, nRequestId, "FrameVars", true, "{vars={}}"));
+		NPL_CHECK(SendReply(session, nRequestId, "ExpValue", false, "{value="));
+		NPL_CHECK(SendReply(session, nRequestId, "ExpValue", true, "1}"));
+		std::string sReply;
+		NPL_CHECK(mailbox.WaitForReply(nRequestId, 5000, sReply) && sReply == "{value=1}");
+		NPL_CHECK(PopReply(session, nRequestId + 1000, "ExpValue", "{stale=1}"));
+		NPL_CHECK(PopReply(session, nRequestId, "FrameVars", "{vars={}}"));
+		InterProcessMessagePtr msg;
+		NPL_CHECK(!mailbox.Pop(msg, 100));
+	}
+
+	/** a reply that arrives after its request timed out is an ordinary message, and never completes a later request. */
+	void TestReplyAfterTimeout()
+	{
+		CLoopbackSession session;
+		NPL_CHECK(session.Open());
+		if(session.m_debuggee == INVALID_SOCKET)
+			return;
+		CNPLDebugMailbox& mailbox = session.m_mailbox;
+		int nTimedOut = mailbox.BeginRequest("ExpValue");
+		std::string sReply;
+		NPL_CHECK(!mailbox.WaitForReply(nTimedOut, 50, sReply) && sReply.empty());
+		// the request is gone after the timeout
+		NPL_CHECK(!mailbox.WaitForReply(nTimedOut, 0, sReply));
+
+		int nRequestId = mailbox.BeginRequest("ExpValue");
+		NPL_CHECK(nRequestId != nTimedOut);
+		NPL_CHECK(SendReply(session, nTimedOut, "ExpValue", true, "{late=1}"));
+		NPL_CHECK(SendReply(session, nRequestId, "ExpValue", true, "{value=2}"));
+		NPL_CHECK(mailbox.WaitForReply(nRequestId, 5000, sReply) && sReply == "{value=2}");
+		NPL_CHECK(PopReply(session, nTimedOut, "ExpValue", "{late=1}"));
+	}
+
+	/** requests can be pipelined: each reply completes its own request, in whatever order they arrive. */
+	void TestPipelinedRequests()
+	{
+		CLoopbackSession session;
+		NPL_CHECK(session.Open());
+		if(session.m_debuggee == INVALID_SOCKET)
+			return;
+		CNPLDebugMailbox& mailbox = session.m_mailbox;
+		int nFirst = mailbox.BeginRequest("ExpValue");
+		int nSecond = mailbox.BeginRequest("ExpValue");
+		NPL_CHECK(nFirst != nSecond);
+		NPL_CHECK(SendReply(session, nSecond, "ExpValue", true, "{value=2}"));
+		NPL_CHECK(SendReply(session, nFirst, "ExpValue", true, "{value=1}"));
+		std::string sReply;
+		NPL_CHECK(mailbox.WaitForReply(nFirst, 5000, sReply) && sReply == "{value=1}");
+		NPL_CHECK(mailbox.WaitForReply(nSecond, 5000, sReply) && sReply == "{value=2}");
+		InterProcessMessagePtr msg;
+		NPL_CHECK(!mailbox.Pop(msg, 100));
+	}
+
+	/** the debuggee breaks again whenever it receives "step", until the connection is closed. */
+	DWORD WINAPI StepDebuggeeProc(LPVOID pParam)
+	{
+		SOCKET debuggee = *(SOCKET*)pParam;
+		InterProcessMessage msg_in;
+		while(ReceiveFrame(debuggee, msg_in))
+		{
+			if(msg_in.m_filename != "step")
+				continue;
+			InterProcessMessage msg_out;
+			MakeMessage(msg_out, "NPLDebug", 1, "BP", msg_in.m_nParam1, 0, "");
+			if(!SendFrame(debuggee, msg_out))
+				break;
+		}
+		return 0;
+	}
+
+	/** the engine waits on the event of the mailbox, as WaitForNPLDebugEvent() does, so a break is seen as soon as it arrives. */
+	void BenchmarkStepLatency()
+	{
+		CLoopbackSession session;
+		NPL_CHECK(session.Open());
+		if(session.m_debuggee == INVALID_SOCKET)
+			return;
+		HANDLE hThread = CreateThread(NULL, 0, StepDebuggeeProc, &session.m_debuggee, 0, NULL);
+
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		double fTotal = 0, fMax = 0;
+		int nLost = 0;
+		for(int i = 1; i <= g_nRoundTrips; ++i)
+		{
+			InterProcessMessage step;
+			MakeMessage(step, "VSDebug", 22, "step", i, 0, "");
+			LARGE_INTEGER nStart, nEnd;
+			QueryPerformanceCounter(&nStart);
+			session.m_pTransport->Send(step, 1);
+			InterProcessMessagePtr msg;
+			if(WaitForSingleObject(session.m_mailbox.GetWaitHandle(), 5000) != WAIT_OBJECT_0 || !session.m_mailbox.Pop(msg, 0) || !msg || msg->m_nParam1 != i)
+			{
+				++nLost;
+				continue;
+			}
+			QueryPerformanceCounter(&nEnd);
+			double fMicroseconds = (double)(nEnd.QuadPart - nStart.QuadPart) * 1000000.0 / (double)frequency.QuadPart;
+			fTotal += fMicroseconds;
+			if(fMicroseconds > fMax)
+				fMax = fMicroseconds;
+		}
+		NPL_CHECK(nLost == 0);
+		double fAverage = fTotal / g_nRoundTrips;
+		printf("CNPLDebugMailbox: %d step round trips over tcp, %.1f us on average, %.1f us at most\n", g_nRoundTrips, fAverage, fMax);
+		// polling every 100ms took 50ms on average
+		NPL_CHECK(fAverage < 20000.0);
+
+		shutdown(session.m_debuggee, SD_BOTH);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+	}
+}
+
+void TestNPLDebugMailbox()
+{
+	WSADATA wsaData;
+	if(WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		NPL_CHECK(!"WSAStartup");
+		return;
+	}
+	TestStaleReply();
+	TestReplyAfterTimeout();
+	TestPipelinedRequests();
+	BenchmarkStepLatency();
+	WSACleanup();
+}
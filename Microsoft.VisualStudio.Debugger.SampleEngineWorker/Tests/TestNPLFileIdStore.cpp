@@ -0,0 +1,83 @@
+/**
+* Date: 2026.10.17
+* Desc: CNPLFileIdStore on a temporary file that is written the way IPCDebugger.lua writes its file id table.
+*/
+#include "stdafx.h"
+#include "NPLFileIdStore.h"
+#include "NPLTest.h"
+
+namespace
+{
+	void WriteTextFile(const char* sFileName, const char* sMode, const char* sText)
+	{
+		FILE* pFile = fopen(sFileName, sMode);
+		if(pFile)
+		{
+			fputs(sText, pFile);
+			fclose(pFile);
+		}
+	}
+
+	bool HasFileName(CNPLFileIdStore& store, unsigned int nFileId, const char* sExpected)
+	{
+		std::string sFileName;
+		return store.GetFileName(nFileId, sFileName) && sFileName == sExpected;
+	}
+
+	void TestParse(const char* sFileName)
+	{
+		WriteTextFile(sFileName, "wb", "NPLFIDS1\nscript/a.lua\r\nscript/b.lua\n");
+		CNPLFileIdStore store;
+		NPL_CHECK(store.Open(sFileName) && store.IsOpen());
+		NPL_CHECK(store.GetCount() == 2);
+		// id 0 is never used, and "\r\n" is accepted
+		std::string sName;
+		NPL_CHECK(!store.GetFileName(0, sName));
+		NPL_CHECK(HasFileName(store, 1, "script/a.lua"));
+		NPL_CHECK(HasFileName(store, 2, "script/b.lua"));
+		NPL_CHECK(!store.GetFileName(3, sName));
+
+		// a line that is still being written is not an id yet
+		WriteTextFile(sFileName, "ab", "script/c");
+		NPL_CHECK(!store.GetFileName(3, sName));
+		WriteTextFile(sFileName, "ab", ".lua\n");
+		NPL_CHECK(HasFileName(store, 3, "script/c.lua"));
+		NPL_CHECK(store.GetCount() == 3);
+
+		store.Close();
+		NPL_CHECK(!store.IsOpen() && store.GetCount() == 0);
+		NPL_CHECK(!store.GetFileName(1, sName));
+
+		// the debuggee truncates the table on a new attach, which is only possible after the worker has closed it. Ids start from 1 again. 
+		WriteTextFile(sFileName, "wb", "NPLFIDS1\nscript/d.lua\n");
+		NPL_CHECK(store.Open(sFileName) && store.GetCount() == 1);
+		NPL_CHECK(HasFileName(store, 1, "script/d.lua"));
+		NPL_CHECK(!store.GetFileName(2, sName));
+		store.Close();
+	}
+
+	void TestInvalidHeader(const char* sFileName)
+	{
+		CNPLFileIdStore store;
+		WriteTextFile(sFileName, "wb", "NPLFIDS0\nscript/a.lua\n");
+		NPL_CHECK(!store.Open(sFileName) && !store.IsOpen());
+		WriteTextFile(sFileName, "wb", "");
+		NPL_CHECK(!store.Open(sFileName));
+		DeleteFileA(sFileName);
+		NPL_CHECK(!store.Open(sFileName));
+	}
+}
+
+void TestNPLFileIdStore()
+{
+	char sTempPath[MAX_PATH];
+	char sFileName[MAX_PATH];
+	if(GetTempPathA(MAX_PATH, sTempPath) == 0 || GetTempFileNameA(sTempPath, "fid", 0, sFileName) == 0)
+	{
+		NPL_CHECK(!"GetTempFileNameA");
+		return;
+	}
+	TestParse(sFileName);
+	TestInvalidHeader(sFileName);
+	DeleteFileA(sFileName);
+}
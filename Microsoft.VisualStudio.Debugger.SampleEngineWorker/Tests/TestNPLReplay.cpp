@@ -0,0 +1,155 @@
+/**
+* Date: 2026.10.17
+* Desc: CNPLReplayTransport over the recorded session data/session.nplrec, and CNPLDebugRecorder writing what the mailbox receives.
+* The recording has an "Attach", "Attached", "setbs", "DebuggerOutput", binary "BP", "continue" and "ExpValue" message,
+* at 0, 10, 12, 20, 50, 60 and 80ms, and a last record that was cut off. Only the 4 messages from the debuggee are replayed.
+*/
+#include "stdafx.h"
+#include "NPLDebugRecorder.h"
+#include "NPLDebugMailbox.h"
+#include "NPLTest.h"
+
+using namespace ParaEngine;
+
+namespace
+{
+	const char* g_sSessionFile = "data/session.nplrec";
+
+	struct ReceiveTask
+	{
+		CNPLReplayTransport* m_pTransport;
+		InterProcessMessage m_msg;
+		int m_nResult;
+	};
+
+	DWORD WINAPI ReceiveProc(LPVOID pParam)
+	{
+		ReceiveTask* pTask = (ReceiveTask*)pParam;
+		pTask->m_nResult = pTask->m_pTransport->Receive(pTask->m_msg);
+		return 0;
+	}
+
+	/** check the messages from the debuggee of the session in replay order. */
+	void CheckSessionMessage(int nIndex, const InterProcessMessage& msg)
+	{
+		NPL_CHECK(msg.m_method == "debug" && msg.m_from == "NPLDebug");
+		switch(nIndex)
+		{
+		case 0:
+			NPL_CHECK(msg.m_nMsgType == 5 && msg.m_filename == "Attached" && msg.m_code == "{bpformat=1, fileids=true, }");
+			break;
+		case 1:
+			NPL_CHECK(msg.m_nMsgType == 3 && msg.m_nParam2 == 1 && msg.m_filename == "DebuggerOutput" && msg.m_code == "hello\n");
+			break;
+		case 2:
+			// the binary stack is kept as it is, including the 0 byte
+			NPL_CHECK(msg.m_nMsgType == 1 && msg.m_filename == "BP" && msg.m_code == std::string("\x81\x8c\0BP", 5));
+			break;
+		case 3:
+			NPL_CHECK(msg.m_nMsgType == 4 && msg.m_nParam1 == 3 && msg.m_nParam2 == 1 && msg.m_filename == "ExpValue" && msg.m_code == "{value=1}");
+			break;
+		default:
+			NPL_CHECK(!"unexpected message");
+			break;
+		}
+	}
+
+	void TestReplay()
+	{
+		CNPLReplayTransport transport;
+		NPL_CHECK(transport.Open(g_sSessionFile, false));
+		int nMessages = 0, nMilliseconds = 0;
+		NPL_CHECK(!transport.PopSummary(nMessages, nMilliseconds));
+		for(int i = 0; i < 4; ++i)
+		{
+			InterProcessMessage msg;
+			NPL_CHECK(transport.Receive(msg) == 0);
+			CheckSessionMessage(i, msg);
+		}
+		NPL_CHECK(transport.PopSummary(nMessages, nMilliseconds) && nMessages == 4);
+		// the summary is reported once
+		NPL_CHECK(!transport.PopSummary(nMessages, nMilliseconds));
+
+		// after the last message, Receive() blocks until WakeUp()
+		ReceiveTask task;
+		task.m_pTransport = &transport;
+		task.m_nResult = 1;
+		HANDLE hThread = CreateThread(NULL, 0, ReceiveProc, &task, 0, NULL);
+		NPL_CHECK(WaitForSingleObject(hThread, 100) == WAIT_TIMEOUT);
+		transport.WakeUp();
+		NPL_CHECK(WaitForSingleObject(hThread, 1000) == WAIT_OBJECT_0);
+		NPL_CHECK(task.m_nResult == -1);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+
+		NPL_CHECK(!transport.Open("data/nonexistent.nplrec", false));
+	}
+
+	/** the recorded pace keeps the 70ms between the first and the last message from the debuggee. */
+	void TestRecordedPace()
+	{
+		CNPLReplayTransport transport;
+		NPL_CHECK(transport.Open(g_sSessionFile, true));
+		DWORD nStartTime = GetTickCount();
+		for(int i = 0; i < 4; ++i)
+		{
+			InterProcessMessage msg;
+			NPL_CHECK(transport.Receive(msg) == 0);
+		}
+		int nMessages = 0, nMilliseconds = 0;
+		NPL_CHECK(transport.PopSummary(nMessages, nMilliseconds) && nMessages == 4);
+		// timer resolution may shorten each wait by a few milliseconds
+		NPL_CHECK(nMilliseconds >= 50 && GetTickCount() - nStartTime >= 50);
+	}
+
+	/** replay into the mailbox as the worker does, and record what it receives. The recording replays the same messages. */
+	void TestMailboxRecording(const char* sFileName)
+	{
+		CNPLDebugRecorder recorder;
+		NPL_CHECK(recorder.Open(sFileName));
+		{
+			CNPLReplayTransport transport;
+			NPL_CHECK(transport.Open(g_sSessionFile, false));
+			CNPLDebugMailbox mailbox;
+			mailbox.SetRecorder(&recorder);
+			NPL_CHECK(mailbox.AddTransport(&transport));
+			for(int i = 0; i < 4; ++i)
+			{
+				InterProcessMessagePtr msg;
+				NPL_CHECK(mailbox.Pop(msg, 5000));
+				if(msg)
+					CheckSessionMessage(i, *msg);
+			}
+			InterProcessMessagePtr msg;
+			NPL_CHECK(!mailbox.Pop(msg, 0));
+			mailbox.Stop();
+		}
+		recorder.Close();
+
+		CNPLReplayTransport transport;
+		NPL_CHECK(transport.Open(sFileName, false));
+		for(int i = 0; i < 4; ++i)
+		{
+			InterProcessMessage msg;
+			NPL_CHECK(transport.Receive(msg) == 0);
+			CheckSessionMessage(i, msg);
+		}
+		int nMessages = 0, nMilliseconds = 0;
+		NPL_CHECK(transport.PopSummary(nMessages, nMilliseconds) && nMessages == 4);
+	}
+}
+
+void TestNPLReplay()
+{
+	char sTempPath[MAX_PATH];
+	char sFileName[MAX_PATH];
+	if(GetTempPathA(MAX_PATH, sTempPath) == 0 || GetTempFileNameA(sTempPath, "rec", 0, sFileName) == 0)
+	{
+		NPL_CHECK(!"GetTempFileNameA");
+		return;
+	}
+	TestReplay();
+	TestRecordedPace();
+	TestMailboxRecording(sFileName);
+	DeleteFileA(sFileName);
+}
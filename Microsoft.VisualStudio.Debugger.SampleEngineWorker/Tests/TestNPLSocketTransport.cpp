@@ -0,0 +1,120 @@
+/**
+* Date: 2026.10.17
+* Desc: CNPLSocketTransport over loopback, with a plain socket standing in for the debuggee.
+*/
+#include "stdafx.h"
+#include "NPLDebugTransport.h"
+#include "NPLTest.h"
+#include "NPLTestSocket.h"
+
+using namespace ParaEngine;
+
+namespace
+{
+	struct ReceiveTask
+	{
+		CNPLSocketTransport* m_pTransport;
+		InterProcessMessage m_msg;
+		int m_nResult;
+	};
+
+	DWORD WINAPI ReceiveProc(LPVOID pParam)
+	{
+		ReceiveTask* pTask = (ReceiveTask*)pParam;
+		pTask->m_nResult = pTask->m_pTransport->Receive(pTask->m_msg);
+		return 0;
+	}
+
+	HANDLE StartReceive(ReceiveTask& task, CNPLSocketTransport* pTransport)
+	{
+		task.m_pTransport = pTransport;
+		task.m_nResult = 1;
+		return CreateThread(NULL, 0, ReceiveProc, &task, 0, NULL);
+	}
+
+	void MakeMessage(InterProcessMessage& msg, int nMsgType, const char* sCode)
+	{
+		msg.m_method = "debug";
+		msg.m_from = "VSDebug";
+		msg.m_filename = "Attach";
+		msg.m_nMsgType = nMsgType;
+		msg.m_nParam1 = 1;
+		msg.m_nParam2 = 2;
+		msg.m_code = sCode;
+	}
+
+	/** a message sent before the debuggee listens is delivered on connect, and a reply is received. */
+	void TestRoundTrip()
+	{
+		int nPort = 0;
+		SOCKET listener = Listen(nPort);
+		NPL_CHECK(listener != INVALID_SOCKET);
+		if(listener == INVALID_SOCKET)
+			return;
+		char sAddress[64];
+		_snprintf(sAddress, sizeof(sAddress), "127.0.0.1:%d", nPort);
+		CNPLSocketTransport transport(sAddress);
+
+		InterProcessMessage msg_out;
+		MakeMessage(msg_out, 16, "{bpformat=1}");
+		NPL_CHECK(transport.Send(msg_out, 1) == 0);
+
+		ReceiveTask task;
+		HANDLE hThread = StartReceive(task, &transport);
+		SOCKET debuggee = accept(listener, NULL, NULL);
+		NPL_CHECK(debuggee != INVALID_SOCKET);
+
+		InterProcessMessage msg_in;
+		NPL_CHECK(ReceiveFrame(debuggee, msg_in));
+		NPL_CHECK(msg_in.m_nMsgType == 16 && msg_in.m_nParam1 == 1 && msg_in.m_nParam2 == 2);
+		NPL_CHECK(msg_in.m_method == "debug" && msg_in.m_from == "VSDebug" && msg_in.m_filename == "Attach" && msg_in.m_code == "{bpformat=1}");
+
+		InterProcessMessage reply;
+		MakeMessage(reply, 5, std::string(100000, 'x').c_str());
+		NPL_CHECK(SendFrame(debuggee, reply));
+		NPL_CHECK(WaitForSingleObject(hThread, 5000) == WAIT_OBJECT_0);
+		NPL_CHECK(task.m_nResult == 0);
+		NPL_CHECK(task.m_msg.m_nMsgType == 5 && task.m_msg.m_code == reply.m_code);
+
+		// messages sent after connecting go straight to the socket
+		NPL_CHECK(transport.Send(msg_out, 1) == 0);
+		NPL_CHECK(ReceiveFrame(debuggee, msg_in) && msg_in.m_code == msg_out.m_code);
+
+		// the receiver thread must be gone before the transport is destroyed
+		transport.WakeUp();
+		closesocket(debuggee);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+		closesocket(listener);
+	}
+
+	/** WakeUp() returns from Receive() while the transport is still trying to connect. */
+	void TestWakeUpWhileConnecting()
+	{
+		// a non-routable address, so that connect() neither succeeds nor fails quickly
+		CNPLSocketTransport transport("10.255.255.1:9");
+		ReceiveTask task;
+		HANDLE hThread = StartReceive(task, &transport);
+		Sleep(200);
+		DWORD nStartTime = GetTickCount();
+		transport.WakeUp();
+		NPL_CHECK(WaitForSingleObject(hThread, 1000) == WAIT_OBJECT_0);
+		NPL_CHECK(GetTickCount() - nStartTime < 1000);
+		NPL_CHECK(task.m_nResult == -1);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+	}
+}
+
+void TestNPLSocketTransport()
+{
+	WSADATA wsaData;
+	if(WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		NPL_CHECK(!"WSAStartup");
+		return;
+	}
+	TestRoundTrip();
+	TestWakeUpWhileConnecting();
+	WSACleanup();
+}
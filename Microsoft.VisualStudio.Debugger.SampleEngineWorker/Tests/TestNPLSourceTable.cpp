@@ -0,0 +1,167 @@
+/**
+* Date: 2026.10.17
+* Desc: NPLSourceTable with more files than would fit in 16 bits, clamped lines and columns, and a change of the working directory.
+* The benchmark binds the frames of 50-frame stops, and prints the time per stop.
+* It is compiled as managed code, see NPLDebugEngineTests.vcxproj.
+*/
+#include "stdafx.h"
+#include "ProjInclude.h"
+#include "NPLSourceTable.h"
+#include "NPLTest.h"
+
+namespace
+{
+	const int g_nFileCount = 200000;
+	const int g_nStops = 20000;
+	const int g_nFramesPerStop = 50;
+	const int g_nStackFiles = 200;
+
+	bool HasLocation(NPLSourceTable^ table, unsigned int address, String^ sFileName, int nLine, int nColumn)
+	{
+		String^ filename;
+		int line = -1, column = -1;
+		table->GetFileLineByAddress(address, filename, line, column);
+		return String::Equals(filename, sFileName) && line == nLine && column == nColumn;
+	}
+
+	/** every file and line is bound to its own address, which maps back to the same file, line and column. */
+	void TestManyFiles()
+	{
+		NPLSourceTable^ table = gcnew NPLSourceTable();
+		table->SetWorkingDir("C:\\Work");
+		cli::array<unsigned int>^ addresses = gcnew cli::array<unsigned int>(g_nFileCount);
+		for(int i = 0; i < g_nFileCount; ++i)
+		{
+			String^ sFileName = String::Format("C:\\Work\\script\\F{0}.lua", i);
+			// ids are dense and start from 1
+			NPL_CHECK(table->GetIdByString(sFileName) == (unsigned int)(i + 1));
+			addresses[i] = table->GetAddressByFileLine(sFileName, i + 1, i % 256);
+			NPL_CHECK(addresses[i] == (unsigned int)(i + 1));
+		}
+		NPL_CHECK(table->FileCount == g_nFileCount + 1);
+		int nMismatches = 0;
+		for(int i = 0; i < g_nFileCount; ++i)
+		{
+			String^ sFileName = String::Format("c:\\work\\script\\f{0}.lua", i);
+			if(!HasLocation(table, addresses[i], sFileName, i + 1, i % 256)
+				|| table->GetIdByString(String::Format("script/f{0}.lua", i)) != (unsigned int)(i + 1)
+				|| table->GetAddressByFileLine(String::Format("script/F{0}.lua", i), i + 1, i % 256) != addresses[i])
+				++nMismatches;
+		}
+		NPL_CHECK(nMismatches == 0);
+		// no file is added by the lookups above
+		NPL_CHECK(table->FileCount == g_nFileCount + 1);
+	}
+
+	/** lines beyond 24 bits and columns beyond 8 bits are clamped, and negative ones are 0. Address 0 and unknown addresses have no file. */
+	void TestClamping()
+	{
+		NPLSourceTable^ table = gcnew NPLSourceTable();
+		table->SetWorkingDir("C:/Work/");
+		unsigned int address = table->GetAddressByFileLine("script/a.lua", 0x1000000, 300);
+		NPL_CHECK(address != 0 && HasLocation(table, address, "script/a.lua", 0xFFFFFF, 0xFF));
+		NPL_CHECK(table->GetAddressByFileLine("script/a.lua", 0x7FFFFFFF, 0xFF) == address);
+		NPL_CHECK(table->GetAddressByFileLine("script/a.lua", 0xFFFFFF, 256) == address);
+
+		unsigned int nFirstLine = table->GetAddressByFileLine("script/a.lua", -5, -1);
+		NPL_CHECK(nFirstLine != address && HasLocation(table, nFirstLine, "script/a.lua", 0, 0));
+		NPL_CHECK(table->GetAddressByFileLine("script/a.lua", 0) == nFirstLine);
+
+		// the empty file name has id 0, and its locations are bound as well
+		NPL_CHECK(table->GetIdByString("") == 0 && table->GetIdByString(nullptr) == 0);
+		unsigned int nNoFile = table->GetAddressByFileLine("", 10, 2);
+		NPL_CHECK(nNoFile != 0 && HasLocation(table, nNoFile, "", 10, 2));
+
+		NPL_CHECK(HasLocation(table, 0, "", 0, 0));
+		NPL_CHECK(HasLocation(table, nNoFile + 1, "", 0, 0));
+		NPL_CHECK(HasLocation(table, 0xFFFFFFFF, "", 0, 0));
+		NPL_CHECK(String::Equals(table->GetStringById(table->FileCount), ""));
+	}
+
+	/** file ids and addresses are kept when the working directory changes, while relative names are mapped to the new one. */
+	void TestSetWorkingDir()
+	{
+		NPLSourceTable^ table = gcnew NPLSourceTable();
+		table->SetWorkingDir("C:\\Work");
+		unsigned int nScript = table->GetIdByString("C:\\Work\\script\\a.lua");
+		unsigned int nLib = table->GetIdByString("D:\\Other\\lib\\b.lua");
+		unsigned int address = table->GetAddressByFileLine("script/a.lua", 12, 3);
+		NPL_CHECK(nScript == 1 && nLib == 2);
+		NPL_CHECK(String::Equals(table->GetRelativeFilePath("C:\\Work\\script\\a.lua"), "script/a.lua"));
+		// "lib/" is not one of the source folders of the NPL runtime
+		NPL_CHECK(String::Equals(table->GetRelativeFilePath("D:\\Other\\lib\\b.lua"), "d:/other/lib/b.lua"));
+
+		// setting the same directory in another form changes nothing
+		table->SetWorkingDir("c:/work/");
+		NPL_CHECK(table->GetIdByString("script/a.lua") == nScript);
+
+		table->SetWorkingDir("D:/Other");
+		NPL_CHECK(table->FileCount == 3);
+		NPL_CHECK(table->GetIdByString("C:\\Work\\script\\a.lua") == nScript);
+		NPL_CHECK(table->GetIdByString("D:\\Other\\lib\\b.lua") == nLib);
+		// relative names of the new working directory, and the folders of the NPL runtime still resolve
+		NPL_CHECK(table->GetIdByString("lib/b.lua") == nLib);
+		NPL_CHECK(table->GetIdByString("script/a.lua") == nScript);
+		NPL_CHECK(String::Equals(table->GetRelativeFilePath("D:\\Other\\lib\\b.lua"), "lib/b.lua"));
+		NPL_CHECK(String::Equals(table->GetRelativeFilePath("C:\\Work\\script\\a.lua"), "c:/work/script/a.lua"));
+		// bound addresses are not changed, and file names are kept as they were first seen
+		NPL_CHECK(HasLocation(table, address, "c:\\work\\script\\a.lua", 12, 3));
+		NPL_CHECK(table->GetAddressByFileLine("C:\\Work\\script\\a.lua", 12, 3) == address);
+		NPL_CHECK(table->FileCount == 3);
+	}
+
+	/** 50-frame stops at a high rate, bound the way NPLDebugLane decodes them: each frame is looked up by its file name, 
+	* which is the same string for all frames of a file, see NPLDebugLane::m_fileNames. Known names are neither canonicalized nor allocated again. */
+	void BenchmarkStops()
+	{
+		NPLSourceTable^ table = gcnew NPLSourceTable();
+		table->SetWorkingDir("C:/Work");
+		cli::array<String^>^ fileNames = gcnew cli::array<String^>(g_nStackFiles);
+		for(int i = 0; i < g_nStackFiles; ++i)
+			fileNames[i] = String::Format("C:\\Work\\Script\\IDE\\Module{0}\\Main.lua", i);
+
+		// frame i of a stop is at line i+1 of one of the files, the first stops bind all of them
+		for(int nStop = 0; nStop < g_nStackFiles; ++nStop)
+		{
+			for(int i = 0; i < g_nFramesPerStop; ++i)
+				table->GetAddressByFileLine(fileNames[(nStop + i) % g_nStackFiles], i + 1);
+		}
+		int nFileCount = table->FileCount;
+
+		AppDomain::MonitoringIsEnabled = true;
+		Int64 nAllocated = AppDomain::CurrentDomain->MonitoringTotalAllocatedMemorySize;
+		Stopwatch^ watch = Stopwatch::StartNew();
+		int nWrongFrames = 0;
+		for(int nStop = 0; nStop < g_nStops; ++nStop)
+		{
+			for(int i = 0; i < g_nFramesPerStop; ++i)
+			{
+				String^ sFileName = fileNames[(nStop + i) % g_nStackFiles];
+				if(table->GetAddressByFileLine(sFileName, i + 1) == 0 || table->GetRelativeFilePath(sFileName)->Length == 0)
+					++nWrongFrames;
+			}
+		}
+		watch->Stop();
+		nAllocated = AppDomain::CurrentDomain->MonitoringTotalAllocatedMemorySize - nAllocated;
+		NPL_CHECK(nWrongFrames == 0);
+		NPL_CHECK(table->FileCount == nFileCount);
+		// the allocation counter is updated in blocks of a few KB, so less than a byte per frame means no allocations per frame
+		NPL_CHECK(nAllocated < (Int64)g_nStops * g_nFramesPerStop);
+		printf("NPLSourceTable: %d stops of %d frames, %.2f us per stop, %lld bytes allocated\n", 
+			g_nStops, g_nFramesPerStop, watch->Elapsed.TotalMilliseconds * 1000.0 / g_nStops, (long long)nAllocated);
+
+		// the cached relative names are mapped again after the working directory changes
+		NPL_CHECK(String::Equals(table->GetRelativeFilePath(fileNames[0]), "script/ide/module0/main.lua"));
+		table->SetWorkingDir("C:/Work/Script");
+		NPL_CHECK(String::Equals(table->GetRelativeFilePath(fileNames[0]), "ide/module0/main.lua"));
+		NPL_CHECK(table->GetAddressByFileLine(fileNames[0], 1) != 0 && table->FileCount == nFileCount);
+	}
+}
+
+void TestNPLSourceTable()
+{
+	TestManyFiles();
+	TestClamping();
+	TestSetWorkingDir();
+	BenchmarkStops();
+}
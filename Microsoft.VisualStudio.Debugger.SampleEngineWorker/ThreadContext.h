@@ -18,6 +18,7 @@ internal:
 		EFlags(threadContext.EFlags)
 	{
 		sName = nullptr;
+		nFrameLevel = 0;
 	}
 
 public:
@@ -33,6 +34,8 @@ public:
 	DWORD EFlags;
 	// function name
 	String^ sName;
+	// NPL only: index of the frame on the stack of its state starting from 1, 0 if unknown
+	int nFrameLevel;
 };
 
 END_NAMESPACE
@@ -69,7 +69,20 @@ VariableInformation^ VariableInformation::Create(DebuggedProcess^ debuggedProces
 }
 
 // this is added for evaluating NPL table object. 
-VariableInformation^ VariableInformation::Create(DebuggedProcess^ debuggedProcess, String^ varName )
+VariableInformation^ VariableInformation::Create(DebuggedProcess^ debuggedProcess, String^ varName, int nFrameLevel)
+{
+	// names and dotted paths are listed like locals, so that tables are expanded a page at a time instead of being dumped as text. 
+	// other expressions are executed every time, since they may have side effects, and the value is their output.
+	if(varName->IndexOfAny(gcnew cli::array<wchar_t>{ L'=', L';', L'(', L')' }) < 0)
+	{
+		VariableInformation^ variable = debuggedProcess->NPL_InspectVariable(varName, nFrameLevel);
+		if(variable != nullptr)
+			return variable;
+	}
+	return CreateFromDump(debuggedProcess, varName);
+}
+
+VariableInformation^ VariableInformation::CreateFromDump(DebuggedProcess^ debuggedProcess, String^ varName)
 {
 	String^ sValue;
 	if(debuggedProcess->NPL_EvaluateExpressionSync(varName, sValue))
@@ -82,9 +95,45 @@ VariableInformation^ VariableInformation::Create(DebuggedProcess^ debuggedProces
 		variable->m_fUserDefinedType = true;
 		variable->m_dwIndirectionLevel = 0;
 
-		// TODO: for nested table object
 		variable->m_value =  sValue;
 		return variable;
 	}
 	return nullptr;
+}
+
+// locals, parameters and upvalues of NPL functions are only listed when the stack frame is shown, and table entries when the table is expanded, 
+// so they are created from the reply of the debuggee.
+VariableInformation^ VariableInformation::Create(DebuggedProcess^ debuggedProcess, String^ varName, String^ typeName, String^ value, unsigned int nHandle, int nChildCount)
+{
+	VariableInformation^ variable = gcnew VariableInformation();
+	variable->m_debuggedProcess = debuggedProcess;
+	variable->m_name = varName;
+	variable->m_typeName = typeName;
+	variable->m_value = value;
+	variable->m_fFrameRelative = true;
+	variable->m_address = 0;
+	variable->m_fUserDefinedType = (nHandle != 0);
+	variable->m_dwIndirectionLevel = 0;
+	variable->m_nHandle = nHandle;
+	variable->m_nChildCount = nChildCount;
+	variable->m_nChildFrom = 1;
+	return variable;
+}
+
+cli::array<VariableInformation^>^ VariableInformation::GetChildren()
+{
+	if(m_children == nullptr && m_debuggedProcess != nullptr && m_nHandle != 0 && m_nChildCount > 0)
+	{
+		m_children = m_debuggedProcess->NPL_GetChildren(this);
+		if(m_children == nullptr && m_sExpression != nullptr)
+		{
+			VariableInformation^ dump = CreateFromDump(m_debuggedProcess, m_sExpression);
+			if(dump != nullptr)
+			{
+				dump->m_name = gcnew String("[dump]");
+				m_children = gcnew cli::array<VariableInformation^>{ dump };
+			}
+		}
+	}
+	return m_children;
 }
\ No newline at end of file
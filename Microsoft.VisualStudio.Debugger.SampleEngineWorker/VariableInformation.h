@@ -19,6 +19,15 @@ public:
 	DWORD m_dwIndirectionLevel;
 	bool m_fFrameRelative;
 	unsigned int m_address;
+	// NPL only: handle of the value in the debuggee, 0 if the value can not be expanded. It is valid until the debuggee resumes.
+	unsigned int m_nHandle;
+	// NPL only: number of children, which is a lower bound for large tables. The exact number is known when the first page of children is fetched.
+	int m_nChildCount;
+	// NPL only: index of the first child to fetch starting from 1. It is larger than 1 for the node that lists the rest of a large table.
+	int m_nChildFrom;
+	// NPL only: the thread of the NPL state and its stop epoch when the value was listed, see NPLDebugLane::m_nStopEpoch
+	DWORD m_dwThreadId;
+	int m_nStopEpoch;
 
 	VariableInformation^ child;
 
@@ -31,13 +40,36 @@ public:
 										DWORD dwOffset, 
 										DWORD dwIndirectionLevel);
 
-	static VariableInformation^ Create(DebuggedProcess^ debuggedProcess, String^ varName);
+	/** evaluate an NPL expression in the stopped state. Names and dotted paths are cached until the state resumes. 
+	* If the state does not list them, such as an older IPCDebugger.lua without "children", they are dumped as text like other expressions. 
+	* @param nFrameLevel: the frame of the expression context, see X86ThreadContext::nFrameLevel */
+	static VariableInformation^ Create(DebuggedProcess^ debuggedProcess, String^ varName, int nFrameLevel);
+
+	/** a variable or table entry listed by the NPL debuggee, see DebuggedProcess::NPL_GetFrameVariables() and NPL_GetChildren() */
+	static VariableInformation^ Create(DebuggedProcess^ debuggedProcess, String^ varName, String^ typeName, String^ value, unsigned int nHandle, int nChildCount);
+
+	/** NPL only: the children of a table, which are fetched a page at a time on first use. 
+	* If the table has more children, the last one is a node that fetches the next page when it is expanded.
+	* If the debuggee can not list them, a variable listed by name has a single "[dump]" child with the text dump of the variable instead. 
+	* @return nullptr if there are no children, or the debuggee has resumed since the value was listed. */
+	cli::array<VariableInformation^>^ GetChildren();
+
+	// NPL only: name of a variable listed by NPL_GetFrameVariables() or NPL_InspectVariable(), which is dumped as text if its children can not be listed. 
+	// It is nullptr for table entries.
+	String^ m_sExpression;
 
 private:
 	VariableInformation()
 	{
 
 	}
+
+	/** the old text dump of an NPL expression, which is executed if it is not a name or a dotted path. */
+	static VariableInformation^ CreateFromDump(DebuggedProcess^ debuggedProcess, String^ varName);
+
+	// NPL only: the process that listed the value, and its fetched children
+	DebuggedProcess^ m_debuggedProcess;
+	cli::array<VariableInformation^>^ m_children;
 };
 
 END_NAMESPACE
\ No newline at end of file
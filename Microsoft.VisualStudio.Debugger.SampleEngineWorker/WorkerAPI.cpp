@@ -26,15 +26,55 @@
 #include "ModuleResolver.h"
 #include "DiaStackWalkHelper.h"
 #include "DiaFrameHolder.h"
+#include "NPLDebugTransport.h"
+#include "NPLDebugMailbox.h"
+#include "NPLDebugOpcodes.h"
+#include "NPLDebugCodec.h"
+#include "NPLDebugRecorder.h"
+#include "NPLFileIdStore.h"
 
 using namespace ParaEngine;
 
 #pragma region NPL debugger
 
-/** the main debug output queue. */
-CInterprocessQueue* g_output_queue = NULL;
-CInterprocessQueue* g_input_queue = NULL;
+/** max time in milliseconds to wait for the reply of an expression evaluation. */
+#define NPL_EVALUATE_TIMEOUT 3000
+/** "BP" message formats, sent in param2 of "BP". The highest format we can decode is offered in "Attach". */
+#define NPL_BP_FORMAT_TEXT 0
+#define NPL_BP_FORMAT_BINARY 1
+/** max number of frames in binary "BP" messages. The other frames are fetched with "stackrange" when visual studio walks the stack. */
+#define NPL_STACK_PAGE_SIZE 16
+/** max number of children of a table fetched at a time with "children". */
+#define NPL_CHILDREN_PAGE_SIZE 100
+/** max size in bytes of output messages that are merged into a single OnOutputString() call. */
+#define NPL_OUTPUT_COALESCE_SIZE (64*1024)
+
+/** input queue of the main lane. Other NPL states use NPL_MAIN_LANE_QUEUE + "_" + state name. */
+#define NPL_MAIN_LANE_QUEUE "NPLDebug"
+/** the queue that all NPL states reply to. */
+#define NPL_REPLY_QUEUE "VSDebug"
+
+/** the default transport: "NPLDebug" queue to the debuggee and "VSDebug" queue from the debuggee. */
+CNPLQueueTransport* g_queue_transport = NULL;
+/** the TCP transport to a remote debuggee, used instead of g_queue_transport if NPL_DEBUG_TRANSPORT is "tcp://host:port". */
+CNPLSocketTransport* g_socket_transport = NULL;
+/** plays back a recorded session if NPL_DEBUG_TRANSPORT is "replay://filename". */
+CNPLReplayTransport* g_replay_transport = NULL;
+/** the transport used for sending. */
+INPLDebugTransport* g_active_transport = NULL;
+/** messages received from all transports by dedicated threads. */
+CNPLDebugMailbox* g_input_mailbox = NULL;
+/** records all messages of the session if NPL_DEBUG_RECORD is set, otherwise NULL. */
+CNPLDebugRecorder* g_recorder = NULL;
+/** an error of GetInputMailbox() that is reported to the output window by the poll thread, since there may be no callback yet. */
+const char* g_sTransportError = NULL;
 InterProcessMessagePtr g_lastDebugMsg;
+/** send only queues to NPL states other than the main lane, mapping from queue name to queue. 
+* It is guarded by the lock of DebuggedProcess::m_lanes. */
+std::map<std::string, CInterprocessQueue*> g_lane_queues;
+/** persistent file id tables accepted by NPL states in "Attached", mapping from lane queue name to the store. 
+* It is only used on the poll thread. */
+std::map<std::string, CNPLFileIdStore*> g_file_stores;
 
 void ConvertCliStringToStdString(String ^ clistr, std::string & out)
 {
@@ -67,55 +107,211 @@ std::string ConvertCliStringToStdString(String ^ clistr)
 	}
 }
 
-CInterprocessQueue* GetOutputQueue()
+/** the preferred transport can be selected with the environment variable NPL_DEBUG_TRANSPORT of visual studio, such as "queue", 
+* "tcp://host:port" to debug a process on another machine, or "replay://filename" to play back a session recorded with NPL_DEBUG_RECORD. It defaults to "queue". */
+std::string GetPreferredTransport()
 {
-	if(g_output_queue != 0)
-		return g_output_queue;
-	else
+	const char* sTransport = getenv("NPL_DEBUG_TRANSPORT");
+	return (sTransport != 0 && sTransport[0] != '\0') ? sTransport : "queue";
+}
+
+/** statistics of the debug engine, such as evaluation cache hits and replay time, are reported to the output window 
+* if the environment variable NPL_DEBUG_STATS of visual studio is set to anything but "0". */
+bool IsDebugStatsEnabled()
+{
+	static int s_nEnabled = -1;
+	if(s_nEnabled < 0)
 	{
-		// always create the queue instead of IPQU_open_or_create, IPQU_create_only. 
-		g_output_queue = new CInterprocessQueue("NPLDebug", IPQU_open_or_create);
-		g_output_queue->Clear();
-		return g_output_queue;
+		const char* sStats = getenv("NPL_DEBUG_STATS");
+		s_nEnabled = (sStats != 0 && sStats[0] != '\0' && strcmp(sStats, "0") != 0) ? 1 : 0;
 	}
+	return s_nEnabled == 1;
 }
 
-CInterprocessQueue* GetInputQueue()
+/** all incoming messages should be read via the mailbox, since its receiver threads own the transports. 
+* It also creates the default queue transport, or the socket transport to a remote debuggee. */
+CNPLDebugMailbox* GetInputMailbox()
 {
-	if(g_input_queue != 0)
-		return g_input_queue;
+	if(g_input_mailbox != 0)
+		return g_input_mailbox;
 	else
 	{
-		g_input_queue = new CInterprocessQueue("VSDebug", IPQU_open_or_create);
-		g_input_queue->Clear();
-		return g_input_queue;
+		g_input_mailbox = new CNPLDebugMailbox();
+		const char* sRecordFile = getenv("NPL_DEBUG_RECORD");
+		if(sRecordFile != 0 && sRecordFile[0] != '\0')
+		{
+			g_recorder = new CNPLDebugRecorder();
+			if(g_recorder->Open(sRecordFile))
+				g_input_mailbox->SetRecorder(g_recorder);
+			else
+				SAFE_DELETE(g_recorder);
+		}
+		std::string sTransport = GetPreferredTransport();
+		if(sTransport.compare(0, 6, "tcp://") == 0)
+		{
+			g_socket_transport = new CNPLSocketTransport(sTransport.c_str() + 6);
+			g_active_transport = g_socket_transport;
+			g_input_mailbox->AddTransport(g_socket_transport);
+		}
+		else if(sTransport.compare(0, 9, "replay://") == 0)
+		{
+			// play back a recorded session instead of talking to a live debuggee
+			const char* sPace = getenv("NPL_DEBUG_REPLAY_PACE");
+			g_replay_transport = new CNPLReplayTransport();
+			if(!g_replay_transport->Open(sTransport.c_str() + 9, sPace != 0 && strcmp(sPace, "recorded") == 0))
+			{
+				g_sTransportError = "NPL debugger: can not open the recorded session\n";
+			}
+			g_active_transport = g_replay_transport;
+			g_input_mailbox->AddTransport(g_replay_transport);
+		}
+		else
+		{
+			g_queue_transport = new CNPLQueueTransport(NPL_REPLY_QUEUE, NPL_MAIN_LANE_QUEUE);
+			g_active_transport = g_queue_transport;
+			g_input_mailbox->AddTransport(g_queue_transport);
+		}
+		return g_input_mailbox;
 	}
 }
 
+INPLDebugTransport* GetActiveTransport()
+{
+	GetInputMailbox();
+	return g_active_transport;
+}
+
 /** whether we are debugging NPL, instead of native code. */
 bool IsDebuggingNPL() {return true;}
 
-/** send an async debug message to the remote process. */
-int SendDebugMessage(const char* filename, int nType = 0, int nParam1 = 0, int nParam2 = 0, const char* code = NULL)
+/** The message name is sent along with the opcode, so that older debuggees can dispatch it by name. */
+void MakeDebugMessage(InterProcessMessage& msg_out, int nOpcode, int nParam1, int nParam2, const char* code)
+{
+	msg_out.m_method = "debug";
+	msg_out.m_nMsgType = nOpcode;
+	msg_out.m_nParam1 = nParam1;
+	msg_out.m_nParam2 = nParam2;
+	const char* filename = NPLDebugOpcodeToName(nOpcode);
+	if(filename!=0)
+		msg_out.m_filename = filename;
+	msg_out.m_from = NPL_REPLY_QUEUE;
+	if(code)
+		msg_out.m_code = code;
+}
+
+/** send an async debug message to the main lane of the remote process. 
+* @param nParam1: for requests that expect a reply, it is the request id returned by CNPLDebugMailbox::BeginRequest(). */
+int SendDebugMessage(NPLDebugOpcode nOpcode, int nParam1 = 0, int nParam2 = 0, const char* code = NULL)
 {
-	CInterprocessQueue* pOutputQueue = GetOutputQueue();
-	if(pOutputQueue)
+	INPLDebugTransport* pTransport = GetActiveTransport();
+	if(pTransport)
 	{
 		InterProcessMessage msg_out;
-		msg_out.m_method = "debug";
-		msg_out.m_nMsgType = nType;
-		msg_out.m_nParam1 = nParam1;
-		msg_out.m_nParam2 = nParam2;
-		if(filename!=0)
-			msg_out.m_filename = filename;
-		msg_out.m_from = "VSDebug";
-		if(code)
-			msg_out.m_code = code;
-		return pOutputQueue->try_send(msg_out, 1);
+		MakeDebugMessage(msg_out, nOpcode, nParam1, nParam2, code);
+		if(g_recorder)
+			g_recorder->Record(NPL_DEBUG_DIR_TO_DEBUGGEE, msg_out);
+		return pTransport->Send(msg_out, 1);
 	}
 	return 0;
 }
 
+/** send an async debug message to a state other than the main lane. The caller should lock DebuggedProcess::m_lanes. */
+int SendDebugMessageToQueue(const std::string& sQueueName, int nOpcode, int nParam1, int nParam2, const char* code)
+{
+	CInterprocessQueue* pQueue = NULL;
+	std::map<std::string, CInterprocessQueue*>::iterator itCur = g_lane_queues.find(sQueueName);
+	if(itCur != g_lane_queues.end())
+	{
+		pQueue = itCur->second;
+	}
+	else
+	{
+		pQueue = new CInterprocessQueue(sQueueName.c_str(), IPQU_open_or_create);
+		g_lane_queues[sQueueName] = pQueue;
+	}
+	InterProcessMessage msg_out;
+	MakeDebugMessage(msg_out, nOpcode, nParam1, nParam2, code);
+	if(g_recorder)
+		g_recorder->Record(NPL_DEBUG_DIR_TO_DEBUGGEE, msg_out);
+	return pQueue->try_send(msg_out, 1);
+}
+
+/** get the persistent file id table of a lane. The caller must lock DebuggedProcess::m_lanes. 
+* @return NULL if the state did not accept one. */
+CNPLFileIdStore* GetFileStore(const std::string& sQueueName)
+{
+	std::map<std::string, CNPLFileIdStore*>::iterator itCur = g_file_stores.find(sQueueName);
+	return (itCur != g_file_stores.end() && itCur->second->IsOpen()) ? itCur->second : NULL;
+}
+
+/** map the file id table written by a state, replacing the previous one of the lane. The caller must lock DebuggedProcess::m_lanes. 
+* The table of a lane is opened again in place instead of being deleted, since the UI thread may be reading it, see NPL_FetchStackFrames(). 
+* @param sFileName: absolute path on the debuggee machine, or empty to close the table. 
+* @return false if the table can not be opened, in which case file ids that are not in the message can not be resolved. */
+bool OpenFileStore(const std::string& sQueueName, const std::string& sFileName)
+{
+	std::map<std::string, CNPLFileIdStore*>::iterator itCur = g_file_stores.find(sQueueName);
+	CNPLFileIdStore* pStore = NULL;
+	if(itCur != g_file_stores.end())
+	{
+		pStore = itCur->second;
+	}
+	else if(!sFileName.empty())
+	{
+		pStore = new CNPLFileIdStore();
+		g_file_stores[sQueueName] = pStore;
+	}
+	if(pStore == NULL)
+		return true;
+	if(sFileName.empty())
+	{
+		pStore->Close();
+		return true;
+	}
+	return pStore->Open(sFileName.c_str());
+}
+
+/** close the file id tables of all lanes, since the debuggee truncates its table on "Attach", 
+* which fails on a file that is still mapped. The caller must lock DebuggedProcess::m_lanes if the poll thread is running. */
+void CloseFileStores()
+{
+	for(std::map<std::string, CNPLFileIdStore*>::iterator itCur = g_file_stores.begin(); itCur != g_file_stores.end(); ++itCur)
+	{
+		itCur->second->Close();
+	}
+}
+
+/** options of "Attach" that are supported by all lanes. */
+void WriteAttachOptions(NPLInterface::CNPLWriter& writer)
+{
+	writer.WriteName("bpformat");
+	writer.WriteValue((int)NPL_BP_FORMAT_BINARY);
+	// the debuggee may keep its file ids in a file that we map, which is only possible on the same machine. 
+	if(g_socket_transport == NULL)
+	{
+		writer.WriteName("filestore");
+		writer.WriteValue(1);
+	}
+	// we acknowledge output batches with "OutputAck", so that the debuggee can limit output in flight. 
+	writer.WriteName("outputack");
+	writer.WriteValue(1);
+	// "BP" messages only carry the top frames and the stack depth, see DebuggedProcess::NPL_FetchStackFrames(). 
+	writer.WriteName("stackpage");
+	writer.WriteValue((int)NPL_STACK_PAGE_SIZE);
+}
+
+/** send "Attach" to enable debug hook in NPL. */
+int SendAttachMessage()
+{
+	NPLInterface::CNPLWriter writer;
+	writer.WriteName("msg");
+	writer.BeginTable();
+	WriteAttachOptions(writer);
+	writer.EndTable();
+	CloseFileStores();
+	return SendDebugMessage(NPL_DEBUG_OP_ATTACH, 0, 0, writer.ToString().c_str());
+}
+
 void DebuggedProcess::NPL_Suspend()
 {
 	// here we will do nothing. 
@@ -126,40 +322,199 @@ void DebuggedProcess::NPL_Resume()
 	// here we will do nothing. 
 }
 
+// the caller should lock m_breakpointMap. The change is sent by FlushPendingBreakpoints(). 
 void DebuggedProcess::NPL_SetBreakPoint(unsigned int addr)
 {
+	// if it is removed and added again before it is sent, it is still sent as added, since an added breakpoint also replaces its condition in the debuggee. 
+	m_pendingBreakpointDelta[addr] = true;
+}
+
+// the caller should lock m_breakpointMap. The change is sent by FlushPendingBreakpoints(). 
+void DebuggedProcess::NPL_RemoveBreakPoint(unsigned int addr)
+{
+	if(m_bNPLProcDetachRequested)
+		return;
+	// it is sent even if it was added after the last flush, since the pending add may only be a condition change of a breakpoint that the debuggee has. 
+	m_pendingBreakpointDelta[addr] = false;
+}
+
+/** append "filename|line\n" of the breakpoint at the given address. */
+void DebuggedProcess::NPL_AppendBreakpoint(std::string& out, unsigned int addr)
+{
+	String^ filename = ""; 
+	int line = 0;
+	GetFileLineByAddress(addr, filename, line);
+	out += ConvertCliStringToStdString(filename);
+	char sLine[32];
+	_snprintf(sLine, sizeof(sLine), "|%d\n", line);
+	out += sLine;
+}
+
+/** append the text as the rest of a "setbs" line. Line breaks and backslashes are escaped as \n, \r and \\, 
+* since replacing line breaks with spaces would change code that has "--" comments or long strings. */
+static void NPL_AppendEscapedLine(std::string& out, String^ text)
+{
+	std::string sText = ConvertCliStringToStdString(text);
+	for(size_t i = 0; i < sText.size(); ++i)
+	{
+		char c = sText[i];
+		if(c == '\\')
+			out += "\\\\";
+		else if(c == '\n')
+			out += "\\n";
+		else if(c == '\r')
+			out += "\\r";
+		else
+			out += c;
+	}
+}
+
+// the caller should lock m_breakpointMap. 
+void DebuggedProcess::NPL_AppendBreakpointCondition(std::string& out, unsigned int addr)
+{
+	BreakpointData^ bpData;
+	if(!m_breakpointMap->TryGetValue(addr, bpData) || (String::IsNullOrEmpty(bpData->Condition) && bpData->PassCountStyle == 0))
+		return;
+	String^ filename = ""; 
+	int line = 0;
+	GetFileLineByAddress(addr, filename, line);
+	out += ConvertCliStringToStdString(filename);
+	char sLine[64];
+	_snprintf(sLine, sizeof(sLine), "|%d|%d|%u|", line, bpData->PassCountStyle, bpData->PassCount);
+	out += sLine;
+	if(!String::IsNullOrEmpty(bpData->Condition))
+	{
+		// the condition is the rest of the line
+		NPL_AppendEscapedLine(out, bpData->Condition);
+	}
+	out += "\n";
+}
+
+// the caller should lock m_breakpointMap. 
+void DebuggedProcess::NPL_AppendLogMessage(std::string& out, unsigned int addr)
+{
+	BreakpointData^ bpData;
+	if(!m_breakpointMap->TryGetValue(addr, bpData) || String::IsNullOrEmpty(bpData->LogMessage))
+		return;
 	String^ filename = ""; 
 	int line = 0;
 	GetFileLineByAddress(addr, filename, line);
+	out += ConvertCliStringToStdString(filename);
+	char sLine[32];
+	_snprintf(sLine, sizeof(sLine), "|%d|", line);
+	out += sLine;
+	// the message is the rest of the line
+	NPL_AppendEscapedLine(out, bpData->LogMessage);
+	out += "\n";
+}
+
+// the caller should lock m_breakpointMap. 
+void DebuggedProcess::NPL_SendBreakpoints(bool bFullTable, NPLDebugLane^ lane)
+{
+	// breakpoints are sent as "filename|line\n" lists, since file names never contain '|'. 
+	// Conditions, hit counts and log messages of added breakpoints are sent in separate lists, so that they are empty in most cases. 
+	std::string sAdded, sRemoved, sConditions, sLogMessages;
+	if(bFullTable)
+	{
+		for each (DWORD_PTR address in m_breakpointMap->Keys)
+		{
+			NPL_AppendBreakpoint(sAdded, (unsigned int)address);
+			NPL_AppendBreakpointCondition(sConditions, (unsigned int)address);
+			NPL_AppendLogMessage(sLogMessages, (unsigned int)address);
+		}
+	}
+	else
+	{
+		for each (Collections::Generic::KeyValuePair<DWORD_PTR, bool> delta in m_pendingBreakpointDelta)
+		{
+			NPL_AppendBreakpoint(delta.Value ? sAdded : sRemoved, (unsigned int)delta.Key);
+			if(delta.Value)
+			{
+				NPL_AppendBreakpointCondition(sConditions, (unsigned int)delta.Key);
+				NPL_AppendLogMessage(sLogMessages, (unsigned int)delta.Key);
+			}
+		}
+		// a full table may be sent to a single lane, so pending changes are only cleared once they are sent to all lanes. 
+		m_pendingBreakpointDelta->Clear();
+	}
 
 	NPLInterface::CNPLWriter writer;
 	writer.WriteName("msg");
 	writer.BeginTable();
-	writer.WriteName("filename");
-	writer.WriteValue(ConvertCliStringToStdString(filename).c_str());
-	writer.WriteName("line");
-	writer.WriteValue((int)line);
+	writer.WriteName("mode");
+	writer.WriteValue(bFullTable ? "full" : "delta");
+	writer.WriteName("add");
+	writer.WriteValue(sAdded.c_str());
+	writer.WriteName("del");
+	writer.WriteValue(sRemoved.c_str());
+	if(!sConditions.empty())
+	{
+		writer.WriteName("cond");
+		writer.WriteValue(sConditions.c_str());
+	}
+	if(!sLogMessages.empty())
+	{
+		writer.WriteName("log");
+		writer.WriteValue(sLogMessages.c_str());
+	}
 	writer.EndTable();
-	SendDebugMessage("setb", 0, 0, 0, writer.ToString().c_str());
+	NPL_SendToLane(lane, NPL_DEBUG_OP_SETBS, 0, 0, writer.ToString().c_str());
 }
 
-void DebuggedProcess::NPL_RemoveBreakPoint(unsigned int addr)
+NPLDebugLane^ DebuggedProcess::NPL_GetLane(const std::string& sQueueName)
 {
-	if(m_bNPLProcDetachRequested)
+	return m_lanes->GetLane(gcnew String(sQueueName.c_str()));
+}
+
+NPLDebugLane^ DebuggedProcess::NPL_GetLaneByThread(DWORD dwThreadId)
+{
+	return m_lanes->GetLaneByThread(dwThreadId);
+}
+
+void DebuggedProcess::NPL_AddLane(String^ sName, String^ sQueueName)
+{
+	msclr::lock lock(m_lanes);
+	NPLDebugLane^ lane = m_lanes->AddLane(sName, sQueueName);
+	if(lane == nullptr)
 		return;
-	String^ filename = ""; 
-	int line = 0;
-	GetFileLineByAddress(addr, filename, line);
-	
+
+	// the thread is created when the state replies "Attached"
 	NPLInterface::CNPLWriter writer;
 	writer.WriteName("msg");
 	writer.BeginTable();
-	writer.WriteName("filename");
-	writer.WriteValue(ConvertCliStringToStdString(filename).c_str());
-	writer.WriteName("line");
-	writer.WriteValue((int)line);
+	WriteAttachOptions(writer);
 	writer.EndTable();
-	SendDebugMessage("delb", 0, 0, 0, writer.ToString().c_str());
+	OpenFileStore(ConvertCliStringToStdString(sQueueName), "");
+	NPL_SendToLane(lane, NPL_DEBUG_OP_ATTACH, 0, 0, writer.ToString().c_str());
+}
+
+int DebuggedProcess::NPL_SendToLane(NPLDebugLane^ lane, int nOpcode, int nParam1, int nParam2, const char* code)
+{
+	// THREADING: Can be called on any thread
+	msclr::lock lock(m_lanes);
+	if(lane == nullptr)
+	{
+		int nResult = 0;
+		for each (NPLDebugLane^ lane_ in m_lanes->Lanes)
+		{
+			if(NPL_SendToLane(lane_, nOpcode, nParam1, nParam2, code) != 0)
+				nResult = -1;
+		}
+		return nResult;
+	}
+	if(lane == m_mainLane)
+		return SendDebugMessage((NPLDebugOpcode)nOpcode, nParam1, nParam2, code);
+	return SendDebugMessageToQueue(ConvertCliStringToStdString(lane->m_sQueueName), nOpcode, nParam1, nParam2, code);
+}
+
+void DebuggedProcess::FlushPendingBreakpoints()
+{
+	// THREADING: Can be called on any thread
+	msclr::lock lock(m_breakpointMap);
+	if(m_pendingBreakpointDelta->Count > 0 && !m_bNPLProcDetachRequested)
+	{
+		NPL_SendBreakpoints(false, nullptr);
+	}
 }
 
 bool DebuggedProcess::NPL_EvaluateExpressionSync(String^ sExpression, String^% sOutputValue)
@@ -176,46 +531,280 @@ bool DebuggedProcess::NPL_EvaluateExpressionSync(String^ sExpression, String^% s
 	//writer.WriteValue(0);
 	writer.EndTable();
 
+	// the reply is correlated by request id, so that concurrent evaluations never steal each other's reply. 
+	CNPLDebugMailbox* pMailbox = GetInputMailbox();
+	int nRequestId = pMailbox->BeginRequest("ExpValue");
+
 	// if expression contains special characters of +;(), we will execute instead of evaluate. 
-	if(sExpression_.find_first_of("=;()") == std::string::npos)
+	NPLDebugOpcode nCommand = (sExpression_.find_first_of("=;()") == std::string::npos) ? NPL_DEBUG_OP_DUMP : NPL_DEBUG_OP_EXEC;
+	// evaluate in the state that stopped
+	NPLDebugLane^ lane = NPL_GetLaneByThread(m_lastDebugEvent.dwThreadId);
+	if(lane == nullptr)
+		lane = m_mainLane;
+	NPL_SendToLane(lane, nCommand, nRequestId, 0, writer.ToString().c_str());
+
+	std::string sReply;
+	pMailbox->WaitForReply(nRequestId, NPL_EVALUATE_TIMEOUT, sReply);
+	sOutputValue = gcnew String(sReply.c_str());
+	if(!String::IsNullOrEmpty(sOutputValue))
+	{
+		// Debug::WriteLine(String::Format(L"Exp: {0}:{1}", sExpression, sOutputValue));
+		return true;
+	}
+	return false;	
+}
+
+CNPLFileIdStore* DebuggedProcess::NPL_GetFileStore(NPLDebugLane^ lane)
+{
+	msclr::lock lock(m_lanes);
+	return GetFileStore(ConvertCliStringToStdString(lane->m_sQueueName));
+}
+
+void DebuggedProcess::NPL_FetchStackFrames(NPLDebugLane^ lane)
+{
+	int nStopEpoch = lane->m_nStopEpoch;
+	int nFrom = lane->m_stackInfos->Count + 1;
+	int nCount = lane->m_nStackDepth - lane->m_stackInfos->Count;
+	if(nCount <= 0)
+		return;
+
+	NPLInterface::CNPLWriter writer;
+	writer.WriteName("msg");
+	writer.BeginTable();
+	writer.WriteName("from");
+	writer.WriteValue(nFrom);
+	writer.WriteName("count");
+	writer.WriteValue(nCount);
+	writer.EndTable();
+
+	CNPLDebugMailbox* pMailbox = GetInputMailbox();
+	int nRequestId = pMailbox->BeginRequest("StackFrames");
+	NPL_SendToLane(lane, NPL_DEBUG_OP_STACK_RANGE, nRequestId, 0, writer.ToString().c_str());
+	std::string sReply;
+	if(!pMailbox->WaitForReply(nRequestId, NPL_EVALUATE_TIMEOUT, sReply))
 	{
-		SendDebugMessage("dump", 0, 0, 0, writer.ToString().c_str());
+		// the state did not reply, the frames sent in "BP" are all we show. 
+		return;
 	}
-	else
+	// the reply refers to files interned by the lane, while the poll thread may be decoding messages of other lanes
+	if(!lane->AddStackFrames(nStopEpoch, sReply, m_sourceTable, NPL_GetFileStore(lane)))
 	{
-		SendDebugMessage("exec", 0, 0, 0, writer.ToString().c_str());
+		m_callback->OnOutputString(gcnew String("NPL debugger: malformed stack frames message\n"));
 	}
+}
+
+bool DebuggedProcess::NPL_RequestStoppedLane(NPLDebugLane^ lane, int nOpcode, const char* sReplyName, const std::string& sCode, std::string& sReply)
+{
+	if(lane == nullptr || !lane->m_bStopped)
+		return false;
+	int nStopEpoch = lane->m_nStopEpoch;
+	CNPLDebugMailbox* pMailbox = GetInputMailbox();
+	int nRequestId = pMailbox->BeginRequest(sReplyName);
+	NPL_SendToLane(lane, nOpcode, nRequestId, 0, sCode.c_str());
+	// handles in a late reply may already be released
+	return pMailbox->WaitForReply(nRequestId, NPL_EVALUATE_TIMEOUT, sReply) && lane->m_nStopEpoch == nStopEpoch && lane->m_bStopped;
+}
+
+/** create the variables in "FrameVars" and "Children" replies: {vars = {{kind, name, type, value, handle, count}, ...}}. 
+* @param parameters: variables whose kind is "param" are added to it if it is not nullptr, all others are added to variables. */
+static void NPLReadVariables(DebuggedProcess^ process, NPLInterface::NPLObjectProxy& msg, NPLDebugLane^ lane, 
+	Collections::Generic::List<VariableInformation^>^ variables, Collections::Generic::List<VariableInformation^>^ parameters)
+{
+	NPLInterface::NPLObjectProxy vars = msg["vars"];
+	if (vars->GetType() != NPLInterface::NPLObjectBase::NPLObjectType_Table)
+		return;
+	for (auto iter = vars.index_begin(); iter != vars.index_end(); iter++)
+	{
+		NPLInterface::NPLObjectProxy& var = iter->second;
+		std::string kind = (string)var["kind"];
+		std::string name_ = (string)var["name"];
+		std::string type_ = (string)var["type"];
+		std::string value_ = (string)var["value"];
+		unsigned int nHandle = (unsigned int)((double)var["handle"]);
+		int nChildCount = (int)((double)var["count"]);
+		VariableInformation^ variable = VariableInformation::Create(process, gcnew String(name_.c_str()), gcnew String(type_.c_str()), gcnew String(value_.c_str()), nHandle, nChildCount);
+		variable->m_dwThreadId = lane->m_dwThreadId;
+		variable->m_nStopEpoch = lane->m_nStopEpoch;
+		if(parameters != nullptr && kind == "param")
+			parameters->Add(variable);
+		else
+			variables->Add(variable);
+	}
+}
 
-	CInterprocessQueue* pInputQueue = GetInputQueue();
-	if(pInputQueue)
+bool DebuggedProcess::NPL_GetFrameVariables(DWORD dwThreadId, int nFrameLevel, Collections::Generic::List<VariableInformation^>^ parameters, Collections::Generic::List<VariableInformation^>^ locals)
+{
+	NPLDebugLane^ lane = NPL_GetLaneByThread(dwThreadId);
+	if(lane == nullptr)
+		lane = m_mainLane;
+	if(nFrameLevel <= 0)
+		return false;
+
+	NPLInterface::CNPLWriter writer;
+	writer.WriteName("msg");
+	writer.BeginTable();
+	writer.WriteName("level");
+	writer.WriteValue(nFrameLevel);
+	writer.EndTable();
+
+	std::string sReply;
+	if(!NPL_RequestStoppedLane(lane, NPL_DEBUG_OP_GET_FRAME_VARS, "FrameVars", writer.ToString(), sReply))
+		return false;
+	// kind is "param", "local" or "upvalue"
+	NPLInterface::NPLObjectProxy msg = NPLInterface::NPLHelper::MsgStringToNPLTable(sReply.c_str());
+	NPLReadVariables(this, msg, lane, locals, parameters);
+	for each (VariableInformation^ variable in parameters)
+		variable->m_sExpression = variable->m_name;
+	for each (VariableInformation^ variable in locals)
+		variable->m_sExpression = variable->m_name;
+	return true;
+}
+
+VariableInformation^ DebuggedProcess::NPL_InspectVariable(String^ sName, int nFrameLevel)
+{
+	// the same state as NPL_EvaluateExpressionSync()
+	NPLDebugLane^ lane = NPL_GetLaneByThread(m_lastDebugEvent.dwThreadId);
+	if(lane == nullptr)
+		lane = m_mainLane;
+	if(lane == nullptr)
+		return nullptr;
+
+	String^ sKey = String::Format("{0}|{1}|{2}|{3}", lane->m_dwThreadId, lane->m_nStopEpoch, nFrameLevel, sName);
+	VariableInformation^ variable;
+	{
+		msclr::lock lock(m_evaluationCache);
+		if(m_evaluationCache->TryGetValue(sKey, variable))
+		{
+			m_nEvaluationCacheHits++;
+			return variable;
+		}
+		m_nEvaluationCacheMisses++;
+	}
+
+	NPLInterface::CNPLWriter writer;
+	writer.WriteName("msg");
+	writer.BeginTable();
+	writer.WriteName("name");
+	writer.WriteValue(ConvertCliStringToStdString(sName).c_str());
+	if(nFrameLevel > 0)
 	{
-		InterProcessMessage msg_in;
-		unsigned int nPriority = 0;
-		
-		// wait for at most 10*100 seconds for the reply
-		bool bHasResult = false;
-		for( int i=0, nHasResultCount = 0;i<10 && nHasResultCount<2;i++)
+		// the name is looked up in the locals and upvalues of that frame, instead of the current level of "set"
+		writer.WriteName("level");
+		writer.WriteValue(nFrameLevel);
+	}
+	writer.EndTable();
+
+	std::string sReply;
+	if(!NPL_RequestStoppedLane(lane, NPL_DEBUG_OP_GET_CHILDREN, "Children", writer.ToString(), sReply))
+		return nullptr;
+	NPLInterface::NPLObjectProxy msg = NPLInterface::NPLHelper::MsgStringToNPLTable(sReply.c_str());
+	Collections::Generic::List<VariableInformation^>^ vars = gcnew Collections::Generic::List<VariableInformation^>();
+	NPLReadVariables(this, msg, lane, vars, nullptr);
+	if(vars->Count == 0)
+		return nullptr;
+	variable = vars[0];
+	variable->m_sExpression = sName;
+	{
+		// the fetched children of the value are kept with it
+		msclr::lock lock(m_evaluationCache);
+		m_evaluationCache[sKey] = variable;
+	}
+	return variable;
+}
+
+void DebuggedProcess::NPL_ClearEvaluationCache()
+{
+	String^ summary = nullptr;
+	{
+		msclr::lock lock(m_evaluationCache);
+		if(m_nEvaluationCacheHits + m_nEvaluationCacheMisses > 0)
 		{
-			Sleep(100);
-			while(pInputQueue->try_receive(msg_in, nPriority) == 0)
+			m_nTotalEvaluationCacheHits += m_nEvaluationCacheHits;
+			m_nTotalEvaluationCacheMisses += m_nEvaluationCacheMisses;
+			if(IsDebugStatsEnabled())
 			{
-				if(msg_in.m_filename == "ExpValue")
-				{
-					String^ expValue = gcnew String(msg_in.m_code.c_str());
-					sOutputValue += expValue;
-					bHasResult = true;
-				}
+				summary = String::Format("NPL debugger: evaluation cache {0} hits, {1} misses in the last stop, {2} hits, {3} misses in total\n", 
+					m_nEvaluationCacheHits, m_nEvaluationCacheMisses, m_nTotalEvaluationCacheHits, m_nTotalEvaluationCacheMisses);
 			}
-			if(bHasResult)
-				++ nHasResultCount;
+			m_nEvaluationCacheHits = 0;
+			m_nEvaluationCacheMisses = 0;
 		}
-		if(!String::IsNullOrEmpty(sOutputValue))
+		m_evaluationCache->Clear();
+	}
+	// the callback is not made while holding the lock
+	if(summary != nullptr)
+		m_callback->OnOutputString(summary);
+}
+
+cli::array<VariableInformation^>^ DebuggedProcess::NPL_GetChildren(VariableInformation^ parent)
+{
+	NPLDebugLane^ lane = NPL_GetLaneByThread(parent->m_dwThreadId);
+	if(lane == nullptr)
+		lane = m_mainLane;
+	// handles are only valid in the stop that listed them
+	if(lane == nullptr || lane->m_nStopEpoch != parent->m_nStopEpoch)
+		return nullptr;
+
+	NPLInterface::CNPLWriter writer;
+	writer.WriteName("msg");
+	writer.BeginTable();
+	writer.WriteName("handle");
+	writer.WriteValue((int)parent->m_nHandle);
+	writer.WriteName("from");
+	writer.WriteValue(parent->m_nChildFrom);
+	writer.WriteName("count");
+	writer.WriteValue((int)NPL_CHILDREN_PAGE_SIZE);
+	writer.EndTable();
+
+	std::string sReply;
+	if(!NPL_RequestStoppedLane(lane, NPL_DEBUG_OP_GET_CHILDREN, "Children", writer.ToString(), sReply))
+		return nullptr;
+	// {vars, from, total}, where kind is "field"
+	NPLInterface::NPLObjectProxy msg = NPLInterface::NPLHelper::MsgStringToNPLTable(sReply.c_str());
+	Collections::Generic::List<VariableInformation^>^ children = gcnew Collections::Generic::List<VariableInformation^>();
+	NPLReadVariables(this, msg, lane, children, nullptr);
+
+	int nTotal = (int)((double)msg["total"]);
+	int nNext = parent->m_nChildFrom + children->Count;
+	if(children->Count > 0 && nNext <= nTotal)
+	{
+		// the rest of a large table is listed a page at a time by a node after the last child
+		int nRest = nTotal - nNext + 1;
+		VariableInformation^ more = VariableInformation::Create(this, gcnew String("[more]"), parent->m_typeName, String::Format("{0} more items", nRest), parent->m_nHandle, nRest);
+		more->m_nChildFrom = nNext;
+		more->m_dwThreadId = parent->m_dwThreadId;
+		more->m_nStopEpoch = parent->m_nStopEpoch;
+		children->Add(more);
+	}
+	return children->ToArray();
+}
+
+bool DebuggedProcess::NPL_ParseBreakpointText(const std::string& sCode, String^% filename, int% line)
+{
+	NPLInterface::NPLObjectProxy msg = NPLInterface::NPLHelper::MsgStringToNPLTable(sCode.c_str());
+	std::string filename_ = msg["filename"];
+	filename = gcnew String(filename_.c_str());
+	line = (int)((double)(msg["line"]));
+
+	m_curStackInfos->Clear();
+	NPLInterface::NPLObjectProxy stack_info = msg["stack_info"];
+	if (stack_info->GetType() == NPLInterface::NPLObjectBase::NPLObjectType_Table)
+	{
+		int stack_level = 0;
+		for (auto iter = stack_info.index_begin(); iter != stack_info.index_end(); iter++, stack_level++)
 		{
-			// Debug::WriteLine(String::Format(L"Exp: {0}:{1}", sExpression, sOutputValue));
-			return true;
+			NPLInterface::NPLObjectProxy& stackInfo = iter->second;
+			// source, short_src, currentline, what, namewhat
+			std::string source = (string)stackInfo["source"];
+			String^ filename = gcnew String(source.c_str());
+			std::string name_ = (string)stackInfo["name"];
+			String^ name = gcnew String(name_.c_str());
+			int line = (int)((double)stackInfo["currentline"]);
+			unsigned int dwStackAddress = GetAddressByFileLine(filename, line);
+			m_curStackInfos->Add(gcnew StackInfo(dwStackAddress, name));
 		}
 	}
-	return false;	
+	return true;
 }
 
 /** translating NPL IPC message to standard win32 debug event. */
@@ -223,15 +812,27 @@ bool DebuggedProcess::TranslateNPLMsgToDebugEvent(LPDEBUG_EVENT lpDebugEvent, In
 {
 	if(lpDebugEvent == 0 || msg_in.m_method != "debug")
 		return false;
-	if(msg_in.m_filename == "BP" && !m_bNPLProcDetachRequested)
+	// m_nMsgType is already set to the opcode by WaitForNPLDebugEvent()
+	switch(msg_in.m_nMsgType)
+	{
+	case NPL_DEBUG_OP_BP:
 	{
-		// a break point is seen
+		if(m_bNPLProcDetachRequested)
+		{
+			// Not to be processed. 
+			lpDebugEvent->dwDebugEventCode = 0;
+			break;
+		}
+		// a break point is seen in one of the states, which is shown as a thread
+		NPLDebugLane^ lane = NPL_GetLane(msg_in.m_from);
+		lane->OnBreak();
+		m_curStackInfos = lane->m_stackInfos;
 		lpDebugEvent->dwDebugEventCode = EXCEPTION_DEBUG_EVENT;
-		lpDebugEvent->dwThreadId = 0;
-		if(m_bExpectingStepBreakpoint)
+		lpDebugEvent->dwThreadId = lane->m_dwThreadId;
+		if(lane->m_bExpectingStep)
 		{
 			// stepping completed. 
-			m_bExpectingStepBreakpoint = false;
+			lane->m_bExpectingStep = false;
 			lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode = SingleStepExceptionCode;
 		}
 		else
@@ -239,35 +840,28 @@ bool DebuggedProcess::TranslateNPLMsgToDebugEvent(LPDEBUG_EVENT lpDebugEvent, In
 			lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode = BreakpointExceptionCode;
 		}
 
-		NPLInterface::NPLObjectProxy msg = NPLInterface::NPLHelper::MsgStringToNPLTable(msg_in.m_code.c_str());
-		std::string filename_ = msg["filename"];
-		String^ filename = gcnew String(filename_.c_str());
-		int line = (int)((double)(msg["line"]));
-		unsigned int dwAddress = GetAddressByFileLine(filename, line);
-		// m_callback->OnOutputString(String::Format(gcnew String("file {0} address {1}\n"), filename, dwAddress));
-		
-		m_curStackInfos->Clear();
-		NPLInterface::NPLObjectProxy stack_info = msg["stack_info"];
-		if (stack_info->GetType() == NPLInterface::NPLObjectBase::NPLObjectType_Table)
+		String^ filename = "";
+		int line = 0;
+		if(msg_in.m_nParam2 == NPL_BP_FORMAT_BINARY)
 		{
-			int stack_level = 0;
-			for (auto iter = stack_info.index_begin(); iter != stack_info.index_end(); iter++, stack_level++)
+			if(!lane->DecodeBreakpoint(msg_in.m_code, m_sourceTable, NPL_GetFileStore(lane), filename, line))
 			{
-				NPLInterface::NPLObjectProxy& stackInfo = iter->second;
-				// source, short_src, currentline, what, namewhat
-				std::string source = (string)stackInfo["source"];
-				String^ filename = gcnew String(source.c_str());
-				std::string name_ = (string)stackInfo["name"];
-				String^ name = gcnew String(name_.c_str());
-				int line = (int)((double)stackInfo["currentline"]);
-				unsigned int dwStackAddress = GetAddressByFileLine(filename, line);
-				m_curStackInfos->Add(gcnew StackInfo(dwStackAddress, name));
+				m_callback->OnOutputString(gcnew String("NPL debugger: malformed breakpoint message\n"));
 			}
 		}
+		else
+		{
+			NPL_ParseBreakpointText(msg_in.m_code, filename, line);
+			lane->m_nStackDepth = m_curStackInfos->Count;
+		}
+		unsigned int dwAddress = GetAddressByFileLine(filename, line);
+		// m_callback->OnOutputString(String::Format(gcnew String("file {0} address {1}\n"), filename, dwAddress));
 
 		lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress = (PVOID)(dwAddress);
+		break;
 	}
-	else if(msg_in.m_filename == "DebuggerOutput" || msg_in.m_filename == "ExpValue")
+	case NPL_DEBUG_OP_DEBUGGER_OUTPUT:
+	case NPL_DEBUG_OP_EXP_VALUE:
 	{
 		String^ outputStr = gcnew String(msg_in.m_code.c_str());
 		m_callback->OnOutputString(outputStr);
@@ -275,9 +869,28 @@ bool DebuggedProcess::TranslateNPLMsgToDebugEvent(LPDEBUG_EVENT lpDebugEvent, In
 		lpDebugEvent->dwDebugEventCode = 0; // OUTPUT_DEBUG_STRING_EVENT
 		return false;
 	}
-	else if(msg_in.m_filename == "Attached")
+	case NPL_DEBUG_OP_ATTACHED:
 	{
+		NPLDebugLane^ lane = NPL_GetLane(msg_in.m_from);
+		// the debuggee starts a new file id table for binary "BP" messages on each attach, unless it keeps them in a persistent table. 
+		{
+			msclr::lock lock(lane->m_fileNames);
+			lane->m_fileNames->Clear();
+		}
 		NPLInterface::NPLObjectProxy msg = NPLInterface::NPLHelper::MsgStringToNPLTable(msg_in.m_code.c_str());
+		std::string filestore_ = msg["filestore"];
+		bool bFileStoreOpened;
+		{
+			msclr::lock lock(m_lanes);
+			bFileStoreOpened = OpenFileStore(ConvertCliStringToStdString(lane->m_sQueueName), filestore_);
+		}
+		if(!bFileStoreOpened)
+			m_callback->OnOutputString(gcnew String("NPL debugger: can not open the file id table of the debuggee\n"));
+		// DispatchNPLDebugEvent() creates the thread of the lane
+		lpDebugEvent->dwThreadId = lane->m_dwThreadId;
+		if(lane != m_mainLane)
+			break;
+
 		std::string workingdir_ = msg["workingdir"];
 		String^ workingdir = gcnew String(workingdir_.c_str());
 		// set working directory of process. 
@@ -286,17 +899,70 @@ bool DebuggedProcess::TranslateNPLMsgToDebugEvent(LPDEBUG_EVENT lpDebugEvent, In
 		std::string desc_ = msg["desc"];
 		String^ desc = gcnew String(desc_.c_str());
 		m_callback->OnOutputString(desc);
+
+		// other NPL states that started their debug engine before we attach, as "name|queue\n" lists
+		std::string states_ = msg["states"];
+		size_t nFrom = 0;
+		while(nFrom < states_.size())
+		{
+			size_t nEnd = states_.find('\n', nFrom);
+			if(nEnd == std::string::npos)
+				nEnd = states_.size();
+			size_t nSep = states_.find('|', nFrom);
+			if(nSep != std::string::npos && nSep < nEnd)
+			{
+				NPL_AddLane(gcnew String(states_.substr(nFrom, nSep - nFrom).c_str()), gcnew String(states_.substr(nSep + 1, nEnd - nSep - 1).c_str()));
+			}
+			nFrom = nEnd + 1;
+		}
+		break;
 	}
-	else if(msg_in.m_filename == "Detach")
+	case NPL_DEBUG_OP_STATE_STARTED:
 	{
-		lpDebugEvent->dwDebugEventCode = EXIT_PROCESS_DEBUG_EVENT;
-		lpDebugEvent->u.ExitProcess.dwExitCode = 0;
-		lpDebugEvent->dwThreadId = 0;
+		NPLInterface::NPLObjectProxy msg = NPLInterface::NPLHelper::MsgStringToNPLTable(msg_in.m_code.c_str());
+		std::string name_ = msg["name"];
+		std::string queue_ = msg["queue"];
+		NPL_AddLane(gcnew String(name_.c_str()), gcnew String(queue_.c_str()));
+		// Not to be processed. 
+		lpDebugEvent->dwDebugEventCode = 0;
+		return false;
 	}
-	else
+	case NPL_DEBUG_OP_DETACH:
 	{
+		NPLDebugLane^ lane = NPL_GetLane(msg_in.m_from);
+		if(lane == m_mainLane)
+		{
+			lpDebugEvent->dwDebugEventCode = EXIT_PROCESS_DEBUG_EVENT;
+			lpDebugEvent->u.ExitProcess.dwExitCode = 0;
+			lpDebugEvent->dwThreadId = 0;
+			break;
+		}
+		// other states exit as threads
+		{
+			msclr::lock lock(m_lanes);
+			m_lanes->RemoveLane(lane);
+			OpenFileStore(ConvertCliStringToStdString(lane->m_sQueueName), "");
+		}
+		bool bHasThread = false;
+		{
+			msclr::lock lock(m_threadIdMap);
+			bHasThread = m_threadIdMap->ContainsKey(lane->m_dwThreadId);
+		}
+		if(!bHasThread)
+		{
+			// the state never replied "Attached"
+			lpDebugEvent->dwDebugEventCode = 0;
+			return false;
+		}
+		lpDebugEvent->dwDebugEventCode = EXIT_THREAD_DEBUG_EVENT;
+		lpDebugEvent->u.ExitThread.dwExitCode = 0;
+		lpDebugEvent->dwThreadId = lane->m_dwThreadId;
+		break;
+	}
+	default:
 		// Not to be processed. 
 		lpDebugEvent->dwDebugEventCode = 0;
+		break;
 	}
 	return true;
 }
@@ -305,36 +971,75 @@ bool DebuggedProcess::WaitForNPLDebugEvent( LPDEBUG_EVENT lpDebugEvent, DWORD dw
 {
 	if(lpDebugEvent == 0)
 		return false;
-	CInterprocessQueue* pInputQueue = GetInputQueue();
-	if(pInputQueue)
-	{
-		if(!g_lastDebugMsg)
-			g_lastDebugMsg.reset(new InterProcessMessage());
-		g_lastDebugMsg->reset();
-		unsigned int nPriority = 0;
-		if(dwMilliseconds == INFINITE)
+	CNPLDebugMailbox* pMailbox = GetInputMailbox();
+	NPL_ReportTransportStatus();
+	if(pMailbox)
+	{
+		// consecutive output messages are merged into a single callback. 
+		std::string sOutput;
+		int nOutputCredits = 0;
+		InterProcessMessagePtr msg_in;
+		while(sOutput.size() < NPL_OUTPUT_COALESCE_SIZE && pMailbox->Pop(msg_in, sOutput.empty() ? dwMilliseconds : 0))
 		{
-			if(pInputQueue->receive(*g_lastDebugMsg, nPriority) == 0)
+			// resolve the opcode once, so that all later dispatching is a switch on m_nMsgType. 
+			msg_in->m_nMsgType = NPLDebugGetOpcode(msg_in->m_nMsgType, msg_in->m_filename);
+			int nOpcode = msg_in->m_nMsgType;
+			if(nOpcode == NPL_DEBUG_OP_OUTPUT || nOpcode == NPL_DEBUG_OP_DEBUGGER_OUTPUT || nOpcode == NPL_DEBUG_OP_EXP_VALUE)
 			{
-				return TranslateNPLMsgToDebugEvent(lpDebugEvent, *g_lastDebugMsg);
-			}
-		}
-		else
-		{
-			if(pInputQueue->try_receive(*g_lastDebugMsg, nPriority) == 0)
-			{
-				return TranslateNPLMsgToDebugEvent(lpDebugEvent, *g_lastDebugMsg);
+				sOutput += msg_in->m_code;
+				// param2 is 1 if the debuggee is waiting for our acknowledgement
+				if(nOpcode != NPL_DEBUG_OP_EXP_VALUE && msg_in->m_nParam2 != 0)
+					++nOutputCredits;
+				continue;
 			}
+			NPL_FlushOutput(sOutput, nOutputCredits);
+			g_lastDebugMsg = msg_in;
+			return TranslateNPLMsgToDebugEvent(lpDebugEvent, *g_lastDebugMsg);
 		}
+		NPL_FlushOutput(sOutput, nOutputCredits);
 	}
 	return false;
 }
 
+void DebuggedProcess::NPL_ReportTransportStatus()
+{
+	if(g_sTransportError != NULL)
+	{
+		m_callback->OnOutputString(gcnew String(g_sTransportError));
+		g_sTransportError = NULL;
+	}
+	int nMessages, nMilliseconds;
+	if(g_replay_transport != NULL && g_replay_transport->PopSummary(nMessages, nMilliseconds) && IsDebugStatsEnabled())
+	{
+		m_callback->OnOutputString(String::Format("NPL debug replay: {0} messages in {1} ms\n", nMessages, nMilliseconds));
+	}
+}
+
+void DebuggedProcess::NPL_FlushOutput(const std::string& sOutput, int nOutputCredits)
+{
+	if(!sOutput.empty())
+	{
+		m_callback->OnOutputString(gcnew String(sOutput.c_str()));
+	}
+	if(nOutputCredits > 0)
+	{
+		SendDebugMessage(NPL_DEBUG_OP_OUTPUT_ACK, nOutputCredits);
+	}
+}
+
 BOOL DebuggedProcess::ContinueNPLDebugEvent( DWORD dwProcessId, DWORD dwThreadId, DWORD dwContinueStatus )
 {
 	if(m_lastStoppingEvent == AyncBreakComplete || m_lastStoppingEvent == Breakpoint || m_lastStoppingEvent == StepComplete)
 	{
-		return SendDebugMessage("continue", dwProcessId, dwThreadId, dwContinueStatus) == 0;
+		// breakpoints changed in break mode should take effect before we continue. 
+		FlushPendingBreakpoints();
+		NPL_ClearEvaluationCache();
+		// only the state that stopped is resumed
+		NPLDebugLane^ lane = NPL_GetLaneByThread(dwThreadId);
+		if(lane == nullptr)
+			lane = m_mainLane;
+		lane->m_bStopped = false;
+		return NPL_SendToLane(lane, NPL_DEBUG_OP_CONTINUE, dwThreadId, dwContinueStatus, NULL) == 0;
 	}
 	return TRUE;
 }
@@ -344,18 +1049,27 @@ bool DebuggedProcess::DispatchNPLDebugEvent(bool& fContinue)
 	if(!g_lastDebugMsg)
 		return false;
 	InterProcessMessage& msg_in = *g_lastDebugMsg;
-	if(msg_in.m_filename == "BP")
+	switch(msg_in.m_nMsgType)
 	{
-
-	}
-	else if(msg_in.m_filename == "Output")
-	{
-		String^ outputStr = gcnew String(g_lastDebugMsg->m_code.c_str());
-		m_callback->OnOutputString(outputStr);
-		return true;
-	}
-	else if (msg_in.m_filename == "Attached")
+	case NPL_DEBUG_OP_ATTACHED:
 	{
+		NPLDebugLane^ lane = NPL_GetLaneByThread(m_lastDebugEvent.dwThreadId);
+		if(lane != nullptr && lane != m_mainLane)
+		{
+			// other NPL states are shown as threads of the process
+			DebuggedThread^ thread = CreateThread(lane->m_dwThreadId, NULL, 0);
+			thread->Name = lane->m_sName;
+			m_callback->OnThreadStart(thread);
+
+			msclr::lock lock(m_breakpointMap);
+			NPL_SendBreakpoints(true, lane);
+			return true;
+		}
+		{
+			// send all breakpoints that are bound so far in a single message
+			msclr::lock lock(m_breakpointMap);
+			NPL_SendBreakpoints(true, m_mainLane);
+		}
 		// send load complete message 
 		msclr::lock lock(m_threadIdMap);
 		{
@@ -366,6 +1080,9 @@ bool DebuggedProcess::DispatchNPLDebugEvent(bool& fContinue)
 		}
 		return true;
 	}
+	default:
+		break;
+	}
 	return false;
 }
 
@@ -374,19 +1091,26 @@ int DebuggedProcess::Step(DebuggedThread^ thread, int nStepKind, int nStepUnit)
 	if(IsDebuggingNPL())
 	{
 		int nLineCount = 1;
-		m_bExpectingStepBreakpoint = true;
+		// step the state of the thread
+		NPLDebugLane^ lane = NPL_GetLaneByThread(thread->Id);
+		if(lane == nullptr)
+			lane = m_mainLane;
+		lane->m_bExpectingStep = true;
+		lane->m_bStopped = false;
+		FlushPendingBreakpoints();
+		NPL_ClearEvaluationCache();
 
 		if(nStepKind == STEP_INTO)
 		{
-			SendDebugMessage("step", 0, nLineCount);
+			NPL_SendToLane(lane, NPL_DEBUG_OP_STEP, nLineCount, 0, NULL);
 		}
 		else if(nStepKind == STEP_OUT)
 		{
-			SendDebugMessage("out", 0, nLineCount);
+			NPL_SendToLane(lane, NPL_DEBUG_OP_OUT, nLineCount, 0, NULL);
 		}
 		else //  if(nStepKind == STEP_OVER)
 		{
-			SendDebugMessage("over", 0, nLineCount);
+			NPL_SendToLane(lane, NPL_DEBUG_OP_OVER, nLineCount, 0, NULL);
 		}
 
 		// Clear the last debug event and last stopping event.
@@ -398,12 +1122,38 @@ int DebuggedProcess::Step(DebuggedThread^ thread, int nStepKind, int nStepUnit)
 	return 0;
 }
 
+/** wraps the native mailbox event, so that it can be passed to WaitHandle::WaitAny. */
+ref class NPLMailboxWaitHandle sealed : public System::Threading::WaitHandle
+{
+public:
+	NPLMailboxWaitHandle(HANDLE hEvent)
+	{
+		// the event is owned by the mailbox. 
+		SafeWaitHandle = gcnew ::Microsoft::Win32::SafeHandles::SafeWaitHandle(IntPtr(hEvent), false);
+	}
+};
+
+System::Threading::WaitHandle^ DebuggedProcess::DebugEventWaitHandle::get()
+{
+	if(m_debugEventWaitHandle == nullptr)
+	{
+		m_debugEventWaitHandle = gcnew NPLMailboxWaitHandle(GetInputMailbox()->GetWaitHandle());
+	}
+	return m_debugEventWaitHandle;
+}
+
 bool DebuggedProcess::NPLDetachProcess()
 {
 	// forge a dummy message and dispatch it to continue with debugging, as if a dummy module and a dummy thread is loaded. 
-	SendDebugMessage("Detach");
+	// all lanes are detached, the process exits when the main lane replies. 
+	NPL_SendToLane(nullptr, NPL_DEBUG_OP_DETACH, 0, 0, NULL);
 
-	m_bNPLProcDetachRequested = true;
+	{
+		// the debuggee removes all breakpoints when detached
+		msclr::lock lock(m_breakpointMap);
+		m_pendingBreakpointDelta->Clear();
+		m_bNPLProcDetachRequested = true;
+	}
 
 	if(m_lastStoppingEvent != Invalid)
 	{
@@ -450,10 +1200,9 @@ DebuggedProcess^ Worker::AttachToProcess(ISampleEngineCallback^ callback, int pr
 	if(IsDebuggingNPL())
 	{
 		// this ensures that IPC queues are created before process is spawned. 
-		GetOutputQueue();
-		GetInputQueue();
+		GetInputMailbox();
 
-		SendDebugMessage("Attach");
+		SendAttachMessage();
 	}
 	else
 	{
@@ -504,8 +1253,7 @@ DebuggedProcess^ Worker::LaunchProcess(ISampleEngineCallback^ callback, ProcessL
 	if(IsDebuggingNPL())
 	{
 		// this ensures that IPC queues are created before process is spawned. 
-		GetOutputQueue();
-		GetInputQueue();
+		GetInputMailbox();
 
 		dwCreationFlags = 0;
 #ifdef DEBUG_LOCAL_EXE
@@ -540,7 +1288,6 @@ DebuggedProcess::DebuggedProcess(DEBUG_METHOD method, ISampleEngineCallback^ cal
 	m_curBreakpointAddress(0),
 	m_fIsPumpingDebugEvents(false),
 	m_fSeenEntrypointBreakpoint(false),
-	m_bExpectingStepBreakpoint(false),
 	m_bNPLProcDetachRequested(false),
 	m_fExpectingAsyncBreak(false)
 {
@@ -568,6 +1315,11 @@ DebuggedProcess::DebuggedProcess(DEBUG_METHOD method, ISampleEngineCallback^ cal
 
 		m_breakpointMap = gcnew Collections::Generic::Dictionary<DWORD_PTR, BreakpointData^>();
 
+		// the main lane is shown as the thread created by the forged CREATE_PROCESS_DEBUG_EVENT
+		m_lanes = gcnew NPLLaneTable(NPL_MAIN_LANE_QUEUE);
+		m_mainLane = m_lanes->MainLane;
+		m_curStackInfos = m_mainLane->m_stackInfos;
+
 		m_resolver->InitializeCache(name);
 		
 		if(IsDebuggingNPL())
@@ -686,8 +1438,24 @@ DebuggedProcess::~DebuggedProcess()
 	m_resolver->Close();		
 	this->!DebuggedProcess();	
 
-	SAFE_DELETE(g_output_queue);
-	SAFE_DELETE(g_input_queue);
+	// stop the receiver threads before the transports they read from are deleted. 
+	m_debugEventWaitHandle = nullptr;
+	SAFE_DELETE(g_input_mailbox);
+	g_active_transport = NULL;
+	SAFE_DELETE(g_queue_transport);
+	SAFE_DELETE(g_socket_transport);
+	SAFE_DELETE(g_replay_transport);
+	SAFE_DELETE(g_recorder);
+	for(std::map<std::string, CInterprocessQueue*>::iterator itCur = g_lane_queues.begin(); itCur != g_lane_queues.end(); ++itCur)
+	{
+		delete itCur->second;
+	}
+	g_lane_queues.clear();
+	for(std::map<std::string, CNPLFileIdStore*>::iterator itCur = g_file_stores.begin(); itCur != g_file_stores.end(); ++itCur)
+	{
+		delete itCur->second;
+	}
+	g_file_stores.clear();
 }
 
 DebuggedProcess::!DebuggedProcess()
@@ -712,37 +1480,38 @@ void DebuggedProcess::SetBreakpoint(DWORD_PTR address, Object^ client)
 		return;
 	}
 
+	if (IsDebuggingNPL())
+	{
+		// NPL breakpoints are batched and sent by FlushPendingBreakpoints(), so there is no need to suspend the debuggee. 
+		NPL_SetBreakPoint(address);
+		bpData = gcnew BreakpointData(address, 0, client);
+		/*{
+			String^ filename;
+			int line = 0;
+			GetFileLineByAddress(address, filename, line);
+			String^ outputStr = String::Format(gcnew String("set break point {0} line {1} address {2}\n"), filename, line, address);
+			m_callback->OnOutputString(outputStr);
+		}*/
+		m_breakpointMap->Add(address, bpData);
+		m_callback->OnBreakpointBound(client, address);
+		return;
+	}
+
 	Suspend();
 
 	try
 	{
-		if (IsDebuggingNPL())
-		{
-			NPL_SetBreakPoint(address);
-			bpData = gcnew BreakpointData(address, 0, client);
-			/*{
-				String^ filename;
-				int line = 0;
-				GetFileLineByAddress(address, filename, line);
-				String^ outputStr = String::Format(gcnew String("set break point {0} line {1} address {2}\n"), filename, line, address);
-				m_callback->OnOutputString(outputStr);
-			}*/
-			m_breakpointMap->Add(address, bpData);
-		}
-		else
-		{
-			cli::array<byte>^ memory = ReadMemory(address, 1);
-			BYTE originialData = memory[0];
+		cli::array<byte>^ memory = ReadMemory(address, 1);
+		BYTE originialData = memory[0];
 
-			bpData = gcnew BreakpointData(address, originialData, client);	
-			m_breakpointMap->Add(address, bpData);
+		bpData = gcnew BreakpointData(address, originialData, client);	
+		m_breakpointMap->Add(address, bpData);
 
-			if (originialData != BreakpointInstruction)
-			{
-				memory[0] = BreakpointInstruction;
-				WriteMemory(address, memory);
-				Win32BoolCall(FlushInstructionCache(m_hProcess, NULL, NULL));
-			}
+		if (originialData != BreakpointInstruction)
+		{
+			memory[0] = BreakpointInstruction;
+			WriteMemory(address, memory);
+			Win32BoolCall(FlushInstructionCache(m_hProcess, NULL, NULL));
 		}
 	}
 	finally
@@ -761,32 +1530,32 @@ void DebuggedProcess::RemoveBreakpoint(DWORD_PTR address, Object^ client)
 	BreakpointData^ bpData;
 	if (m_breakpointMap->TryGetValue(address, bpData))
 	{	
-		Suspend();
-
-		try
+		if (IsDebuggingNPL())
 		{
-			if (IsDebuggingNPL())
+			// batched like SetBreakpoint(), and only removed from the debuggee when the last client is gone. 
+			bpData->Clients->Remove(client);
+			if (bpData->Clients->Count == 0)
 			{
 				NPL_RemoveBreakPoint(address);
-				bpData->Clients->Remove(client);
-				if (bpData->Clients->Count == 0)
-				{
-					m_breakpointMap->Remove(address);
-				}
+				m_breakpointMap->Remove(address);
 			}
-			else
-			{
-				cli::array<byte>^ origData = gcnew cli::array<byte>(1);
-				origData[0] = bpData->OriginalData;
-				WriteMemory(address, origData);
-				Win32BoolCall(FlushInstructionCache(m_hProcess, NULL, NULL));
+			return;
+		}
 
-				bpData->Clients->Remove(client);
+		Suspend();
 
-				if (bpData->Clients->Count == 0)
-				{
-					m_breakpointMap->Remove(address);
-				}
+		try
+		{
+			cli::array<byte>^ origData = gcnew cli::array<byte>(1);
+			origData[0] = bpData->OriginalData;
+			WriteMemory(address, origData);
+			Win32BoolCall(FlushInstructionCache(m_hProcess, NULL, NULL));
+
+			bpData->Clients->Remove(client);
+
+			if (bpData->Clients->Count == 0)
+			{
+				m_breakpointMap->Remove(address);
 			}
 		}
 		finally
@@ -798,6 +1567,45 @@ void DebuggedProcess::RemoveBreakpoint(DWORD_PTR address, Object^ client)
 	return;
 }
 
+void DebuggedProcess::SetBreakpointCondition(DWORD_PTR address, String^ condition, int nPassCountStyle, unsigned int nPassCount)
+{
+	// THREADING: Can be called on any thread
+	msclr::lock lock(m_breakpointMap);
+
+	BreakpointData^ bpData;
+	if (!m_breakpointMap->TryGetValue(address, bpData))
+		return;
+	if (String::Equals(bpData->Condition, condition) && bpData->PassCountStyle == nPassCountStyle && bpData->PassCount == nPassCount)
+		return;
+	bpData->Condition = condition;
+	bpData->PassCountStyle = nPassCountStyle;
+	bpData->PassCount = nPassCount;
+	if (IsDebuggingNPL())
+	{
+		// the breakpoint is sent again with its new condition
+		NPL_SetBreakPoint((unsigned int)address);
+	}
+}
+
+void DebuggedProcess::SetBreakpointLogMessage(DWORD_PTR address, String^ message)
+{
+	// THREADING: Can be called on any thread
+	msclr::lock lock(m_breakpointMap);
+
+	BreakpointData^ bpData;
+	if (!m_breakpointMap->TryGetValue(address, bpData))
+		return;
+	if (String::IsNullOrEmpty(message))
+		message = nullptr;
+	if (String::Equals(bpData->LogMessage, message))
+		return;
+	bpData->LogMessage = message;
+	if (IsDebuggingNPL())
+	{
+		NPL_SetBreakPoint((unsigned int)address);
+	}
+}
+
 BreakpointData^ DebuggedProcess::FindBreakpointAtAddress(DWORD_PTR address)
 {
 	// THREADING: Can be called on any thread
@@ -824,7 +1632,13 @@ void DebuggedProcess::WaitForAndDispatchDebugEvent(ResumeEventPumpFlags flags)
 		return;
 	}
 
-	bool fGotEvent = WaitForDebugEvent(50);
+	if(IsDebuggingNPL())
+	{
+		FlushPendingBreakpoints();
+	}
+
+	// NPL events are waited for by the poll thread on DebugEventWaitHandle, so we only need to peek here. 
+	bool fGotEvent = WaitForDebugEvent(IsDebuggingNPL() ? 0 : 50);
 	if (fGotEvent)
 	{
 		if (!DispatchDebugEvent())
@@ -867,7 +1681,7 @@ void DebuggedProcess::Break()
 	if(IsDebuggingNPL())
 	{
 		// just break it anyway. 
-		SendDebugMessage("Break");
+		SendDebugMessage(NPL_DEBUG_OP_BREAK);
 	}
 	else
 	{
@@ -1017,7 +1831,7 @@ void DebuggedProcess::ResumeFromLaunch()
 		DispatchDebugEvent();
 
 		// send the attach message to enable debug hook in NPL. 
-		SendDebugMessage("Attach");
+		SendAttachMessage();
 	}
 	else
 	{
@@ -1728,14 +2542,29 @@ void DebuggedProcess::DoStackWalk(DebuggedThread^ thread)
 		CONTEXT context;
 		ZeroMemory(&context, sizeof(context));
 
+		// each NPL state has its own stack
+		Collections::Generic::List<StackInfo^>^ stackInfos = m_curStackInfos;
+		NPLDebugLane^ lane = NPL_GetLaneByThread(thread->Id);
+		if(lane != nullptr)
+		{
+			// other states keep running while one of them is stopped
+			if(lane != m_mainLane && !lane->m_bStopped)
+				return;
+			// frames after the top ones sent in "BP" are fetched once per stop
+			if(lane->m_bStopped && lane->m_stackInfos->Count < lane->m_nStackDepth)
+				NPL_FetchStackFrames(lane);
+			stackInfos = lane->m_stackInfos;
+		}
+
 		// newer NPL debugger client support stack info, so if it is available we will use it.
-		if (m_curStackInfos->Count > 0)
+		if (stackInfos->Count > 0)
 		{
-			for (int i = 0; i < m_curStackInfos->Count; ++i)
+			for (int i = 0; i < stackInfos->Count; ++i)
 			{
-				context.Eip = m_curStackInfos[i]->m_nAddress;
+				context.Eip = stackInfos[i]->m_nAddress;
 				X86ThreadContext^ threadContext = gcnew X86ThreadContext(context);
-				threadContext->sName = m_curStackInfos[i]->m_sName;
+				threadContext->sName = stackInfos[i]->m_sName;
+				threadContext->nFrameLevel = i + 1;
 				thread->AddStackFrame(threadContext);
 			}
 		}
@@ -1815,7 +2644,7 @@ bool DebuggedProcess::GetSourceInformation(unsigned int ip, String^% documentNam
 		dwLineNumber = lineNumber;
 		// use relative path as function name
 		functionName = GetRelativeFilePath(documentName);
-		// TODO: shall we support display locals and parameters? 
+		// locals and parameters are not known by address, they are listed by the debuggee when the frame is shown, see NPL_GetFrameVariables(). 
 		numParameters = 0;
 		numLocals = 0;
 		return true;
@@ -1882,7 +2711,7 @@ void DebuggedProcess::GetFunctionVariablesByIP(unsigned int ip, unsigned int bp,
 {
 	if(IsDebuggingNPL())
 	{
-		// TODO: 
+		// NPL variables are listed by stack frame instead of by address, see NPL_GetFrameVariables(). 
 	}
 	else
 	{
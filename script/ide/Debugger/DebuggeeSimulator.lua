@@ -0,0 +1,328 @@
+--[[
+Title: synthetic debuggee for load testing the debug engine
+Date: 2026/10/17
+Desc: a headless stand-in for IPCDebugger.lua that speaks the same protocol, but never runs a debug hook.
+It answers "Attach", "setb", "setbs", "delb", "dump", "exec", "framevars", "children", "continue", "step", "over", "out" and "Detach",
+and emits "BP" events and output at configurable rates, stack depths and payload sizes, so that the debug engine worker can be profiled
+under thousands of events per second without the game client.
+- BP events are sent at a random breakpoint set by the debug engine, or at a synthetic location if there is none.
+- if wait_continue is true, it blocks after each "BP" until "continue" or a step command is received, like the real debugger loop.
+	Otherwise "BP" events are streamed at bp_rate, regardless of whether the debug engine keeps up.
+- it uses the transport selected by the command line the same way as IPCDebugger, i.e. the "debugqueue" IPC queue, or debugtransport="tcp://*:port".
+- statistics are logged every second.
+Use Lib:
+-------------------------------------------------------
+NPL.load("(gl)script/ide/Debugger/DebuggeeSimulator.lua");
+IPCDebugger.DebuggeeSimulator.Start({bp_rate = 2000, stack_depth = 20, name_size = 64, output_rate = 100, output_size = 1024});
+-------------------------------------------------------
+]]
+NPL.load("(gl)script/ide/commonlib.lua");
+NPL.load("(gl)script/ide/IPC.lua");
+NPL.load("(gl)script/ide/Debugger/IPCDebugger.lua");
+
+local DebuggeeSimulator = commonlib.gettable("IPCDebugger.DebuggeeSimulator");
+local opcodes = IPCDebugger.opcodes;
+
+-- default settings, see DebuggeeSimulator.Start()
+DebuggeeSimulator.config = {
+	-- "BP" events per second, 0 to send them as fast as possible.
+	bp_rate = 100,
+	-- whether to wait for "continue" after each "BP"
+	wait_continue = false,
+	-- number of frames in each "BP" event
+	stack_depth = 10,
+	-- length of function names in the stack, which controls the payload size of "BP" events.
+	name_size = 16,
+	-- output messages per second, and the size of each message in bytes.
+	output_rate = 0,
+	output_size = 256,
+	-- number of entries of the table listed by "framevars" and "children"
+	table_size = 1000,
+	-- stop after this many seconds, 0 to run until "Detach".
+	duration = 0,
+	-- timer interval in milliseconds
+	interval = 10,
+};
+
+local config;
+local input_queue;
+local output_queue;
+-- whether the debug engine is attached
+local attached = false;
+-- the "BP" message format negotiated in "Attach"
+local bp_format = 0;
+-- number of output batches we can send, nil if the debug engine does not acknowledge output.
+local output_credits;
+-- breakpoints set by the debug engine, array of {filename, line}, and mapping from "filename|line" to index in the array.
+local bp_list = {};
+local bp_index = {};
+-- time when the debug engine attached, and number of events sent since then.
+local start_time = 0;
+local stats = {};
+local stats_time = 0;
+
+local function reset_stats()
+	stats = {bp = 0, output = 0, output_bytes = 0, commands = 0, evaluations = 0, dropped = 0};
+end
+
+local function send_message(msg, priority)
+	if(output_queue) then
+		return output_queue:try_send({
+			method = "debug",
+			from = IPCDebugger.input_queue_name,
+			type = msg.type,
+			param1 = msg.param1,
+			param2 = msg.param2,
+			filename = msg.filename,
+			code = msg.code,
+			priority = priority or 1,
+		});
+	end
+end
+
+local function add_breakpoint(filename, line)
+	local key = filename.."|"..line;
+	if(not bp_index[key]) then
+		bp_list[#bp_list+1] = {filename, tonumber(line)};
+		bp_index[key] = #bp_list;
+	end
+end
+
+local function remove_breakpoint(filename, line)
+	local key = filename.."|"..line;
+	local index = bp_index[key];
+	if(index) then
+		-- swap with the last one
+		local last = bp_list[#bp_list];
+		bp_list[index] = last;
+		bp_index[last[1].."|"..last[2]] = index;
+		bp_list[#bp_list] = nil;
+		bp_index[key] = nil;
+	end
+end
+
+local function apply_breakpoints(msg)
+	if(type(msg) ~= "table") then
+		return
+	end
+	if(msg.mode == "full") then
+		bp_list, bp_index = {}, {};
+	end
+	for file, line in string.gmatch(msg.del or "", "([^\n|]+)|(%d+)") do
+		remove_breakpoint(file, line);
+	end
+	for file, line in string.gmatch(msg.add or "", "([^\n|]+)|(%d+)") do
+		add_breakpoint(file, line);
+	end
+end
+
+-- a synthetic call stack with the given break location on top
+local function make_stack(filename, line)
+	local stack_info = {};
+	local name_pad = string.rep("_", math.max(config.name_size - 8, 0));
+	for i = 1, config.stack_depth do
+		stack_info[i] = {
+			source = (i == 1) and filename or string.format("script/simulator/frame%d.lua", i % 16),
+			currentline = (i == 1) and line or (i * 10),
+			name = string.format("func%04d", i)..name_pad,
+		};
+	end
+	return stack_info;
+end
+
+local function send_breakpoint()
+	local filename, line;
+	if(#bp_list > 0) then
+		local bp = bp_list[math.random(#bp_list)];
+		filename, line = bp[1], bp[2];
+	else
+		filename, line = "script/simulator/main.lua", (stats.bp % 1000) + 1;
+	end
+	local stack_info = make_stack(filename, line);
+	if(bp_format == 1) then
+		send_message({filename="BP", type=opcodes.BP, param2 = 1, code = IPCDebugger.EncodeBreakpoint(filename, line, stack_info)});
+	else
+		send_message({filename="BP", type=opcodes.BP, code = {filename=filename, line=line, stack_info=stack_info}});
+	end
+	stats.bp = stats.bp + 1;
+end
+
+local function send_output()
+	if(output_credits and output_credits <= 0) then
+		stats.dropped = stats.dropped + 1;
+		return
+	end
+	if(output_credits) then
+		output_credits = output_credits - 1;
+	end
+	local text = string.rep("o", math.max(config.output_size - 1, 0)).."\n";
+	send_message({filename="DebuggerOutput", type=opcodes.DebuggerOutput, param2 = output_credits and 1 or 0, code = text}, 0);
+	stats.output = stats.output + 1;
+	stats.output_bytes = stats.output_bytes + #text;
+end
+
+-- handle a message from the debug engine.
+-- @return "resume" if the debug engine resumes execution after a "BP"
+local function handle_message(msg)
+	if(msg.method ~= "debug") then
+		return
+	end
+	stats.commands = stats.commands + 1;
+	local op = msg.type;
+	if(not op or op == 0) then
+		op = opcodes[msg.filename];
+	end
+	if(op == opcodes.Attach) then
+		output_queue = IPCDebugger.socket_transport or IPC.CreateGetQueue(msg.from, 2);
+		local options = msg.code;
+		bp_format = IPCDebugger.SelectBreakpointFormat(options);
+		output_credits = (type(options) == "table" and options.outputack) and IPCDebugger.output_window or nil;
+		attached = true;
+		start_time = ParaGlobal.timeGetTime();
+		stats_time = start_time;
+		reset_stats();
+		send_message({filename="Attached", type=opcodes.Attached, code = {
+			desc = "NPL debuggee simulator attached\n",
+			workingdir = ParaIO.GetCurDirectory(0),
+			bpformat = bp_format,
+		}});
+	elseif(op == opcodes.Detach) then
+		attached = false;
+		send_message({filename="Detach", type=opcodes.Detach});
+		return "resume";
+	elseif(op == opcodes.setbs) then
+		apply_breakpoints(msg.code);
+	elseif(op == opcodes.setb) then
+		if(type(msg.code) == "table" and msg.code.filename and msg.code.line) then
+			add_breakpoint(msg.code.filename, msg.code.line);
+		end
+	elseif(op == opcodes.delb) then
+		if(type(msg.code) == "table" and msg.code.filename and msg.code.line) then
+			remove_breakpoint(msg.code.filename, msg.code.line);
+		end
+	elseif(op == opcodes.OutputAck) then
+		if(output_credits) then
+			output_credits = math.min(output_credits + (msg.param1 or 0), IPCDebugger.output_window);
+		end
+	elseif(op == opcodes.dump or op == opcodes.exec) then
+		stats.evaluations = stats.evaluations + 1;
+		send_message({filename="ExpValue", type=opcodes.ExpValue, param1 = msg.param1, param2 = 1, code = "simulated value\n"});
+	elseif(op == opcodes.framevars) then
+		stats.evaluations = stats.evaluations + 1;
+		send_message({filename="FrameVars", type=opcodes.FrameVars, param1 = msg.param1, param2 = 1, code = {vars = {
+			{kind = "param", name = "self", type = "table", value = "{...}", handle = 1, count = config.table_size},
+			{kind = "local", name = "i", type = "number", value = tostring(stats.bp), handle = 0, count = 0},
+		}}});
+	elseif(op == opcodes.children) then
+		stats.evaluations = stats.evaluations + 1;
+		-- a table of config.table_size numbers, listed a page at a time
+		local params = type(msg.code) == "table" and msg.code or {};
+		local from = tonumber(params.from) or 1;
+		local vars = {};
+		if(params.name) then
+			vars[1] = {kind = "value", name = params.name, type = "table", value = "{...}", handle = 1, count = config.table_size};
+		else
+			for i = from, math.min(from + (tonumber(params.count) or 0) - 1, config.table_size) do
+				vars[#vars+1] = {kind = "field", name = "["..i.."]", type = "number", value = tostring(i), handle = 0, count = 0};
+			end
+		end
+		send_message({filename="Children", type=opcodes.Children, param1 = msg.param1, param2 = 1, code = {vars = vars, from = from, total = config.table_size}});
+	elseif(op == opcodes.continue or op == opcodes.step or op == opcodes.over or op == opcodes.out) then
+		return "resume";
+	end
+end
+
+-- block until the debug engine resumes, like debugger_loop in IPCDebugger.lua
+local function wait_for_resume()
+	local msg = {};
+	while(input_queue:receive(msg) == 0) do
+		if(handle_message(msg) == "resume") then
+			return
+		end
+		msg = {};
+	end
+end
+
+local function log_stats(now)
+	local elapsed = now - stats_time;
+	if(elapsed >= 1000) then
+		commonlib.log("debuggee simulator: %d BP, %d output (%d bytes), %d commands, %d evaluations, %d output dropped in %d ms, %d breakpoints\n",
+			stats.bp, stats.output, stats.output_bytes, stats.commands, stats.evaluations, stats.dropped, elapsed, #bp_list);
+		reset_stats();
+		stats_time = now;
+	end
+end
+
+-- number of events that are due since the last tick
+local bp_due, output_due = 0, 0;
+
+local function on_tick(timer)
+	local msg = {};
+	while(input_queue:try_receive(msg) == 0) do
+		handle_message(msg);
+		msg = {};
+	end
+	if(not attached) then
+		return
+	end
+	local now = ParaGlobal.timeGetTime();
+	local interval = config.interval / 1000;
+
+	if(config.bp_rate > 0) then
+		bp_due = bp_due + config.bp_rate * interval;
+	else
+		-- as fast as the debug engine accepts them within this tick
+		bp_due = 1;
+	end
+	local deadline = now + config.interval;
+	while(bp_due >= 1 and attached) do
+		bp_due = bp_due - 1;
+		send_breakpoint();
+		if(config.wait_continue) then
+			wait_for_resume();
+		end
+		if(config.bp_rate <= 0 and ParaGlobal.timeGetTime() < deadline) then
+			bp_due = 1;
+		end
+	end
+
+	output_due = output_due + config.output_rate * interval;
+	while(output_due >= 1 and attached) do
+		output_due = output_due - 1;
+		send_output();
+	end
+
+	now = ParaGlobal.timeGetTime();
+	log_stats(now);
+	if(config.duration > 0 and (now - start_time) >= config.duration * 1000) then
+		commonlib.log("debuggee simulator: finished after %d seconds\n", config.duration);
+		attached = false;
+		timer:Change();
+	end
+end
+
+-- start the simulator in the calling NPL state.
+-- @param settings: nil or a table that overrides DebuggeeSimulator.config
+function DebuggeeSimulator.Start(settings)
+	config = commonlib.copy(DebuggeeSimulator.config);
+	for key, value in pairs(settings or {}) do
+		config[key] = value;
+	end
+	IPCDebugger.input_queue_name = ParaEngine.GetAppCommandLineByParam("debugqueue", "NPLDebug");
+	local socket_host, socket_port = ParaEngine.GetAppCommandLineByParam("debugtransport", ""):match("^tcp://([^:]*):(%d+)$");
+	if(socket_host) then
+		NPL.load("(gl)script/ide/Debugger/IPCSocketTransport.lua");
+		input_queue = IPCDebugger.SocketTransport:new(socket_host, tonumber(socket_port));
+		IPCDebugger.socket_transport = input_queue;
+	elseif(ParaIPC) then
+		input_queue = ParaIPC.CreateGetQueue(IPCDebugger.input_queue_name, 2);
+	end
+	if(not input_queue) then
+		commonlib.log("debuggee simulator: no transport available\n");
+		return
+	end
+	reset_stats();
+	commonlib.log("debuggee simulator started: queue name %s\n", IPCDebugger.input_queue_name);
+	DebuggeeSimulator.timer = DebuggeeSimulator.timer or commonlib.Timer:new({callbackFunc = on_tick});
+	DebuggeeSimulator.timer:Change(config.interval, config.interval);
+end
@@ -5,14 +5,23 @@ Date: 2010/5/10
 Desc: This is the debug engine that communicates with the remote debug engine worker running in visual studio via IPC. 
 Basic functions
 - In visual studio, we can launch or attach to a ParaEngine process to debug it. Breakpoints, step into/over/out are supported. 
-- Currently, we only support debugging one NPL state (usually the main state). To start the debugging, simply call IPCDebugger.StartDebugEngine(); in the NPL state to be debugged. 
+- To start the debugging, simply call IPCDebugger.StartDebugEngine(); in the NPL state to be debugged. 
 	alternatively, we can start it automatically when loading IPCDebugger.lua, provided the command line parameter "debug" is the current NPL state name, such as "main". The queue name can be specified by "debugqueue", which defaults to "NPLDebug"
+- Multiple NPL states can be debugged in the same session with debug="*" (or "all"). Each state has its own input queue, i.e. "NPLDebug" for the main state 
+	and "NPLDebug_"..statename for others, and is shown as a thread in visual studio. Other states register themselves to the main state, 
+	which tells the debug engine about them in "Attached" or "StateStarted". 
+- To debug a process on another machine, start it with debugtransport="tcp://*:8099" and set NPL_DEBUG_TRANSPORT=tcp://servername:8099 in visual studio. 
+	Only the main state is debugged over the socket, see IPCSocketTransport.lua. 
+- File ids of "BP" messages are appended to "temp/debugger/<queue name>.fileids" of the working directory, which the debug engine maps, 
+	so that file names are never sent in "BP" messages. The file is truncated on each attach. 
 - Note: there is no performance penalties when starting a debug engine, it only starts a timer to receive from IPC queue. The IPCdebugger only starts the debug hook whenever visual studio attaches or launched the process. 
 ### Notice for Luajit users
 I have fixed stack level when steping over functions for luajit.
 The fix is due to following reason:
   * The Lua debug API is missing a couple of features (return hooks for non-Lua functions) and shows slightly different behavior in LuaJIT (no per-coroutine hooks, no tail call counting).
   * see also here: http://luajit.org/status.html  and http://www.freelists.org/post/luajit/Debug-hooks-and-JIT,2
+Hooks are not called from jit compiled code. Instead of turning off luajit for the whole process, the debugger turns it off only for functions 
+that have a breakpoint or are on the stack while stepping, and flushes compiled code whenever breakpoints change, see IPCDebugger.selective_jit. 
 
 Use Lib:
 -------------------------------------------------------
@@ -35,6 +44,12 @@ local debug_debugger = false;
 
 -- polling for incoming debug request message every 100ms. 
 IPCDebugger.polling_interval = 100;
+-- if true, the lua debug hook only hooks "line" events in functions whose line range has a breakpoint, or while stepping. 
+-- Otherwise every line of every function is hooked. It is read when the hook is installed. 
+IPCDebugger.scoped_line_hook = true;
+-- if true, luajit is only turned off for functions that have a breakpoint or are on the stack while stepping, and turned on again once they do not. 
+-- Otherwise it is turned off for the whole process when the debugger attaches. It is read when the lua debug hook is installed. 
+IPCDebugger.selective_jit = true;
 local Handlers = {};
 IPCDebugger.Handlers = Handlers;
 IPCDebugger.IsIPCStarted = nil;
@@ -43,11 +58,20 @@ IPCDebugger.input_queue_name = nil;
 
 local input_queue;
 local output_queue;
-local debug_events_enum = {
-	DEBUG_OUTPUT = 0,
-	BREAKPOINT = 0,
-	ATTACHED = 0,
+-- opcodes of debug messages, carried in the "type" field. The same table is defined in NPLDebugOpcodes.h of the debug engine worker, keep them in sync. 
+-- message names are always sent as well, and messages with type 0 (from older debug engines) are dispatched by name. 
+local opcodes = {
+	-- to the debug engine
+	BP = 1, Output = 2, DebuggerOutput = 3, ExpValue = 4, Attached = 5, StateStarted = 7, StackFrames = 8, FrameVars = 9, Children = 10,
+	-- both directions
+	Detach = 6,
+	-- from the debug engine
+	Attach = 16, Break = 17, setb = 18, delb = 19, setbs = 20, continue = 21, step = 22, over = 23, out = 24, dump = 25, exec = 26, OutputAck = 27, stackrange = 28,
+	framevars = 29, children = 30,
 }
+IPCDebugger.opcodes = opcodes;
+-- async message handlers indexed by opcode, see Handlers. 
+local opcode_handlers = {};
 
 --------------------------
 -- local fast functions
@@ -71,6 +95,8 @@ local step_over   = false
 local step_lines  = 0
 local step_level  = 0
 local stack_level = 0
+-- the stack depth counted when the debuggee last stopped, which is reused by "stackrange" during that stop. 
+local stop_depth = 0
 local trace_level = 0
 local trace_calls = false
 local trace_returns = false
@@ -83,27 +109,79 @@ local _g      = _G
 local cocreate, cowrap = coroutine.create, coroutine.wrap
 local pausemsg = 'pause'
 local is_luajit = (jit and jit.version~=nil);
+-- the value of IPCDebugger.scoped_line_hook when the lua debug hook is installed
+local scoped_line_hook = false;
+-- whether jit is turned off per function, see IPCDebugger.selective_jit
+local selective_jit = false;
+-- other NPL states being debugged, mapping from state name to its input queue name. Only used in the main state. 
+local debug_states = {};
+
+-- get the input queue name of the calling NPL state. 
+-- @param base_queue_name: the queue name of the main state, default to "NPLDebug"
+function IPCDebugger.GetStateQueueName(base_queue_name)
+	base_queue_name = base_queue_name or "NPLDebug";
+	local state_name = __rts__:GetName();
+	if(state_name == "main" or state_name == "") then
+		return base_queue_name;
+	end
+	return base_queue_name.."_"..state_name;
+end
+
 -- call this when game is loaded. Please note, if one delete all timers, such as restart a game level, one need to call this function again. 
 -- @param bForceStart: if true, we will force start the debugger regardless when the app is started with command line debug="main". 
 function IPCDebugger.Start(bForceStart)
+	local base_queue_name = ParaEngine.GetAppCommandLineByParam("debugqueue", "NPLDebug");
 	if(not bForceStart) then
 		local debugState = ParaEngine.GetAppCommandLineByParam("debug", "");
-		if(debugState == "true" or debugState == __rts__:GetName()) then
-			IPCDebugger.StartDebugEngine(ParaEngine.GetAppCommandLineByParam("debugqueue", "NPLDebug"));
+		if(debugState == "*" or debugState == "all") then
+			-- every NPL state loading this file is debugged in the same session
+			IPCDebugger.StartDebugEngine(IPCDebugger.GetStateQueueName(base_queue_name));
+		elseif(debugState == "true" or debugState == __rts__:GetName()) then
+			IPCDebugger.StartDebugEngine(base_queue_name);
 		end
 	else
-		IPCDebugger.StartDebugEngine(ParaEngine.GetAppCommandLineByParam("debugqueue", "NPLDebug"));
+		IPCDebugger.StartDebugEngine(base_queue_name);
 	end	
 end
 
+-- other NPL states being debugged, such as "worker1|NPLDebug_worker1\n". It is sent in "Attached" of the main state. 
+function IPCDebugger.GetDebugStates()
+	local states = {};
+	for state_name, queue_name in pairs(debug_states) do
+		states[#states+1] = state_name.."|"..queue_name.."\n";
+	end
+	return table.concat(states);
+end
+
+-- called in the main state when another NPL state starts its debug engine. 
+-- @param state_name: the NPL state name, which is shown as the thread name in visual studio
+-- @param queue_name: the input queue name of the state
+function IPCDebugger.OnStateStarted(state_name, queue_name)
+	-- other states are not reachable over the socket transport
+	if(not state_name or not queue_name or debug_states[state_name] == queue_name or IPCDebugger.socket_transport) then
+		return
+	end
+	debug_states[state_name] = queue_name;
+	if(output_queue) then
+		-- already attached, otherwise the state is listed in "Attached"
+		IPCDebugger.Write({filename="StateStarted", type=opcodes.StateStarted, code = {name = state_name, queue = queue_name}});
+	end
+end
+
 -- start the debug engine. It will begin waiting for incoming debug request from the debugger UI.
 -- Note: start the debug engine only start a 100ms timer that polls the "debugger IPC queue". 
 -- So there is no performance impact to the runtime until we explicitly enable debug hook of the NPL runtime. 
 -- @param input_queue_name: the input IPC queue name, default to "NPLDebug"
 function IPCDebugger.StartDebugEngine(input_queue_name)
-	if(not ParaIPC) then
-		commonlib.log("ParaIPC C++ implementation not found\n");
-		return;
+	local is_main_lane = (input_queue_name or "NPLDebug") == ParaEngine.GetAppCommandLineByParam("debugqueue", "NPLDebug");
+	-- such as "tcp://*:8099"
+	local socket_host, socket_port = ParaEngine.GetAppCommandLineByParam("debugtransport", ""):match("^tcp://([^:]*):(%d+)$");
+	if(not socket_host or not is_main_lane) then
+		socket_host = nil;
+		if(not ParaIPC) then
+			commonlib.log("ParaIPC C++ implementation not found\n");
+			return;
+		end
 	end
 	-- IPCDebugger.TurnOffJit();
 
@@ -113,27 +191,48 @@ function IPCDebugger.StartDebugEngine(input_queue_name)
 		end	
 		return
 	end
-	IPCDebugger.IsIPCStarted = true;
 	IPCDebugger.input_queue_name = input_queue_name or "NPLDebug";
-	input_queue = ParaIPC.CreateGetQueue(IPCDebugger.input_queue_name, 2);
+	if(socket_host) then
+		NPL.load("(gl)script/ide/Debugger/IPCSocketTransport.lua");
+		input_queue = IPCDebugger.SocketTransport:new(socket_host, tonumber(socket_port));
+		if(not input_queue) then
+			return
+		end
+		-- the same connection is used in both directions
+		IPCDebugger.socket_transport = input_queue;
+		commonlib.log("IPC debugger is listening on %s:%s\n", socket_host, socket_port);
+	else
+		input_queue = ParaIPC.CreateGetQueue(IPCDebugger.input_queue_name, 2);
+	end
+	IPCDebugger.IsIPCStarted = true;
 	
 	commonlib.log("IPC debugger started in NPL state %s: queue name %s\n", __rts__:GetName(), IPCDebugger.input_queue_name);
+	if(not is_main_lane) then
+		-- this is not the main lane, let the main state tell the debug engine about us. 
+		NPL.activate("(main)script/ide/Debugger/IPCDebugger.lua", {debug_state = __rts__:GetName(), debug_queue = IPCDebugger.input_queue_name});
+	end
 	
+	local function DispatchAsyncMessage(out_msg)
+		if(debug_debugger) then
+			log("AsyncDebugMsg:")
+			commonlib.echo(out_msg);
+		end	
+		if(out_msg.method == "debug") then
+			-- messages from older debug engines do not have an opcode
+			local handler = opcode_handlers[out_msg.type] or Handlers[out_msg.filename];
+			if(type(handler) == "function") then
+				handler(out_msg.type, out_msg.param1, out_msg.param2, out_msg.code, out_msg.from)
+			end
+		end	
+	end
 	-- start timer to process the asynchrounous messages. 
 	IPCDebugger.input_timer = IPCDebugger.input_timer or commonlib.Timer:new({callbackFunc = function(timer)
 		local out_msg = {};
 		while(input_queue:try_receive(out_msg) == 0) do
-			if(debug_debugger) then
-				log("AsyncDebugMsg:")
-				commonlib.echo(out_msg);
-			end	
-			if(out_msg.method == "debug") then
-				local handler = Handlers[out_msg.filename];
-				if(type(handler) == "function") then
-					handler(out_msg.type, out_msg.param1, out_msg.param2, out_msg.code, out_msg.from)
-				end
-			end	
+			DispatchAsyncMessage(out_msg);
 		end
+		-- time bounded output batches
+		IPCDebugger.FlushOutput();
 	end})
 	IPCDebugger.input_timer:Change(IPCDebugger.polling_interval, IPCDebugger.polling_interval)
 end
@@ -165,8 +264,33 @@ function IPCDebugger.WaitForBreak()
 end
 
 
--- send a debug event message to the remote debug engine via the output_queue
-function IPCDebugger.Write(msg)
+-- output is sent in batches of at most output_batch_size bytes, or output_batch_interval milliseconds after the first buffered fragment. 
+IPCDebugger.output_batch_size = 4096;
+IPCDebugger.output_batch_interval = 50;
+-- max number of output batches sent but not yet acknowledged by the debug engine with "OutputAck". 
+IPCDebugger.output_window = 16;
+-- output beyond this size is dropped while we are waiting for "OutputAck"
+IPCDebugger.output_max_buffer = 65536;
+-- string values listed by "framevars" and "children" are cut to this length
+IPCDebugger.max_value_text = 256;
+-- number of entries shown in the preview of a table
+IPCDebugger.max_preview_items = 4;
+-- entries of a table are only counted up to this number when the table is listed. The exact number is sent with its first page of children. 
+IPCDebugger.max_child_count = 1000;
+
+-- buffered output fragments
+local output_buffer = {};
+local output_size = 0;
+-- time of the first buffered fragment
+local output_time = 0;
+-- number of batches that we can still send, nil if the debug engine does not acknowledge output. 
+local output_credits;
+-- number of bytes dropped since the last batch
+local output_dropped = 0;
+
+-- send a message to the remote debug engine via the output_queue
+-- @param priority: output is sent at priority 0, so that it never delays control messages in the queue. 
+local function send_message(msg, priority)
 	if(output_queue) then
 		output_queue:try_send({
 			method = "debug",
@@ -176,41 +300,481 @@ function IPCDebugger.Write(msg)
 			param2 = msg.param2,
 			filename = msg.filename,
 			code = msg.code,
+			priority = priority,
 		});
 	end
 end
 
+-- send buffered output as a single "DebuggerOutput" message. 
+-- @param bForce: send even if there is no credit left. It is used in break mode and before control messages, which are never chatty. 
+-- Forced batches are not acknowledged by the debug engine. 
+function IPCDebugger.FlushOutput(bForce)
+	if(output_size == 0 and output_dropped == 0) then
+		return
+	end
+	local bUseCredit = (output_credits ~= nil and not bForce);
+	if(bUseCredit and output_credits <= 0) then
+		return
+	end
+	if(output_dropped > 0) then
+		output_buffer[#output_buffer+1] = string.format("\n[NPL debugger: %d bytes of output dropped]\n", output_dropped);
+		output_dropped = 0;
+	end
+	local text = table.concat(output_buffer);
+	output_buffer = {};
+	output_size = 0;
+	if(bUseCredit) then
+		output_credits = output_credits - 1;
+	end
+	send_message({filename="DebuggerOutput", type=opcodes.DebuggerOutput, param2 = bUseCredit and 1 or 0, code = text}, 0);
+end
+
+-- buffer an output fragment, and send the batch if it is large or old enough. 
+local function buffer_output(text)
+	if(output_credits and output_credits <= 0 and output_size >= IPCDebugger.output_max_buffer) then
+		-- the debug engine is not keeping up
+		output_dropped = output_dropped + #text;
+		return
+	end
+	if(output_size == 0) then
+		output_time = ParaGlobal.timeGetTime();
+	end
+	output_buffer[#output_buffer+1] = text;
+	output_size = output_size + #text;
+	if(output_size >= IPCDebugger.output_batch_size or (ParaGlobal.timeGetTime() - output_time) >= IPCDebugger.output_batch_interval) then
+		IPCDebugger.FlushOutput();
+	end
+end
+
+-- enable output acknowledgement if it is offered by the debug engine in the "Attach" message
+-- @return true if enabled
+function IPCDebugger.SelectOutputAck(msg)
+	if(type(msg) == "table" and msg.outputack) then
+		output_credits = IPCDebugger.output_window;
+	else
+		output_credits = nil;
+	end
+	return output_credits ~= nil;
+end
+
+-- the debug engine has consumed param1 output batches
+function Handlers.OutputAck(type, param1, param2, msg)
+	if(output_credits) then
+		output_credits = math.min(output_credits + (param1 or 0), IPCDebugger.output_window);
+		IPCDebugger.FlushOutput();
+	end
+end
+
+-- send a debug event message to the remote debug engine via the output_queue
+function IPCDebugger.Write(msg)
+	-- keep output in order with control messages
+	IPCDebugger.FlushOutput(true);
+	send_message(msg, 1);
+end
+
 -- this function is met to send message to output window while the program is paused
 -- @param msg: the string
 function IPCDebugger.WriteDebugOutput(msg)
 	if(debug_debugger) then log(msg); end
-	IPCDebugger.Write({filename="DebuggerOutput", type=debug_events_enum.DEBUG_OUTPUT, code = msg});
+	buffer_output(msg);
 end
 local write = IPCDebugger.WriteDebugOutput
 
+-- the id of the request that we are replying to. The debug engine sends it in param1 of "dump" and "exec". 
+local reply_request_id = 0;
+-- buffered reply of the current request
+local reply_buffer = {};
+local reply_size = 0;
+
+local function flush_reply(bLast)
+	send_message({filename="ExpValue", type=opcodes.ExpValue, param1 = reply_request_id, param2 = bLast and 1 or 0, code = table.concat(reply_buffer)}, 1);
+	reply_buffer = {};
+	reply_size = 0;
+end
+
+-- all IPCDebugger.Dump() output until IPCDebugger.EndReply() is tagged with the given request id. 
+function IPCDebugger.BeginReply(request_id)
+	reply_request_id = request_id or 0;
+	reply_buffer = {};
+	reply_size = 0;
+end
+
+-- send the last reply message (param2 == 1), so that the debug engine stops waiting for this request. 
+function IPCDebugger.EndReply()
+	if(reply_request_id ~= 0) then
+		IPCDebugger.FlushOutput(true);
+		flush_reply(true);
+		reply_request_id = 0;
+	end
+end
+
+-- reply to the current request. Fragments are sent in batches of output_batch_size bytes, and the last batch is sent by EndReply(). 
+-- If there is no request, it is the same as WriteDebugOutput(). 
 function IPCDebugger.Dump(...)
 	local msg = table.concat({...})
 	if(msg) then
 		if(debug_debugger) then log(msg); end
-		IPCDebugger.Write({filename="ExpValue", type=debug_events_enum.DEBUG_OUTPUT, code = msg});
+		if(reply_request_id == 0) then
+			buffer_output(msg);
+		else
+			reply_buffer[#reply_buffer+1] = msg;
+			reply_size = reply_size + #msg;
+			if(reply_size >= IPCDebugger.output_batch_size) then
+				flush_reply(false);
+			end
+		end
 	end	
 end
 
 -- this funcion is met to send messsage to output window while the program is running. 
 -- @param msg: the string
 function IPCDebugger.WriteOutput(msg)
-	IPCDebugger.Write({filename="Output", type=debug_events_enum.DEBUG_OUTPUT, code = msg});
+	buffer_output(msg);
+end
+
+-- "BP" message formats, sent in param2 of "BP". 0 is the NPL text table, 1 is the compact binary format below. 
+local BP_FORMAT_TEXT, BP_FORMAT_BINARY = 0, 1;
+-- the format negotiated by "bpformat" in "Attach" and "Attached"
+local bp_format = BP_FORMAT_TEXT;
+-- mapping from file name to id of files already sent in the binary format since the last attach. 
+local bp_file_ids = {};
+local bp_file_count = 0;
+-- the persistent file id table accepted in "Attached", see IPCDebugger.SelectFileStore(). nil to send file names in "BP" messages. 
+local bp_store_path;
+local BP_STORE_HEADER = "NPLFIDS1\n";
+
+local strchar = string.char
+local floor = math.floor
+
+-- 6 bits per byte, least significant group first. Bit 7 is always set, so that the message never contains '\0'. 
+-- Bit 6 is set on all but the last byte. 
+local function bp_write_varint(buf, n)
+	while n >= 64 do
+		buf[#buf+1] = strchar(0xC0 + n % 64);
+		n = floor(n / 64);
+	end
+	buf[#buf+1] = strchar(0x80 + n);
+end
+
+local function bp_write_string(buf, s)
+	bp_write_varint(buf, #s);
+	buf[#buf+1] = s;
+end
+
+-- append a file name to the persistent file id table, so that the debug engine can read it before it sees the id. 
+-- @return true if succeed
+local function bp_store_append(filename)
+	local file = io.open(bp_store_path, "ab");
+	if(file) then
+		local result = file:write(filename, "\n");
+		file:close();
+		return result ~= nil;
+	end
+end
+
+-- varint (id*2 + bDefine), followed by the file name only the first time a file is sent. 
+-- With a persistent file id table, the name is written to the table instead and never sent. 
+local function bp_write_file(buf, filename)
+	local id = bp_file_ids[filename];
+	if(id) then
+		bp_write_varint(buf, id*2);
+	else
+		if(bp_store_path and not bp_store_append(filename)) then
+			-- send names from now on, the table is loaded again on the next attach
+			bp_store_path = nil;
+		end
+		bp_file_count = bp_file_count + 1;
+		id = bp_file_count;
+		bp_file_ids[filename] = id;
+		if(bp_store_path) then
+			bp_write_varint(buf, id*2);
+		else
+			bp_write_varint(buf, id*2 + 1);
+			bp_write_string(buf, filename);
+		end
+	end
+end
+
+-- layout: varint line+1, file, varint frame count, and for each frame: file, varint currentline+1, string name. 
+-- lines are offset by 1, since currentline is -1 for C functions. 
+local function bp_write_frames(buf, stack_info)
+	local nCount = stack_info and #stack_info or 0;
+	bp_write_varint(buf, nCount);
+	for i = 1, nCount do
+		local info = stack_info[i];
+		bp_write_file(buf, info.source or "");
+		local currentline = info.currentline or -1;
+		bp_write_varint(buf, (currentline >= -1) and (currentline + 1) or 0);
+		bp_write_string(buf, info.name or "");
+	end
+end
+
+-- if stack_info.depth is set, it is written after the frames, and the debug engine fetches the frames after #stack_info with "stackrange". 
+local function encode_breakpoint(filename, line, stack_info)
+	local buf = {};
+	bp_write_varint(buf, (tonumber(line) or 0) + 1);
+	bp_write_file(buf, filename or "");
+	bp_write_frames(buf, stack_info);
+	if(stack_info and stack_info.depth) then
+		bp_write_varint(buf, stack_info.depth);
+	end
+	return table.concat(buf);
+end
+-- also used by DebuggeeSimulator.lua
+IPCDebugger.EncodeBreakpoint = encode_breakpoint;
+
+-- select the "BP" message format offered by the debug engine in the "Attach" message. It also resets the file id table. 
+-- @return the format to reply in "Attached"
+function IPCDebugger.SelectBreakpointFormat(msg)
+	bp_file_ids, bp_file_count, bp_store_path = {}, 0, nil;
+	if(type(msg) == "table" and (tonumber(msg.bpformat) or BP_FORMAT_TEXT) >= BP_FORMAT_BINARY) then
+		bp_format = BP_FORMAT_BINARY;
+	else
+		bp_format = BP_FORMAT_TEXT;
+	end
+	return bp_format;
+end
+
+-- max number of frames in "BP" messages, nil to send the whole stack. 
+local stack_page;
+
+-- send only the top frames and the stack depth in "BP" messages if the debug engine offers "stackpage" in the "Attach" message. 
+-- It fetches the other frames with "stackrange" only when it needs them. It requires the binary "BP" format. 
+-- @return the number of frames in "BP" messages, or nil if the whole stack is sent. 
+function IPCDebugger.SelectStackPage(msg)
+	stack_page = nil;
+	if(type(msg) == "table" and bp_format == BP_FORMAT_BINARY) then
+		local nPageSize = tonumber(msg.stackpage);
+		if(nPageSize and nPageSize > 0) then
+			stack_page = nPageSize;
+		end
+	end
+	return stack_page;
+end
+
+-- reply to "stackrange" with frames of the stopped stack. 
+-- layout: varint index of the first frame (starting from 1), then the frames as in "BP", i.e. varint frame count, and for each frame: file ref, varint currentline+1, string name. 
+function IPCDebugger.WriteStackFrames(request_id, from, stack_info)
+	local buf = {};
+	bp_write_varint(buf, from);
+	bp_write_frames(buf, stack_info);
+	IPCDebugger.Write({filename="StackFrames", type=opcodes.StackFrames, param1 = request_id, param2 = 1, code = table.concat(buf)});
+end
+
+-- values listed by "framevars" and "children" in the current break, mapping from handle to value, and from value to handle. 
+-- handles are only given to values that can be expanded, and stay valid until the debuggee resumes, see release_handles(). 
+local handle_values = {};
+local value_handles = {};
+-- ordered keys of tables whose children are listed, mapping from handle to array of keys, so that pages of children are consistent. 
+local handle_keys = {};
+
+-- @return the handle of a table, function, userdata or thread, or 0 for other values. 
+local function get_handle(value)
+	local value_type = type(value);
+	if(value_type ~= "table" and value_type ~= "function" and value_type ~= "userdata" and value_type ~= "thread") then
+		return 0;
+	end
+	local handle = value_handles[value];
+	if(not handle) then
+		handle = #handle_values + 1;
+		handle_values[handle] = value;
+		value_handles[value] = handle;
+	end
+	return handle;
+end
+
+-- forget all handles, so that the values they refer to can be collected while the debuggee runs. 
+local function release_handles()
+	if(#handle_values > 0) then
+		handle_values = {};
+		value_handles = {};
+		handle_keys = {};
+	end
+end
+
+-- get the value of a handle given in the current break, nil if it is unknown or released. 
+function IPCDebugger.GetHandleValue(handle)
+	return handle_values[handle];
+end
+
+-- name of a table entry, such as name, ["a b"] or [1]
+local function format_key(key)
+	if(type(key) == "string") then
+		if(strfind(key, "^[_%a][_%w]*$")) then
+			return key;
+		end
+		return string.format("[%q]", key);
+	end
+	return "["..tostring(key).."]";
+end
+
+-- short text of a value in the locals window. Tables are shown with their first few entries, and nested tables are not expanded. 
+-- @param bNested: true for values in the preview of a table, which are shorter
+local function format_value(value, bNested)
+	local value_type = type(value);
+	if(value_type == "string") then
+		local max_size = bNested and 32 or IPCDebugger.max_value_text;
+		if(#value > max_size) then
+			return string.format("%q", strsub(value, 1, max_size)).."...";
+		end
+		return string.format("%q", value);
+	elseif(value_type == "table") then
+		if(bNested) then
+			return "{...}";
+		end
+		local items = {};
+		local n = 0;
+		for key, item in pairs(value) do
+			if(n >= IPCDebugger.max_preview_items) then
+				items[#items+1] = "...";
+				break;
+			end
+			n = n + 1;
+			if(key == n) then
+				items[#items+1] = format_value(item, true);
+			else
+				items[#items+1] = format_key(key).."="..format_value(item, true);
+			end
+		end
+		return "{"..table.concat(items, ", ").."}";
+	end
+	return tostring(value);
+end
+
+-- number of children of a value, counted up to IPCDebugger.max_child_count. Only tables have children. 
+local function count_children(value)
+	if(type(value) ~= "table") then
+		return 0;
+	end
+	local n = 0;
+	for _ in pairs(value) do
+		n = n + 1;
+		if(n >= IPCDebugger.max_child_count) then
+			break;
+		end
+	end
+	return n;
+end
+
+-- keys of a table in the order of its children: number keys in ascending order, then string keys in ascending order, then other keys. 
+-- They are sorted once per break, when the first page of children is listed. 
+local function get_child_keys(handle, value)
+	local keys = handle_keys[handle];
+	if(not keys) then
+		local numbers, strings, others = {}, {}, {};
+		for key in pairs(value) do
+			local key_type = type(key);
+			if(key_type == "number") then
+				numbers[#numbers+1] = key;
+			elseif(key_type == "string") then
+				strings[#strings+1] = key;
+			else
+				others[#others+1] = key;
+			end
+		end
+		table.sort(numbers);
+		table.sort(strings);
+		keys = numbers;
+		for _, key in ipairs(strings) do
+			keys[#keys+1] = key;
+		end
+		for _, key in ipairs(others) do
+			keys[#keys+1] = key;
+		end
+		handle_keys[handle] = keys;
+	end
+	return keys;
+end
+
+-- the variable list of "FrameVars" and "Children" messages: array of {kind, name, type, value, handle, count}, 
+-- where value is the text of the value, handle is nonzero if the value can be expanded, and count is its number of children (see count_children). 
+-- @param vars: array of {kind, name, value}
+local function make_var_list(vars)
+	local list = {};
+	for i, var in ipairs(vars) do
+		local value = var[3];
+		local count = count_children(value);
+		list[i] = {kind = var[1], name = var[2], type = type(value), value = format_value(value), handle = (count > 0) and get_handle(value) or 0, count = count};
+	end
+	return list;
+end
+
+-- reply to "framevars" with variables of a frame of the stopped stack. 
+-- code is {vars = variable list}, where kind is "param", "local" or "upvalue", see make_var_list(). 
+-- @param vars: array of {kind, name, value}
+function IPCDebugger.WriteFrameVars(request_id, vars)
+	IPCDebugger.Write({filename="FrameVars", type=opcodes.FrameVars, param1 = request_id, param2 = 1, code = {vars = make_var_list(vars)}});
+end
+
+-- a page of children of a value listed in this break. 
+-- @param from, count: index of the first child starting from 1, and the max number of children
+-- @return array of {"field", name, value}, and the total number of children
+local function get_children(handle, from, count)
+	local value = handle_values[handle];
+	if(type(value) ~= "table") then
+		return {}, 0;
+	end
+	local keys = get_child_keys(handle, value);
+	local children = {};
+	for i = from, math.min(from + count - 1, #keys) do
+		local key = keys[i];
+		children[#children+1] = {"field", format_key(key), rawget(value, key)};
+	end
+	return children, #keys;
+end
+
+-- reply to "children". code is {vars = variable list, from = index of the first child, total = number of children}, 
+-- where kind is "field" for table entries or "value" for an expression, see make_var_list(). 
+-- @param vars: array of {kind, name, value}
+function IPCDebugger.WriteChildren(request_id, vars, from, total)
+	IPCDebugger.Write({filename="Children", type=opcodes.Children, param1 = request_id, param2 = 1, code = {vars = make_var_list(vars), from = from, total = total}});
+end
+
+-- use the persistent file id table if the debug engine offers "filestore" in the "Attach" message, i.e. it runs on the same machine. 
+-- The table is "temp/debugger/<input queue name>.fileids" in the working directory, with the header line "NPLFIDS1" followed by one file name per line, 
+-- and the id of a file is its line number. The table is truncated on every attach, so that ids always start from 1 and the table never grows 
+-- beyond the files seen in one debug session. The debug engine closes its mapping of the table before it sends "Attach". 
+-- It must be called after IPCDebugger.SelectBreakpointFormat(). 
+-- @return the absolute file path to reply in "Attached", or nil to send file names in "BP" messages. 
+function IPCDebugger.SelectFileStore(msg)
+	if(bp_format ~= BP_FORMAT_BINARY or type(msg) ~= "table" or not msg.filestore or not io) then
+		return
+	end
+	local dir = IPCDebugger.GetSourceDirectory() or "";
+	if(dir ~= "" and not dir:match("[/\\]$")) then
+		dir = dir.."/";
+	end
+	local path = dir.."temp/debugger/"..(IPCDebugger.input_queue_name or "NPLDebug")..".fileids";
+
+	ParaIO.CreateDirectory(path);
+	local file = io.open(path, "wb");
+	if(not file) then
+		return
+	end
+	local result = file:write(BP_STORE_HEADER);
+	file:close();
+	if(result == nil) then
+		return
+	end
+	bp_file_ids, bp_file_count, bp_store_path = {}, 0, path;
+	return path;
 end
 
 -- send a break point event to the debugger UI. 
 function IPCDebugger.WriteBreakPoint(filename, line, stack_info)
-	IPCDebugger.Write({filename="BP", type=debug_events_enum.BREAKPOINT, code = {filename=filename, line=line, stack_info=stack_info}});
+	if(bp_format == BP_FORMAT_BINARY) then
+		IPCDebugger.Write({filename="BP", type=opcodes.BP, param2 = BP_FORMAT_BINARY, code = encode_breakpoint(filename, line, stack_info)});
+	else
+		IPCDebugger.Write({filename="BP", type=opcodes.BP, code = {filename=filename, line=line, stack_info=stack_info}});
+	end
 end
 
 -- read the next debug message. 
 -- @return the message table or nil
 function IPCDebugger.WaitForDebugEvent(out_msg)
 	out_msg = out_msg or {};
+	-- we are in break mode, send all output before blocking
+	IPCDebugger.FlushOutput(true);
 	if(input_queue:receive(out_msg) == 0) then
 		if(debug_debugger) then
 			log("SyncDebugMsg:")
@@ -220,18 +784,26 @@ function IPCDebugger.WaitForDebugEvent(out_msg)
 	end
 end
 
+-- the queue to reply to the debug engine
+local function get_output_queue(from)
+	return IPCDebugger.socket_transport or IPC.CreateGetQueue(from, 2);
+end
+
 -- async break request
 function Handlers.Break(type, param1, param2, msg, from)
-	output_queue = IPC.CreateGetQueue(from, 2);
+	output_queue = get_output_queue(from);
 	IPCDebugger.pause();
 end
 
 -- async attach a remote IPC debugger to this NPL state and break it  
 function Handlers.Attach(type, param1, param2, msg, from)
 	-- create the output message queue to communicate with the remote debug engine
-	output_queue = IPC.CreateGetQueue(from, 2);
+	output_queue = get_output_queue(from);
 	-- attach debug hook
-	IPCDebugger.Attach();
+	IPCDebugger.SelectBreakpointFormat(msg);
+	IPCDebugger.SelectStackPage(msg);
+	IPCDebugger.SelectOutputAck(msg);
+	IPCDebugger.Attach(IPCDebugger.SelectFileStore(msg));
 end
 
 -- async detach a remote IPC debugger 
@@ -244,14 +816,20 @@ function Handlers.Suspend(type, param1, param2, msg)
 end
 
 -- SetBreakpoint async: this is not recommended way to set breakpoint, call setb when breaked instead.
+-- @param msg: {filename, line, cond, passcount_style, passcount, log}, see IPCDebugger.NewBreakpointCondition() for the optional fields. 
 function Handlers.setb(type, param1, param2, msg)
 	local filename, line = IPCDebugger.NormalizeFileName(msg.filename), msg.line;
 	if(filename and line) then
-		IPCDebugger.set_breakpoint(filename, line);
+		IPCDebugger.set_breakpoint(filename, line, IPCDebugger.NewBreakpointCondition(msg.cond, msg.passcount_style, msg.passcount, msg.log));
 		IPCDebugger.WriteDebugOutput("Breakpoint async set in file "..filename..' line '..line..'\n')
 	end	
 end
 
+-- batched SetBreakpoint and RemoveBreakpoint async: sent by the debug engine on attach (mode="full") and after bulk edits (mode="delta").
+function Handlers.setbs(type, param1, param2, msg)
+	IPCDebugger.apply_breakpoints(msg);
+end
+
 -- RemoveBreakpoint async: this is not recommended way to remove breakpoint, call delb when breaked instead. 
 function Handlers.delb(type, param1, param2, msg)
 	IPCDebugger.remove_breakpoint(IPCDebugger.NormalizeFileName(msg.filename), msg.line)
@@ -262,6 +840,10 @@ end
 
 function Handlers.Close(type, param1, param2, msg)
 end
+
+for name, op in pairs(opcodes) do
+	opcode_handlers[op] = Handlers[name];
+end
 	
 
 --like debug.getinfo but copes with no activation record at the given level
@@ -471,21 +1053,426 @@ local function info()
 	dumpvar( traceinfo, 0, 'traceinfo' )
 end
 
+-- relative paths of file names sent by the debug engine, mapping from the file name to its relative path. 
+local relative_paths = {};
+
 local function GetRelativeNPLPath(file)
-	if(file:match(":")) then
-		-- only relative path
-		file = string.gsub(file, "^.*/script/", "script/");
-		file = string.gsub(file, "^.*/source/", "source/");
+	local relative_path = relative_paths[file];
+	if(not relative_path) then
+		relative_path = file;
+		if(file:match(":")) then
+			-- only relative path
+			relative_path = string.gsub(relative_path, "^.*/script/", "script/");
+			relative_path = string.gsub(relative_path, "^.*/source/", "source/");
+		end
+		relative_paths[file] = relative_path;
+	end
+	return relative_path;
+end
+
+-- file names of chunk sources as used in breakpoints, mapping from the raw source, such as "@Script/Test.lua", to "script/test.lua". 
+-- Each source is only normalized the first time it is seen. 
+local source_files = {};
+
+local function get_source_file(source)
+	local file = source_files[source];
+	if(not file) then
+		file = strlower(source);
+		if(strsub(file, 1, 1) == "@") then
+			file = strsub(file, 2);
+		end
+		source_files[source] = file;
 	end
 	return file;
 end
 
-local function set_breakpoint(file, line)
+-- breakpoint lines of each chunk, mapping from the raw source to {[line] = value of breakpoints[line][file]}, so that the debug hook does no string work on line events. 
+-- It is built lazily from breakpoints as sources are seen, and replaced whenever breakpoints change. 
+local source_breakpoints;
+
+local function new_source_breakpoints()
+	return setmetatable({}, {__index = function(t, source)
+		local file = get_source_file(source);
+		local lines = {};
+		for line, files in pairs(breakpoints) do
+			if(files[file]) then
+				lines[line] = files[file];
+			end
+		end
+		t[source] = lines;
+		return lines;
+	end});
+end
+source_breakpoints = new_source_breakpoints();
+
+-- get the breakpoint lines of a chunk source, such as "@script/test.lua". 
+-- @return {[line] = true or the value returned by IPCDebugger.NewBreakpointCondition()}, which should not be modified. 
+function IPCDebugger.GetSourceBreakpoints(source)
+	return source_breakpoints[source];
+end
+
+-- functions called since breakpoints last changed, mapping from function to {lines, first, last, has_breakpoint}, see function_has_breakpoint(), 
+-- or to false for C functions. debug.getinfo(level, "f") creates no strings, so "S" is only asked for on the first call of each function. 
+-- It is weak-keyed, so that closures are collected, and it is cleared whenever breakpoints change. 
+local line_hook_funcs = setmetatable({}, {__mode = "k"});
+
+-- breakpoint lines of the running function, i.e. source_breakpoints of its source, and its line range. 
+-- They are set by function_has_breakpoint() on call and return events, so that line events need no debug.getinfo. 
+-- frame_lines is nil if the running function is unknown, such as after calling a C function, which has no return event in luajit. 
+-- Lines outside the range are not trusted either, since frames unwound by errors have no return events. 
+local frame_lines, frame_first, frame_last;
+
+-- functions that we turned jit off for, mapping from function to "bp" if it has a breakpoint, or "step" if it is on the stack while stepping. 
+-- hooks are not called from jit compiled code, so these functions must run in the interpreter. 
+local jit_off_funcs = setmetatable({}, {__mode = "k"});
+
+-- turn jit off for a lua function, which also flushes its compiled code. 
+-- @param reason: "bp" or "step"
+local function jit_off_function(func, reason)
+	local old_reason = jit_off_funcs[func];
+	if(old_reason ~= reason and old_reason ~= "bp") then
+		if(not old_reason) then
+			jit.off(func);
+		end
+		jit_off_funcs[func] = reason;
+	end
+end
+
+-- turn jit on again for functions that we turned off.
+-- @param reason: nil for all functions, or "step" for functions that were only turned off for stepping. 
+local function jit_on_functions(reason)
+	for func, func_reason in pairs(jit_off_funcs) do
+		if(not reason or func_reason == reason) then
+			jit.on(func);
+			jit_off_funcs[func] = nil;
+		end
+	end
+end
+
+-- turn jit off for all lua functions on the stack from the given level, so that stepping over and out of them gets their line events. 
+local function jit_off_stack(level)
+	level = level + 1;
+	while true do
+		local info = debug.getinfo(level, "Sf");
+		if not info then break end
+		if(info.what ~= "C") then
+			jit_off_function(info.func, "step");
+		end
+		level = level + 1;
+	end
+end
+
+-- whether the function at the given stack level needs line events, see IPCDebugger.scoped_line_hook. 
+-- @param level: stack level of the caller of this function
+-- @return nil for C functions and unknown levels, which do not change whether line events are hooked. 
+local function function_has_breakpoint(level)
+	local func_info = debug.getinfo(level + 1, "f");
+	local func = func_info and func_info.func;
+	if(not func) then
+		frame_lines = nil;
+		return
+	end
+	local entry = line_hook_funcs[func];
+	if(entry == nil) then
+		local info = debug.getinfo(func, "S");
+		if(info.what == "C") then
+			entry = false;
+		else
+			local lines = source_breakpoints[info.source];
+			local first, last = info.linedefined, info.lastlinedefined;
+			-- the main chunk has no line range
+			if(info.what == "main") then
+				first, last = 0, math.huge;
+			end
+			local result = false;
+			for line in pairs(lines) do
+				if(line >= first and line <= last) then
+					result = true;
+					break;
+				end
+			end
+			entry = {lines, first, last, result};
+			if(result and selective_jit) then
+				jit_off_function(func, "bp");
+			end
+		end
+		line_hook_funcs[func] = entry;
+	end
+	if(not entry) then
+		frame_lines = nil;
+		return
+	end
+	frame_lines, frame_first, frame_last = entry[1], entry[2], entry[3];
+	return entry[4];
+end
+
+-- enable or disable line events of the lua debug hook
+local function set_line_hook(bEnable)
+	local hook, mask = debug.gethook();
+	local new_mask = bEnable and "lcr" or "cr";
+	if(hook and mask ~= new_mask) then
+		debug.sethook(hook, new_mask);
+	end
+end
+
+-- call this whenever breakpoints change
+local function on_breakpoints_changed()
+	source_breakpoints = new_source_breakpoints();
+	line_hook_funcs = setmetatable({}, {__mode = "k"});
+	frame_lines = nil;
+	if(selective_jit) then
+		-- functions are turned off again on their next call if they still have a breakpoint. 
+		-- compiled code of other functions may have inlined a function with a new breakpoint, so all of it is flushed. 
+		jit_on_functions("bp");
+		jit.flush();
+	end
+	if(started and IPCDebugger.scoped_line_hook) then
+		-- the running function may have a new breakpoint, it is decided again on the next call or return. 
+		set_line_hook(true);
+	end
+end
+
+-- hit count predicates of breakpoints, the same as enum_BP_PASSCOUNT_STYLE of visual studio
+local PASSCOUNT_NONE, PASSCOUNT_EQUAL, PASSCOUNT_EQUAL_OR_GREATER, PASSCOUNT_MOD = 0, 1, 2, 3;
+
+-- logpoint messages per second that each logpoint may print, and the number that it may print at once after being idle. 
+-- messages beyond the rate are dropped and counted, so that a logpoint in a hot loop never floods the output queue. 
+IPCDebugger.logpoint_rate = 10;
+IPCDebugger.logpoint_burst = 20;
+
+-- the value of breakpoints[line][file], which is true for unconditional breakpoints. 
+-- @param cond: nil or an expression that is evaluated with the locals, upvalues and environment of the frame that hits the breakpoint. 
+-- @param passcount_style: nil or one of PASSCOUNT_*. Hits are counted after the condition passes. 
+-- @param passcount: the hit count to compare with
+-- @param log: nil or the message template of a logpoint, where {expression} is replaced by the value of the expression in the same environment as cond. 
+--  logpoints print the message when the condition and hit count pass, and never stop. 
+-- @return true or {cond, passcount_style, passcount, hits, log}
+local function new_condition(cond, passcount_style, passcount, log)
+	passcount_style = tonumber(passcount_style) or PASSCOUNT_NONE;
+	if(cond == "") then
+		cond = nil;
+	end
+	if(log == "") then
+		log = nil;
+	end
+	if(not cond and not log and passcount_style == PASSCOUNT_NONE) then
+		return true;
+	end
+	return {cond = cond, passcount_style = passcount_style, passcount = tonumber(passcount) or 0, hits = 0, log = log};
+end
+IPCDebugger.NewBreakpointCondition = new_condition;
+
+-- environment of the expression browsed by commands.children: locals and upvalues of the frame at the given level, falling back to the environment of its function. 
+local function get_frame_env(level)
+	local info = debug.getinfo(level + 1, "f");
+	local func = info and info.func;
+	local env = setmetatable({}, {__index = func and getfenv(func) or _g});
+	local i = 1;
+	while func do
+		local name, value = debug.getupvalue(func, i);
+		if not name then break end
+		env[name] = value;
+		i = i + 1;
+	end
+	i = 1;
+	while true do
+		local name, value = debug.getlocal(level + 1, i);
+		if not name then break end
+		-- ignoring internal control variables, and inner locals are listed after outer ones of the same name
+		if(strsub(name, 1, 1) ~= "(") then
+			env[name] = value;
+		end
+		i = i + 1;
+	end
+	return env;
+end
+
+-- the function of the frame that eval_in_frame() runs an expression in, and the level of that frame relative to the __index of frame_env
+local eval_func, eval_level;
+
+-- environment of condition and logpoint expressions: locals of the frame running eval_func, then its upvalues, then the environment of eval_func. 
+-- Names are resolved when an expression reads them, so that a hit builds no table of the frame. 
+local frame_env = setmetatable({}, {__index = function(_, name)
+	local func = eval_func;
+	if not func then
+		return _g[name];
+	end
+	local level = eval_level;
+	if not level then
+		-- the frame is below the expression, pcall and eval_in_frame
+		level = 2;
+		while true do
+			local info = debug.getinfo(level, "f");
+			if not info then
+				return nil;
+			elseif info.func == func then
+				break;
+			end
+			level = level + 1;
+		end
+		eval_level = level;
+	end
+	local value, bFound;
+	local i = 1;
+	while true do
+		local local_name, local_value = debug.getlocal(level, i);
+		if not local_name then break end
+		-- inner locals are listed after outer ones of the same name
+		if(local_name == name) then
+			value, bFound = local_value, true;
+		end
+		i = i + 1;
+	end
+	if bFound then
+		return value;
+	end
+	i = 1;
+	while true do
+		local upvalue_name, upvalue = debug.getupvalue(func, i);
+		if not upvalue_name then break end
+		if(upvalue_name == name) then
+			return upvalue;
+		end
+		i = i + 1;
+	end
+	return getfenv(func)[name];
+end});
+
+-- run an expression whose environment is frame_env in the frame at the given level. 
+-- @return the results of pcall
+local function eval_in_frame(expr, level)
+	local info = debug.getinfo(level + 1, "f");
+	local last_func, last_level = eval_func, eval_level;
+	eval_func, eval_level = info and info.func, nil;
+	local bSucceed, result = pcall(expr);
+	eval_func, eval_level = last_func, last_level;
+	return bSucceed, result;
+end
+
+-- compile the message template of a logpoint into an array of literal strings and expression functions
+local function compile_log_message(log)
+	local parts = {};
+	local pos = 1;
+	while true do
+		local from, to, expr = strfind(log, "{([^}]*)}", pos);
+		if not from then break end
+		if(from > pos) then
+			parts[#parts+1] = strsub(log, pos, from - 1);
+		end
+		local func, err = loadstring("return ("..expr..")", "=logpoint");
+		parts[#parts+1] = func or ("<"..tostring(err)..">");
+		pos = to + 1;
+	end
+	if(pos <= #log) then
+		parts[#parts+1] = strsub(log, pos);
+	end
+	return parts;
+end
+IPCDebugger.CompileLogMessage = compile_log_message;
+
+-- print the message of a logpoint hit by the frame at the given level, unless it is over IPCDebugger.logpoint_rate. 
+local function write_log_message(bp, level)
+	-- token bucket refilled at logpoint_rate
+	local now = ParaGlobal.timeGetTime();
+	local burst = IPCDebugger.logpoint_burst;
+	local tokens = bp.tokens or burst;
+	if(bp.token_time) then
+		tokens = math.min(burst, tokens + (now - bp.token_time) * IPCDebugger.logpoint_rate / 1000);
+	end
+	bp.token_time = now;
+	if(tokens < 1) then
+		bp.tokens = tokens;
+		bp.dropped = (bp.dropped or 0) + 1;
+		return
+	end
+	bp.tokens = tokens - 1;
+
+	local parts = bp.log_parts;
+	if(not parts) then
+		parts = compile_log_message(bp.log);
+		for _, part in ipairs(parts) do
+			if(type(part) == "function") then
+				setfenv(part, frame_env);
+			end
+		end
+		bp.log_parts = parts;
+	end
+	local text = {};
+	for i, part in ipairs(parts) do
+		if(type(part) == "function") then
+			local bSucceed, result = eval_in_frame(part, level + 1);
+			text[i] = bSucceed and tostring(result) or ("<"..tostring(result)..">");
+		else
+			text[i] = part;
+		end
+	end
+	if(bp.dropped) then
+		text[#text+1] = string.format(" [%d messages dropped]", bp.dropped);
+		bp.dropped = nil;
+	end
+	text[#text+1] = "\n";
+	IPCDebugger.WriteOutput(table.concat(text));
+end
+
+-- whether a breakpoint hit by the frame at the given level should stop. Conditions are compiled once, so that hits which do not match are cheap. 
+-- logpoints print their message here and never stop. 
+-- @param bp: the value of breakpoints[line][file]
+local function check_condition(bp, level)
+	if(bp == true) then
+		return true;
+	end
+	if(bp.cond) then
+		local func = bp.func;
+		if(func == nil) then
+			local err;
+			func, err = loadstring("return ("..bp.cond..")", "=breakpoint condition");
+			if(func) then
+				setfenv(func, frame_env);
+			else
+				IPCDebugger.WriteDebugOutput("NPL debugger: invalid breakpoint condition "..bp.cond..": "..tostring(err).."\n");
+			end
+			bp.func = func or false;
+		end
+		if(func) then
+			local bSucceed, result = eval_in_frame(func, level + 1);
+			if(not bSucceed) then
+				-- stop, so that the error is noticed
+				IPCDebugger.WriteDebugOutput("NPL debugger: error in breakpoint condition "..bp.cond..": "..tostring(result).."\n");
+			elseif(not result) then
+				return false;
+			end
+		end
+	end
+	if(bp.passcount_style ~= PASSCOUNT_NONE) then
+		bp.hits = bp.hits + 1;
+		local bPassed = true;
+		if(bp.passcount_style == PASSCOUNT_EQUAL) then
+			bPassed = bp.hits == bp.passcount;
+		elseif(bp.passcount_style == PASSCOUNT_EQUAL_OR_GREATER) then
+			bPassed = bp.hits >= bp.passcount;
+		elseif(bp.passcount_style == PASSCOUNT_MOD) then
+			bPassed = bp.passcount > 0 and (bp.hits % bp.passcount) == 0;
+		end
+		if(not bPassed) then
+			return false;
+		end
+	end
+	if(bp.log) then
+		write_log_message(bp, level + 1);
+		return false;
+	end
+	return true;
+end
+IPCDebugger.CheckBreakpointCondition = check_condition;
+
+-- @param bp: nil or the value returned by IPCDebugger.NewBreakpointCondition()
+local function set_breakpoint(file, line, bp)
 	if not breakpoints[line] then 
 		breakpoints[line] = {} 
 	end  
 	file = GetRelativeNPLPath(file);
-	breakpoints[line][file] = true;
+	breakpoints[line][file] = bp or true;
+	on_breakpoints_changed();
 end
 
 IPCDebugger.set_breakpoint = set_breakpoint;
@@ -494,6 +1481,7 @@ local function remove_breakpoint(file, line)
 	if breakpoints[line] then 
 		file = GetRelativeNPLPath(file);
 		breakpoints[line][file] = nil;
+		on_breakpoints_changed();
 	end
 end
 
@@ -513,12 +1501,103 @@ local function NormalizeFileName(filename)
 	return filename;
 end
 IPCDebugger.NormalizeFileName = NormalizeFileName;
+
+-- copy of the breakpoints table, so that changes can be made on it and swapped in at once.
+local function copy_breakpoints(from)
+	local to = {};
+	for line, files in pairs(from) do
+		local files_copy = {};
+		for file, value in pairs(files) do
+			files_copy[file] = value;
+		end
+		to[line] = files_copy;
+	end
+	return to;
+end
+
+-- conditions and log messages are escaped by the debug engine, so that they fit in one line
+local line_escapes = { ["\\"] = "\\", n = "\n", r = "\r" };
+local function unescape_line(text)
+	return (string.gsub(text, "\\([\\nr])", line_escapes));
+end
+
+-- apply a batch of breakpoint changes in a single step, so that the debug hook never sees a partially applied batch. 
+-- @param msg: {mode="full"|"delta", add="filename|line\n...", del="filename|line\n...", cond="filename|line|passcount_style|passcount|condition\n...", log="filename|line|message\n..."}
+--  if mode is "full", all existing breakpoints are replaced by the add list. 
+--  cond is optional, it lists the added breakpoints that have a condition or hit count, see IPCDebugger.NewBreakpointCondition(). 
+--  log is optional, it lists the added breakpoints that are logpoints. 
+--  line breaks and backslashes in condition and message are escaped as \n, \r and \\. 
+-- @return the number of breakpoints added and removed
+local function apply_breakpoints(msg)
+	if(type(msg) ~= "table") then
+		return 0, 0;
+	end
+	local new_breakpoints;
+	if(msg.mode == "full") then
+		new_breakpoints = {};
+	else
+		new_breakpoints = copy_breakpoints(breakpoints);
+	end
+	local conditions;
+	if(msg.cond or msg.log) then
+		conditions = {};
+		local logs = {};
+		for file, line, log in string.gmatch(msg.log or "", "([^\n|]+)|(%d+)|([^\n]*)") do
+			logs[file.."|"..line] = unescape_line(log);
+		end
+		for file, line, passcount_style, passcount, cond in string.gmatch(msg.cond or "", "([^\n|]+)|(%d+)|(%d+)|(%d+)|([^\n]*)") do
+			local key = file.."|"..line;
+			conditions[key] = new_condition(unescape_line(cond), passcount_style, passcount, logs[key]);
+			logs[key] = nil;
+		end
+		for key, log in pairs(logs) do
+			conditions[key] = new_condition(nil, nil, nil, log);
+		end
+	end
+	local nAdded, nRemoved = 0, 0;
+	if(msg.del) then
+		for file, line in string.gmatch(msg.del, "([^\n|]+)|(%d+)") do
+			local files = new_breakpoints[tonumber(line)];
+			if(files) then
+				files[GetRelativeNPLPath(NormalizeFileName(file))] = nil;
+				nRemoved = nRemoved + 1;
+			end
+		end
+	end
+	if(msg.add) then
+		for file, line in string.gmatch(msg.add, "([^\n|]+)|(%d+)") do
+			local bp = conditions and conditions[file.."|"..line] or true;
+			line = tonumber(line);
+			local files = new_breakpoints[line];
+			if(not files) then
+				files = {};
+				new_breakpoints[line] = files;
+			end
+			files[GetRelativeNPLPath(NormalizeFileName(file))] = bp;
+			nAdded = nAdded + 1;
+		end
+	end
+	breakpoints = new_breakpoints;
+	on_breakpoints_changed();
+	return nAdded, nRemoved;
+end
+IPCDebugger.apply_breakpoints = apply_breakpoints;
 		
 -- search for exact names
 local function has_breakpoint(file, line)
   return breakpoints[line] and breakpoints[line][file]
 end
 
+-- lower cased file name of the function at the given level, without the leading "@"
+local function get_frame_file(level)
+  local file = getinfo(level+1, "source")
+  if strfind(file, "@") == 1 then
+    file = strsub(file, 2)
+  end
+  if IsWindows then file = strlower(file) end
+  return file
+end
+
 local function capture_vars(ref,level,line)
   --get vars, file and line for the given level relative to debug_hook offset by ref
 
@@ -571,11 +1650,7 @@ local function capture_vars(ref,level,line)
   
   --}}}
 
-  local file = getinfo(lvl, "source")
-  if strfind(file, "@") == 1 then
-    file = strsub(file, 2)
-  end
-  if IsWindows then file = strlower(file) end
+  local file = get_frame_file(lvl)
 
   if not line then
     line = getinfo(lvl, "currentline")
@@ -585,28 +1660,149 @@ local function capture_vars(ref,level,line)
 
 end
 
+-- number of parameters of lua functions, where debug.getinfo does not report nparams (lua 5.1). 
+-- They are parsed from the parameter list at the line that defines the function, and cached per function. 
+local param_counts = setmetatable({}, {__mode = "k"});
+
+-- source code of a chunk from the given line, nil if it is not available. 
+-- @param max_lines: max number of lines to read from a file
+local function read_source_lines(source, from, max_lines)
+  local prefix = strsub(source, 1, 1)
+  if prefix == "@" then
+    local file = io and io.open(strsub(source, 2), "r")
+    if not file then return end
+    local lines = {}
+    local n = 0
+    for line in file:lines() do
+      n = n + 1
+      if n >= from then
+        lines[#lines+1] = line
+        if #lines >= max_lines then break end
+      end
+    end
+    file:close()
+    return table.concat(lines, "\n")
+  elseif prefix ~= "=" then
+    -- the source of a string chunk is its code
+    local pos = 1
+    for i = 2, from do
+      pos = strfind(source, "\n", pos, true)
+      if not pos then return end
+      pos = pos + 1
+    end
+    return strsub(source, pos)
+  end
+end
+
+-- number of parameters of a function, which are its first locals. 
+-- @param ar: debug.getinfo of the function with "S", "f" and "u"
+local function get_param_count(ar)
+  if ar.nparams then return ar.nparams end
+  local func = ar.func
+  if not func or ar.what ~= "Lua" then return 0 end
+  local count = param_counts[func]
+  if not count then
+    count = 0
+    local text = ar.source and read_source_lines(ar.source, ar.linedefined, 8)
+    --NB: if several functions are defined on the same line, the first one is used
+    local name, params = string.match(text or "", "function%s*([%w_%.:]*)%s*%(([^%)]*)%)")
+    if params then
+      if strfind(name, ":", 1, true) then
+        count = 1  -- self
+      end
+      for param in string.gmatch(params, "[_%a][_%w]*") do
+        count = count + 1
+      end
+    end
+    param_counts[func] = count
+  end
+  return count
+end
+
+-- locals and upvalues of the function at the given level, for "framevars". 
+-- Like capture_vars, internal control variables are ignored, and a local hides upvalues and outer locals of the same name. 
+-- @param level: stack level relative to this function
+-- @return array of {kind, name, value}, where kind is "param", "local" or "upvalue"
+local function get_frame_vars(level)
+  local vars = {}
+  local ar = debug.getinfo(level, "Sfu")
+  if not ar then return vars end
+
+  --NB: nparams is only known in luajit, otherwise the parameter list is parsed from the source
+  local nparams = get_param_count(ar)
+  local index = {}
+  local i = 1
+  while true do
+    local name, value = debug.getlocal(level, i)
+    if not name then break end
+    if strsub(name,1,1) ~= '(' then
+      local var = {i <= nparams and "param" or "local", name, value}
+      if index[name] then
+        vars[index[name]] = var
+      else
+        vars[#vars+1] = var
+        index[name] = #vars
+      end
+    end
+    i = i + 1
+  end
+
+  local func = ar.func
+  if func then
+    i = 1
+    while true do
+      local name, value = debug.getupvalue(func, i)
+      if not name then break end
+      if strsub(name,1,1) ~= '(' and not index[name] then
+        vars[#vars+1] = {"upvalue", name, value}
+        index[name] = #vars
+      end
+      i = i + 1
+    end
+  end
+  return vars
+end
+
+-- get the number of frames on the stack from the given level, i.e. the stack level of the function at that level. 
+-- The first missing level is found by an exponential then binary search, which takes O(log(depth)) calls to debug.getinfo instead of O(depth). 
+-- Each probe asks for no fields with "", so it does not look up the source or the line of the frame. 
+-- @param level: stack level relative to this function, i.e. the level of debug.getinfo in the caller plus 1
+-- @param hint_start: nil or the expected stack level, which is only used as the start of the search. 
 function IPCDebugger.GetStackLevel(level, hint_start)
-	local count = 0;
-	if(hint_start and debug.getinfo(level + hint_start - 1, "l")) then
-		count = hint_start;
-		level = level + hint_start;
+	-- level relative to this function
+	if not debug.getinfo(level, "") then
+		return 0;
 	end
-	
-	while true do
-		local info = debug.getinfo(level, "l")
-		if not info then break end
-		level = level + 1;
-		count = count + 1;
-    end
-	return count;
+	-- the frame at lo exists, the one at hi does not
+	local lo = level;
+	if(hint_start and hint_start > 1 and debug.getinfo(level + hint_start - 1, "")) then
+		lo = level + hint_start - 1;
+	end
+	local step = 1;
+	local hi = lo + step;
+	while debug.getinfo(hi, "") do
+		lo = hi;
+		step = step * 2;
+		hi = lo + step;
+	end
+	while hi - lo > 1 do
+		local mid = floor((lo + hi) / 2);
+		if debug.getinfo(mid, "") then
+			lo = mid;
+		else
+			hi = mid;
+		end
+	end
+	return hi - level;
 end
 
 -- get all function, lines on the stack. 
+-- @param count: nil or the max number of frames to get
 -- @return array of {source, short_src, currentline, what, namewhat, }
-local function do_stackwalk(level)
+local function do_stackwalk(level, count)
 	local stackwalk_info = {};
     level = level or 1
-    while true do
+    while not count or #stackwalk_info < count do
 		local info = debug.getinfo(level, "nSl")
 		if not info then break end
 		stackwalk_info[#stackwalk_info+1] = info;
@@ -729,16 +1925,48 @@ local function debug_hook(event, line)
 	if event == "call" then
 		stack_level = stack_level + 1
 		--echo({"call", stack_level})
+		if scoped_line_hook then
+			-- C functions keep the mask of their caller, since luajit has no return hook for them. 
+			local bHasBreakpoint = function_has_breakpoint(level);
+			if bHasBreakpoint ~= nil then
+				set_line_hook(step_into or step_over or bHasBreakpoint);
+			end
+		elseif selective_jit then
+			function_has_breakpoint(level);
+		end
+		if step_into and selective_jit then
+			local info = debug.getinfo(level, "Sf");
+			if(info and info.what ~= "C") then
+				jit_off_function(info.func, "step");
+			end
+		end
 	elseif event == "return" or event == "tail return" then
 		stack_level = stack_level - 1
+		if scoped_line_hook then
+			-- the function that we return to
+			local bHasBreakpoint = function_has_breakpoint(level + 1);
+			if bHasBreakpoint ~= nil then
+				set_line_hook(step_into or step_over or bHasBreakpoint);
+			end
+		else
+			frame_lines = nil;
+		end
 
 		--echo({"return", stack_level})
 		--if stack_level < 0 then stack_level = 0 end
 	else
-		-- TODO: debug.getinfo return a new table each time, we should use a C function that return source directly. 
-		local file = strlower(debug.getinfo(2, "S").source);
-		if string.find(file, "@") == 1 then
-			file = string.sub(file, 2)
+		-- the breakpoint lines of the running function are known from the last call or return event. Otherwise most lines have no breakpoint 
+		-- on any file, so the source is only looked up if there is one on this line number. debug.getinfo returns a new table each time. 
+		local bp;
+		if not (step_into or step_over) then
+			if frame_lines and line >= frame_first and line <= frame_last then
+				bp = frame_lines[line];
+			elseif breakpoints[line] then
+				bp = source_breakpoints[debug.getinfo(level, "S").source][line];
+			end
+			if not bp then
+				return
+			end
 		end
 
 		local ev = events.STEP
@@ -746,23 +1974,29 @@ local function debug_hook(event, line)
 		--echo({step_into= step_into, step_over=step_over, stack_level=stack_level, step_level=step_level})
 		if(step_over and is_luajit) then
 			if(stack_level > step_level) then
-				-- luajit does not have "tail return" hook for C function, we need to correct stack_level.
-				-- this will slow the execution, so we need to correct it here for step_over event only. 
-				stack_level = IPCDebugger.GetStackLevel(level + 1, step_level);
+				-- luajit does not have "tail return" hook for C function, so stack_level may be larger than the real one. 
+				-- Instead of counting the stack on every line, we only check if there is a frame step_level levels above this function: 
+				-- if there is none, the stack is no deeper than where the step started. The real level is counted once we break. 
+				if not debug.getinfo(level + step_level, "") then
+					stack_level = step_level;
+				end
 			end
 		end
 
 		if step_into or (step_over and stack_level <= step_level)then
 			step_into = false
 			step_over = false
-		elseif(has_breakpoint(file, line)) then
-			ev = events.BREAK;
 		else
-			return  
+			bp = bp or source_breakpoints[debug.getinfo(level, "S").source][line];
+			if not (bp and check_condition(bp, level)) then
+				return
+			end
+			ev = events.BREAK;
 		end
 		local vars, idx = nil, 0;
-		-- Enter Break Mode, since there is no watches, we will only capture vars after a break point is met. This greatly improves debug_hook speed at run mode. 
-		local vars,file,line = capture_vars(level,1,line)
+		-- Enter Break Mode. Variables are not captured until a command needs them, see get_eval_env(), 
+		-- and the debug engine only lists those of the frames that visual studio shows with "framevars". 
+		local file = get_frame_file(level)
 		
 		--local stop, ev, idx = false, events.STEP, 0
 		--while true do
@@ -794,13 +2028,29 @@ local function debug_hook(event, line)
 		-- tracestack(level)
 
 		local last_next = 1
-		local stacks = do_stackwalk(level+1);
+		local stacks;
+		if stack_page then
+			-- the debug engine fetches the other frames with "stackrange" if it needs them
+			stacks = do_stackwalk(level+1, stack_page);
+			stacks.depth = IPCDebugger.GetStackLevel(level+1, #stacks);
+		else
+			stacks = do_stackwalk(level+1);
+			stacks.depth = #stacks;
+		end
 		-- fix stack level, since luajit has no tail return for C functions.
-		stack_level = #stacks;
+		stack_level = stacks.depth;
+		stop_depth = stacks.depth;
 		local err, next = coroutine.resume(coro_debugger, ev, vars, file, line, idx, stacks);
 
 		while true do
 			if next == 'cont' then
+				if selective_jit then
+					if step_into or step_over then
+						jit_off_stack(level);
+					else
+						jit_on_functions("step");
+					end
+				end
 				return
 			elseif next == 'stop' then
 				IPCDebugger.Detach();
@@ -812,7 +2062,18 @@ local function debug_hook(event, line)
 				last_next = next
 				restore_vars(level,vars)
 				vars, file, line = capture_vars(level,next)
-				err, next = coroutine.resume(coro_debugger, events.SET, vars, file, line, idx, do_stackwalk(level+next))
+				-- the stack is not reported for events.SET
+				err, next = coroutine.resume(coro_debugger, events.SET, vars, file, line, idx)
+			elseif type(next) == "table" and next[1] == "stackrange" then
+				-- frames of the stopped stack requested by commands.stackrange, which can not see this stack from the debugger coroutine
+				-- the depth is known for this stop, so the walk does not probe past the last frame
+				err, next = coroutine.resume(coro_debugger, do_stackwalk(level + next[2], math.max(math.min(next[3], stop_depth - next[2] + 1), 0)))
+			elseif type(next) == "table" and next[1] == "framevars" then
+				-- variables of a frame requested by commands.framevars
+				err, next = coroutine.resume(coro_debugger, get_frame_vars(level + next[2]))
+			elseif type(next) == "table" and next[1] == "frameenv" then
+				-- environment of a frame requested by commands.children, which get_frame_env looks up relative to this function
+				err, next = coroutine.resume(coro_debugger, get_frame_env(level + next[2] - 1))
 			else
 				write('Unknown command from debugger_loop: '..tostring(next)..'\n')
 				write('Stopping debugger\n')
@@ -822,9 +2083,37 @@ local function debug_hook(event, line)
 	end
 end
 
+-- install or remove debug_hook. 
+-- @param bEnable: true to install, false to remove. 
+function IPCDebugger.SetHook(bEnable)
+	frame_lines = nil;
+	if(not bEnable) then
+		debug.sethook();
+		if(selective_jit) then
+			selective_jit = false;
+			jit_on_functions();
+		end
+		return
+	end
+	scoped_line_hook = IPCDebugger.scoped_line_hook;
+	if(is_luajit) then
+		if(IPCDebugger.selective_jit) then
+			if(not selective_jit) then
+				selective_jit = true;
+				-- compiled code that has inlined functions with breakpoints never calls the hook
+				jit.flush();
+			end
+		else
+			IPCDebugger.TurnOffJit();
+		end
+	end
+	-- line events are hooked until the next call or return decides for the running function
+	debug.sethook(debug_hook, "lcr");
+end
+
 -- whenever a stopping event occurs
+-- vars is nil until a command needs the variables, see get_eval_env(). 
 local function report(ev, vars, file, line, idx_watch, stack_info)
-  local vars = vars or {}
   local file = file or '?'
   local line = line or 0
   local prefix = ''
@@ -853,317 +2142,475 @@ local function report(ev, vars, file, line, idx_watch, stack_info)
   return vars, file, line
 end
 
--- this is the coroutine main loop when process is paused, we will wait on messages from the debugger IDE. 
-local function debugger_loop(ev, vars, file, line, idx_watch, stack_info)
-	write("NPL debugger_loop started\n")
-	local eval_env, breakfile, breakline = report(ev, vars, file, line, idx_watch, stack_info)
+-- commands handled in break mode by debugger_loop, mapping from message name to function(ctx, msg). 
+-- ctx is {eval_env, breakfile, breakline} of the current break, msg is the message received. eval_env is nil until get_eval_env() captures it. 
+-- return 'stop' to leave the debugger loop. 
+local commands = {};
+IPCDebugger.commands = commands;
+-- the same commands indexed by opcode, see opcodes. 
+local opcode_commands = {};
+
+-- get the line and normalized file name of a message whose code is {filename, line}
+local function get_file_line(msg)
+	local params = msg.code;
+	if(type(params) == "table") then
+		return NormalizeFileName(params.filename), params.line;
+	end
+end
 
-	local command, params, args;
+-- resume the debuggee and wait for the next break
+local function resume(ctx, ...)
+	if (...) == 'cont' then
+		release_handles()
+	end
+	ctx.eval_env, ctx.breakfile, ctx.breakline = report(coroutine.yield(...))
+end
 
-	while true do
-	write("[DEBUG]> ")
-	local msg_in = IPCDebugger.WaitForDebugEvent();
+-- the variables of the current level, which are captured on first use, since most breaks are never inspected. 
+local function get_eval_env(ctx)
+	if not ctx.eval_env then
+		resume(ctx, 0)
+	end
+	return ctx.eval_env
+end
 
-	if(not msg_in) then
-		command = "exit"
+-- set breakpoint
+function commands.setb(ctx, msg)
+	local filename, line = get_file_line(msg);
+	if filename and line then
+		local params = msg.code;
+		set_breakpoint(filename, line, new_condition(params.cond, params.passcount_style, params.passcount, params.log))
+		write("Breakpoint set in file "..filename..' line '..line..'\n')
 	else
-		command = msg_in.filename;
+		write("Bad request\n")
 	end
-
-	local line, filename;
-	local param1, param2 = msg_in.param1, msg_in.param2;
-	params = msg_in.code;
-	if(type(params) == "table") then
-		line = params.line;
-		filename = NormalizeFileName(params.filename);
+end
+commands["break"] = commands.setb;
+commands.b = commands.setb;
+
+-- delete breakpoint
+function commands.delb(ctx, msg)
+	local filename, line = get_file_line(msg);
+	if filename and line then
+		remove_breakpoint(filename, line)
+		write("Breakpoint deleted from file "..filename..' line '..line.."\n")
+	else
+		write("Bad request\n")
 	end
+end
 
-	if command == "setb" or command=="break" or command=="b" then
-		-- set breakpoint
-		if filename and line then
-			set_breakpoint(filename,line)
-			write("Breakpoint set in file "..filename..' line '..line..'\n')
-		else
-			write("Bad request\n")
+-- frames of the stopped stack after the ones sent in "BP", see IPCDebugger.SelectStackPage(). 
+-- @param msg: param1 is the request id, and code is {from = index of the first frame starting from 1, count = max number of frames}
+function commands.stackrange(ctx, msg)
+	local params = type(msg.code) == "table" and msg.code or {};
+	local from = math.max(tonumber(params.from) or 1, 1);
+	local count = math.max(tonumber(params.count) or 0, 0);
+	local stack_info = coroutine.yield({"stackrange", from, count});
+	IPCDebugger.WriteStackFrames(msg.param1 or 0, from, stack_info);
+end
+
+-- locals and upvalues of a frame of the stopped stack, which the debug engine only asks for when visual studio shows them. 
+-- @param msg: param1 is the request id, and code is {level = index of the frame starting from 1}
+function commands.framevars(ctx, msg)
+	local params = type(msg.code) == "table" and msg.code or {};
+	local level = math.max(tonumber(params.level) or 1, 1);
+	local vars = coroutine.yield({"framevars", level});
+	IPCDebugger.WriteFrameVars(msg.param1 or 0, vars);
+end
+
+-- batched breakpoint changes
+function commands.setbs(ctx, msg)
+	local nAdded, nRemoved = apply_breakpoints(msg.code);
+	write(string.format("%d breakpoints set, %d deleted\n", nAdded, nRemoved))
+end
+
+-- delete all breakpoints
+function commands.delallb(ctx, msg)
+	breakpoints = {}
+	on_breakpoints_changed();
+	write('All breakpoints deleted\n')
+end
+
+-- list breakpoints
+function commands.listb(ctx, msg)
+	for i, v in pairs(breakpoints) do
+		for ii, vv in pairs(v) do
+			write("Break at: "..i..' in '..ii..'\n')
 		end
-	  
-	elseif command == "delb" then
-		-- delete breakpoint
+	end
+end
+
+-- set watch expression
+function commands.setw(ctx, msg)
+	local params = msg.code;
+	if type(params) == "table" and params.exp then
+		local func = loadstring("return(" .. params.exp.. ")")
+		local newidx = #watches + 1
+		watches[newidx] = {func = func, exp = params.exp}
+		write("Set watch exp no. " .. newidx..'\n')
+	else
+		write("Bad request\n")
+	end
+end
+
+-- delete watch expression
+function commands.delw(ctx, msg)
+	local index = msg.param1
+	if index then
+		watches[index] = nil
+		write("Watch expression deleted\n")
+	else
+		write("Bad request\n")
+	end
+end
+
+--  delete all watch expressions
+function commands.delallw(ctx, msg)
+	watches = {}
+	write('All watch expressions deleted\n')
+end
+
+--list watch expressions
+function commands.listw(ctx, msg)
+	for i, v in pairs(watches) do
+		write("Watch exp. " .. i .. ": " .. v.exp..'\n')
+	end
+end
+
+-- run until breakpoint
+function commands.continue(ctx, msg)
+	step_into = false
+	step_over = false
+	resume(ctx, 'cont')
+end
+commands.run = commands.continue;
+commands.r = commands.continue;
+
+-- step N lines (into functions)
+function commands.step(ctx, msg)
+	local N = msg.param1;
+	if(N == 0) then N = 1 end
+	step_over  = false
+	step_into  = true
+	step_lines = N
+	resume(ctx, 'cont')
+end
+commands.s = commands.step;
+
+-- step N lines (over functions)
+function commands.over(ctx, msg)
+	local N = msg.param1;
+	if(N == 0) then N = 1 end
+	step_into  = false
+	step_over  = true
+	step_lines = N
+	step_level = stack_level
+	resume(ctx, 'cont')
+end
+commands.next = commands.over;
+commands.n = commands.over;
+
+-- step N lines (out of functions)
+function commands.out(ctx, msg)
+	local N = msg.param1;
+	if(N == 0) then N = 1 end
+	step_into  = false
+	step_over  = true
+	step_lines = 1
+	step_level = stack_level - tonumber(N or 1)
+	resume(ctx, 'cont')
+end
 
-		if filename and line then
-			remove_breakpoint(filename, line)
-			write("Breakpoint deleted from file "..filename..' line '..line.."\n")
+-- step until reach line
+commands["goto"] = function(ctx, msg)
+	local N = msg.param1;
+	if(N == 0) then N = 1 end
+	if N then
+		step_over  = false
+		step_into  = false
+		if has_breakpoint(ctx.breakfile,N) then
+			resume(ctx, 'cont')
 		else
-			write("Bad request\n")
-		end
-
-	elseif command == "delallb" then
-		-- delete all breakpoints
-		breakpoints = {}
-		write('All breakpoints deleted\n')
-	  
-	elseif command == "listb" then
-		-- list breakpoints
-		for i, v in pairs(breakpoints) do
-			for ii, vv in pairs(v) do
-				write("Break at: "..i..' in '..ii..'\n')
+			local bf = ctx.breakfile
+			set_breakpoint(ctx.breakfile,N)
+			resume(ctx, 'cont')
+			if ctx.breakfile == bf and ctx.breakline == N then 
+				remove_breakpoint(ctx.breakfile,N) 
 			end
 		end
+	else
+		write("Bad request\n")
+	end
+end
 
-	elseif command == "setw" then
-		-- set watch expression
-		if params.exp then
-			local func = loadstring("return(" .. params.exp.. ")")
-			local newidx = #watches + 1
-			watches[newidx] = {func = func, exp = params.exp}
-			write("Set watch exp no. " .. newidx..'\n')
-		else
-			write("Bad request\n")
-		end
-	  
-	elseif command == "delw" then
-		-- delete watch expression
-		local index = param1
-		if index then
-			watches[index] = nil
-			write("Watch expression deleted\n")
-		else
-			write("Bad request\n")
-		end
-
-	elseif command == "delallw" then
-		--  delete all watch expressions
-		watches = {}
-		write('All watch expressions deleted\n')
-
-	elseif command == "listw" then
-		--list watch expressions
-		for i, v in pairs(watches) do
-			write("Watch exp. " .. i .. ": " .. v.exp..'\n')
-		end
-	  
-	elseif command == "run" or command == "continue" or command == "r" then
-		-- run until breakpoint
-		step_into = false
-		step_over = false
-		eval_env, breakfile, breakline = report(coroutine.yield('cont'))
-
-	elseif command == "step" or command == "s" then
-		-- step N lines (into functions)
-		local N = param1;
-		if(N == 0) then N = 1 end
-		step_over  = false
-		step_into  = true
-		step_lines = N
-		eval_env, breakfile, breakline = report(coroutine.yield('cont'))
-
-	elseif command == "over" or command=="next" or command=="n" then
-		-- step N lines (over functions)
-		local N = param1;
-		if(N == 0) then N = 1 end
-		step_into  = false
-		step_over  = true
-		step_lines = N
-		step_level = stack_level
-		eval_env, breakfile, breakline = report(coroutine.yield('cont'))
-	  
-	elseif command == "out" then
-		-- step N lines (out of functions)
-		local N = param1;
-		if(N == 0) then N = 1 end
-		step_into  = false
-		step_over  = true
-		step_lines = 1
-		step_level = stack_level - tonumber(N or 1)
-		eval_env, breakfile, breakline = report(coroutine.yield('cont'))
-
-	elseif command == "goto" then
-		-- step until reach line
-		local N = param1;
-		if(N == 0) then N = 1 end
-		if N then
-			step_over  = false
-			step_into  = false
-			if has_breakpoint(breakfile,N) then
-				eval_env, breakfile, breakline = report(coroutine.yield('cont'))
+-- set/show context level
+function commands.set(ctx, msg)
+	local level = msg.param1
+	if level~=0 then
+		resume(ctx, level)
+	end
+	local eval_env = get_eval_env(ctx)
+	if eval_env.__VARSLEVEL__ then
+		write('Level: '..eval_env.__VARSLEVEL__..'\n')
+	else
+		write('No level set\n')
+	end
+end
+
+-- list context variables
+function commands.vars(ctx, msg)
+	local depth = msg.param1
+	if(depth == 0) then depth = 1 end
+	dumpvar(get_eval_env(ctx), depth+1, 'variables')
+end
+
+-- list global variables
+function commands.glob(ctx, msg)
+	local depth = msg.param1
+	if(depth == 0) then depth = 1 end
+	dumpvar(get_eval_env(ctx).__GLOBALS__,depth+1,'globals')
+end
+
+-- list function environment variables
+function commands.fenv(ctx, msg)
+	local depth = msg.param1
+	if(depth == 0) then depth = 1 end
+	dumpvar(get_eval_env(ctx).__ENVIRONMENT__,depth+1,'environment')
+end
+
+-- list upvalue names
+function commands.ups(ctx, msg)
+	dumpvar(get_eval_env(ctx).__UPVALUES__,2,'upvalues')
+end
+
+-- list locals names
+function commands.locs(ctx, msg)
+	dumpvar(get_eval_env(ctx).__LOCALS__,2,'upvalues')
+end
+
+-- show where a function is defined
+function commands.what(ctx, msg)
+	local args = msg.args
+	if args and args ~= '' then
+		local v = get_eval_env(ctx)
+		local n = nil
+		for w in string.gmatch(args,"[%w_]+") do
+			v = v[w]
+			if n then n = n..'.'..w else n = w end
+			if not v then break end
+		end
+		if type(v) == 'function' then
+			local def = debug.getinfo(v,'S')
+			if def then
+				write(def.what..' in '..def.short_src..' '..def.linedefined..'..'..def.lastlinedefined..'\n')
 			else
-				local bf = breakfile
-				set_breakpoint(breakfile,N)
-				eval_env, breakfile, breakline = report(coroutine.yield('cont'))
-				if breakfile == bf and breakline == N then 
-					remove_breakpoint(breakfile,N) 
-				end
+				write('Cannot get info for '..v..'\n')
 			end
 		else
-			write("Bad request\n")
+			write(tostring(v)..' is not a function\n')
 		end
+	else
+		write("Bad request\n")
+	end
+end
 
-	elseif command == "set" then
-		-- set/show context level
-		local level = param1
-		if level~=0 then
-			eval_env, breakfile, breakline = report(coroutine.yield(level))
-		end
-		if eval_env.__VARSLEVEL__ then
-			write('Level: '..eval_env.__VARSLEVEL__..'\n')
+-- get the value of a variable name or a dotted path such as "a.b.1". 
+-- @param env: the environment of the first name, such as get_eval_env(ctx)
+-- @return the value, or nil if a part of the path is not found
+local function get_path_value(env, name)
+	local v = env
+	for w in string.gmatch(name,"[^%.]+") do     --get everything between dots
+		if type(v) ~= 'table' then return nil end
+		v = v[tonumber(w) or w]
+	end
+	return v
+end
+
+-- children of a value listed in this break, or the value of a variable, for the locals and watch windows. 
+-- Only a page of children is sent, so that expanding a large table never sends the whole table. 
+-- @param msg: param1 is the request id, and code is {handle, from = index of the first child starting from 1, count = max number of children}, 
+--  or {name = variable name or dotted path, level = nil or index of the frame starting from 1}, in which case the value itself is listed. 
+--  The name is looked up in the locals and upvalues of the frame at level, or in the current level of "set" if level is nil. 
+function commands.children(ctx, msg)
+	local params = type(msg.code) == "table" and msg.code or {};
+	if params.name then
+		local env;
+		if tonumber(params.level) then
+			env = coroutine.yield({"frameenv", math.max(tonumber(params.level), 1)});
 		else
-			write('No level set\n')
-		end
-	  
-	elseif command == "vars" then
-		-- list context variables
-		local depth = param1
-		if(depth == 0) then depth = 1 end
-		dumpvar(eval_env, depth+1, 'variables')
-
-	elseif command == "glob" then
-		-- list global variables
-		local depth = param1
-		if(depth == 0) then depth = 1 end
-		dumpvar(eval_env.__GLOBALS__,depth+1,'globals')
-
-	elseif command == "fenv" then
-		-- list function environment variables
-		local depth = param1
-		if(depth == 0) then depth = 1 end
-		dumpvar(eval_env.__ENVIRONMENT__,depth+1,'environment')
-	  
-	elseif command == "ups" then
-		-- list upvalue names
-		dumpvar(eval_env.__UPVALUES__,2,'upvalues')
-
-	elseif command == "locs" then
-		-- list locals names
-		dumpvar(eval_env.__LOCALS__,2,'upvalues')
-
-	elseif command == "what" then
-	  -- show where a function is defined
-		if args and args ~= '' then
-			local v = eval_env
-			local n = nil
-			for w in string.gmatch(args,"[%w_]+") do
-				v = v[w]
-				if n then n = n..'.'..w else n = w end
-				if not v then break end
-			end
-			if type(v) == 'function' then
-				local def = debug.getinfo(v,'S')
-				if def then
-					write(def.what..' in '..def.short_src..' '..def.linedefined..'..'..def.lastlinedefined..'\n')
-				else
-					write('Cannot get info for '..v..'\n')
-				end
+			env = get_eval_env(ctx);
+		end
+		IPCDebugger.WriteChildren(msg.param1 or 0, {{"value", params.name, get_path_value(env, params.name)}}, 1, 1);
+	else
+		local from = math.max(tonumber(params.from) or 1, 1);
+		local count = math.max(tonumber(params.count) or 0, 0);
+		local children, total = get_children(tonumber(params.handle) or 0, from, count);
+		IPCDebugger.WriteChildren(msg.param1 or 0, children, from, total);
+	end
+end
+
+--  dump a variable
+function commands.dump(ctx, msg)
+	local params = msg.code;
+	local name, depth = params.name, params.depth
+	if name ~= '' then
+		if depth == '' or depth == 0 then depth = nil end
+		depth = tonumber(depth or 1)
+		local v = get_eval_env(ctx)
+		local n = nil
+		for w in string.gmatch(name,"[^%.]+") do     --get everything between dots
+			if tonumber(w) then
+				v = v[tonumber(w)]
 			else
-				write(tostring(v)..' is not a function\n')
+				v = v[w]
 			end
-		else
-			write("Bad request\n")
-		end
-
-	elseif command == "dump" or command=="print" or command=="p" then
-		--  dump a variable
-		local name, depth = params.name, params.depth
-		if name ~= '' then
-			if depth == '' or depth == 0 then depth = nil end
-			depth = tonumber(depth or 1)
-			local v = eval_env
-			local n = nil
-			for w in string.gmatch(name,"[^%.]+") do     --get everything between dots
-				if tonumber(w) then
-					v = v[tonumber(w)]
-				else
-					v = v[w]
+			if n then n = n..'.'..w else n = w end
+			if not v then break end
+		end
+		dumpvar(v,depth+1,n)
+	else
+		write("Bad request\n")
+	end
+end
+commands.print = commands.dump;
+commands.p = commands.dump;
+
+--  show file around a line or the current breakpoint
+function commands.show(ctx, msg)
+	local params = msg.code;
+	local line, file, before, after = params.line, params.file, params.before, params.after;
+	if before == 0 then before = 10     end
+	if after  == 0 then after  = before end
+	
+	if file ~= '' and file ~= "=stdin" then
+		show(file,line,before,after)
+	else
+		write('Nothing to show\n')
+	end
+end
+commands.list = commands.show;
+commands.l = commands.show;
+
+-- turn pause command off
+function commands.poff(ctx, msg)
+	pause_off = true
+end
+
+-- turn pause command on
+function commands.pon(ctx, msg)
+	pause_off = false
+end
+
+-- turn tracing on/off
+function commands.tron(ctx, msg)
+	local option = getargs('S')
+	trace_calls   = false
+	trace_returns = false
+	trace_lines   = false
+	if strfind(option,'c') then trace_calls   = true end
+	if strfind(option,'r') then trace_returns = true end
+	if strfind(option,'l') then trace_lines   = true end
+end
+
+-- dump a stack trace
+function commands.trace(ctx, msg)
+	trace(ctx.eval_env and ctx.eval_env.__VARSLEVEL__ or 1)
+end
+commands.bt = commands.trace;
+commands.backtrace = commands.trace;
+
+-- dump all debug info captured
+function commands.info(ctx, msg)
+	info()
+end
+
+-- output acknowledged in break mode
+function commands.OutputAck(ctx, msg)
+	Handlers.OutputAck(msg.type, msg.param1, msg.param2, msg.code);
+end
+
+-- not allowed in here
+function commands.pause(ctx, msg)
+	write('pause() should only be used in the script you are debugging\n')
+end
+
+-- exit debugger
+function commands.exit(ctx, msg)
+	return 'stop'
+end
+commands.finish = commands.exit;
+commands.f = commands.exit;
+commands.Detach = commands.exit;
+
+-- exec code in current location
+function commands.exec(ctx, msg)
+	local params = msg.code;
+	local code;
+	if(type(params) == "table") then
+		code = params.name
+	else	
+		code = params
+	end
+	local ok, func = pcall(loadstring,code)
+	if func == nil then
+		IPCDebugger.Dump("Compile error: "..tostring(code)..'\n')
+	elseif not ok then
+		IPCDebugger.Dump("Compile error: "..func..'\n')
+	else
+		setfenv(func, get_eval_env(ctx))
+		local res = {pcall(func)}
+		if res[1] then
+			if res[2] then
+				table.remove(res,1)
+				for _,v in ipairs(res) do
+					IPCDebugger.Dump(tostring(v))
+					IPCDebugger.Dump('\t')
 				end
-				if n then n = n..'.'..w else n = w end
-				if not v then break end
+				IPCDebugger.Dump('\n')
+			else	
+				IPCDebugger.Dump('NPL Expression executed without return value\n');
 			end
-			dumpvar(v,depth+1,n)
+			--update in the context
+			resume(ctx, 0)
 		else
-			write("Bad request\n")
+		  IPCDebugger.Dump("Run error: "..res[2]..'\n')
 		end
+	end
+end
 
-	elseif command == "show" or command=="list" or command=="l" then
-		--  show file around a line or the current breakpoint
-		local line, file, before, after = params.line, params.file, params.before, params.after;
-		if before == 0 then before = 10     end
-		if after  == 0 then after  = before end
-		
-		if file ~= '' and file ~= "=stdin" then
-			show(file,line,before,after)
-		else
-			write('Nothing to show\n')
-		end
-
-	elseif command == "poff" then
-		-- turn pause command off
-		pause_off = true
-	  
-	elseif command == "pon" then
-		-- turn pause command on
-		pause_off = false
-	  
-	elseif command == "tron" then
-		-- turn tracing on/off
-		local option = getargs('S')
-		trace_calls   = false
-		trace_returns = false
-		trace_lines   = false
-		if strfind(option,'c') then trace_calls   = true end
-		if strfind(option,'r') then trace_returns = true end
-		if strfind(option,'l') then trace_lines   = true end
-
-	elseif command == "trace" or command=="bt" or command=="backtrace" then
-		-- dump a stack trace
-		trace(eval_env.__VARSLEVEL__)
-
-	elseif command == "info" then
-		-- dump all debug info captured
-		info()
-	  
-	elseif command == "pause" then
-		-- not allowed in here
-		write('pause() should only be used in the script you are debugging\n')
-
-	elseif command == "exit" or command=="finish" or command=="f" or command=="Detach" then
-		-- exit debugger
-		return 'stop'
-
-	elseif command == 'exec' then
-	  -- exec code in current location
-		local code;
-		if(type(params) == "table") then
-			code = params.name
-		else	
-			code = params
-		end
-		local ok, func = pcall(loadstring,code)
-		if func == nil then
-			IPCDebugger.Dump("Compile error: "..line..'\n')
-		elseif not ok then
-			IPCDebugger.Dump("Compile error: "..func..'\n')
+for name, op in pairs(opcodes) do
+	opcode_commands[op] = commands[name];
+end
+
+-- this is the coroutine main loop when process is paused, we will wait on messages from the debugger IDE. 
+local function debugger_loop(ev, vars, file, line, idx_watch, stack_info)
+	write("NPL debugger_loop started\n")
+	local ctx = {};
+	ctx.eval_env, ctx.breakfile, ctx.breakline = report(ev, vars, file, line, idx_watch, stack_info)
+
+	while true do
+		write("[DEBUG]> ")
+		local msg_in = IPCDebugger.WaitForDebugEvent();
+
+		local command;
+		if(not msg_in) then
+			command = commands.exit;
+			msg_in = {};
 		else
-			setfenv(func, eval_env)
-			local res = {pcall(func)}
-			if res[1] then
-				if res[2] then
-					table.remove(res,1)
-					for _,v in ipairs(res) do
-						IPCDebugger.Dump(tostring(v))
-						IPCDebugger.Dump('\t')
-					end
-					IPCDebugger.Dump('\n')
-				else	
-					IPCDebugger.Dump('NPL Expression executed without return value\n');
-				end
-				--update in the context
-				eval_env, breakfile, breakline = report(coroutine.yield(0))
-			else
-			  IPCDebugger.Dump("Run error: "..res[2]..'\n')
-			end
+			-- messages from older debug engines do not have an opcode
+			command = opcode_commands[msg_in.type] or commands[msg_in.filename];
 		end
+		local op = msg_in.type;
+		if(op == opcodes.dump or op == opcodes.exec or msg_in.filename == "dump" or msg_in.filename == "exec") then
+			-- param1 is the request id that should be echoed in the reply
+			IPCDebugger.BeginReply(msg_in.param1);
+		end
+		if(command and command(ctx, msg_in) == 'stop') then
+			release_handles()
+			return 'stop'
+		end
+		IPCDebugger.EndReply();
 	end
-	end
-
 end
 
 --
@@ -1192,7 +2639,7 @@ function IPCDebugger.pause(x)
     step_lines = lines
     step_into  = true
     started    = true
-    debug.sethook(debug_hook, "lcr")         --NB: this will cause an immediate entry to the debugger_loop
+    IPCDebugger.SetHook(true)         --NB: this will cause an immediate entry to the debugger_loop
   end
 end
 
@@ -1214,19 +2661,23 @@ function IPCDebugger.TurnOffJit()
 end
 
 -- start the debug hook but does not pause.
-function IPCDebugger.Attach()
+-- @param filestore: nil or the file id table selected by IPCDebugger.SelectFileStore(). 
+function IPCDebugger.Attach(filestore)
 	log("NPL debugger attached\n")
 	
-	if(jit and jit.version) then
+	if(is_luajit and not IPCDebugger.selective_jit) then
 		IPCDebugger.TurnOffJit();
 		IPCDebugger.WriteDebugOutput("NPL debugger WARNING: please turn off luajit at very beginning for accurate debugging\n");
 	end
 		
 	log("NPL debugger src directory:"..IPCDebugger.GetSourceDirectory().."\n")
 
-	IPCDebugger.Write({filename="Attached", type=debug_events_enum.ATTACHED, code = {
+	IPCDebugger.Write({filename="Attached", type=opcodes.Attached, code = {
 		desc = "NPL debugger 2.0 attached\n",
 		workingdir = IPCDebugger.GetSourceDirectory(),
+		bpformat = bp_format,
+		states = IPCDebugger.GetDebugStates(),
+		filestore = filestore,
 	}});
 	
 	if(not started) then
@@ -1238,7 +2689,7 @@ function IPCDebugger.Attach()
 		step_lines = 0;
 		started = true;
 		
-		debug.sethook(debug_hook, "lcr")         --NB: this will cause an immediate entry to the debugger_loop
+		IPCDebugger.SetHook(true)         --NB: this will cause an immediate entry to the debugger_loop
 	end
 end
 
@@ -1247,13 +2698,17 @@ function IPCDebugger.Detach()
 	log("NPL debugger detached\n")
 	if(started) then
 		started = false;
-		debug.sethook() 
+		IPCDebugger.SetHook(false);
 		
 		-- remove all break points
 		breakpoints = {};
+		on_breakpoints_changed();
 	end
 	-- send back to confirm detach. 
-	IPCDebugger.Write({filename="Detach"});
+	IPCDebugger.Write({filename="Detach", type=opcodes.Detach});
+	IPCDebugger.SelectBreakpointFormat(nil);
+	IPCDebugger.SelectStackPage(nil);
+	IPCDebugger.SelectOutputAck(nil);
 end
 
 --shows the value of the given variable, only really useful
@@ -1272,8 +2727,13 @@ debug.traceback = function(x)
   return assertmsg                       --carry on
 end
 
--- this one is solely for testing
+-- it receives the registration of other NPL states being debugged, the rest is solely for testing
 local function activate()
+	if(type(msg) == "table" and msg.debug_queue) then
+		-- another NPL state started its debug engine, see IPCDebugger.StartDebugEngine()
+		IPCDebugger.OnStateStarted(msg.debug_state, msg.debug_queue);
+		return
+	end
 	if(main_state == nil) then
 		-- only for testing
 		main_state = 0;
@@ -0,0 +1,230 @@
+--[[
+Title: socket transport of the IPC debugger
+Date: 2026/10/17
+Desc: a TCP listener that carries IPC debugger messages, so that visual studio can debug NPL processes on another machine, such as headless linux servers.
+It has the same try_send/try_receive/receive methods as ParaIPCQueue, so that IPCDebugger uses it in place of its IPC queues.
+- start the process with debugtransport="tcp://*:8099", and set the environment variable NPL_DEBUG_TRANSPORT=tcp://servername:8099 of visual studio.
+- each message is framed as uint32 size + the layout of NPLEncodeMessage() of the debug engine worker:
+	int32 type, int32 param1, int32 param2, followed by method, from, filename, code, each as uint32 length + bytes. All integers are little endian.
+- Nagle's algorithm is disabled, so that small control messages such as "step" are sent immediately.
+- only one debug engine is connected at a time, a new connection replaces the old one.
+It requires LuaSocket.
+Use Lib:
+-------------------------------------------------------
+NPL.load("(gl)script/ide/Debugger/IPCSocketTransport.lua");
+local transport = IPCDebugger.SocketTransport:new("*", 8099);
+local out_msg = {};
+if(transport and transport:try_receive(out_msg) == 0) then
+	commonlib.echo(out_msg);
+end
+-------------------------------------------------------
+]]
+local SocketTransport = commonlib.gettable("IPCDebugger.SocketTransport");
+SocketTransport.__index = SocketTransport;
+
+local strchar = string.char
+local strbyte = string.byte
+local strsub = string.sub
+local floor = math.floor
+
+-- LuaSocket module, false if not available
+local socket_lib;
+
+-- whether LuaSocket is available in the host runtime
+function SocketTransport.IsAvailable()
+	if(socket_lib == nil) then
+		local bLoaded, lib = pcall(require, "socket");
+		socket_lib = bLoaded and lib or false;
+	end
+	return socket_lib ~= false;
+end
+
+-- listen for the debug engine.
+-- @param host: the address to bind, "*" for all interfaces.
+-- @param port: the port number
+-- @return nil if LuaSocket is not available or the port can not be bound.
+function SocketTransport:new(host, port)
+	if(not SocketTransport.IsAvailable()) then
+		commonlib.log("IPC debugger: LuaSocket is not available for socket transport\n");
+		return
+	end
+	local server, err = socket_lib.bind(host or "*", port);
+	if(not server) then
+		commonlib.log("IPC debugger: can not listen on %s:%s: %s\n", tostring(host), tostring(port), tostring(err));
+		return
+	end
+	server:settimeout(0);
+	local o = {server = server, recv_buffer = ""};
+	setmetatable(o, self);
+	return o;
+end
+
+-- accept a pending connection of the debug engine.
+-- @param timeout: 0 to poll, nil to block
+-- @return true if connected
+function SocketTransport:Accept(timeout)
+	self.server:settimeout(timeout);
+	local client = self.server:accept();
+	self.server:settimeout(0);
+	if(client) then
+		self:Close();
+		client:setoption("tcp-nodelay", true);
+		self.client = client;
+	end
+	return self.client ~= nil;
+end
+
+-- close the current connection, the listener is kept.
+function SocketTransport:Close()
+	if(self.client) then
+		self.client:close();
+		self.client = nil;
+	end
+	self.recv_buffer = "";
+end
+
+local function encode_int32(n)
+	n = floor(tonumber(n) or 0) % 4294967296;
+	return strchar(n % 256, floor(n / 256) % 256, floor(n / 65536) % 256, floor(n / 16777216));
+end
+
+-- @return the signed value, or nil if the buffer is truncated
+local function decode_int32(s, pos)
+	local b1, b2, b3, b4 = strbyte(s, pos, pos + 3);
+	if(not b4) then
+		return
+	end
+	local n = b1 + b2 * 256 + b3 * 65536 + b4 * 16777216;
+	if(n >= 2147483648) then
+		n = n - 4294967296;
+	end
+	return n;
+end
+
+local function encode_string(s)
+	s = s or "";
+	return encode_int32(#s)..s;
+end
+
+-- @return the string and the position after it, or nil if the buffer is truncated
+local function decode_string(s, pos)
+	local size = decode_int32(s, pos);
+	if(not size or size < 0 or pos + 3 + size > #s) then
+		return
+	end
+	return strsub(s, pos + 4, pos + 3 + size), pos + 4 + size;
+end
+
+local function encode_message(msg)
+	local code = msg.code;
+	if(type(code) == "table") then
+		-- the same as the NPL text table sent by ParaIPCQueue
+		code = "msg="..commonlib.serialize_compact(code);
+	elseif(code ~= nil) then
+		code = tostring(code);
+	end
+	local body = table.concat({encode_int32(msg.type), encode_int32(msg.param1), encode_int32(msg.param2),
+		encode_string(msg.method), encode_string(msg.from), encode_string(msg.filename), encode_string(code)});
+	return encode_int32(#body)..body;
+end
+
+-- @return true if the frame is well formed
+local function decode_message(frame, out_msg)
+	local pos = 13;
+	local method, from, filename, code;
+	method, pos = decode_string(frame, pos);
+	if(pos) then from, pos = decode_string(frame, pos); end
+	if(pos) then filename, pos = decode_string(frame, pos); end
+	if(pos) then code, pos = decode_string(frame, pos); end
+	if(not pos) then
+		return false;
+	end
+	if(strsub(code, 1, 4) == "msg=") then
+		code = NPL.LoadTableFromString(strsub(code, 5)) or code;
+	end
+	out_msg.type = decode_int32(frame, 1);
+	out_msg.param1 = decode_int32(frame, 5);
+	out_msg.param2 = decode_int32(frame, 9);
+	out_msg.method, out_msg.from, out_msg.filename, out_msg.code = method, from, filename, code;
+	return true;
+end
+
+-- read the next frame.
+-- @param timeout: 0 to poll, nil to block until a frame is received.
+-- @return the frame or nil
+function SocketTransport:ReadFrame(timeout)
+	while(true) do
+		local buffer = self.recv_buffer;
+		local needed = 4 - #buffer;
+		if(needed <= 0) then
+			local size = decode_int32(buffer, 1);
+			if(size < 0) then
+				-- broken stream
+				self:Close();
+				return
+			end
+			if(#buffer >= size + 4) then
+				self.recv_buffer = strsub(buffer, size + 5);
+				return strsub(buffer, 5, size + 4);
+			end
+			needed = size + 4 - #buffer;
+		end
+		if(not self.client and not self:Accept(timeout)) then
+			return
+		end
+		self.client:settimeout(timeout);
+		local data, err, partial = self.client:receive(needed);
+		data = data or partial;
+		if(data and #data > 0) then
+			self.recv_buffer = self.recv_buffer..data;
+		end
+		if(err == "closed") then
+			-- wait for the debug engine to connect again
+			self:Close();
+			if(timeout == 0) then
+				return
+			end
+		elseif(err) then
+			return
+		end
+	end
+end
+
+-- send a message without waiting for the connection.
+-- @param msg: the same as ParaIPCQueue:try_send(), except that priority is ignored.
+-- @return 0 if succeed.
+function SocketTransport:try_send(msg)
+	if(not self.client and not self:Accept(0)) then
+		return -1;
+	end
+	self.client:settimeout(nil);
+	local result, err = self.client:send(encode_message(msg));
+	if(not result) then
+		self:Close();
+		return -1;
+	end
+	return 0;
+end
+
+-- @return 0 if a message is read into out_msg
+function SocketTransport:try_receive(out_msg)
+	local frame = self:ReadFrame(0);
+	if(frame and decode_message(frame, out_msg)) then
+		return 0;
+	end
+	return -1;
+end
+
+-- block until a message is read into out_msg.
+-- @return 0 if succeed
+function SocketTransport:receive(out_msg)
+	while(true) do
+		local frame = self:ReadFrame(nil);
+		if(not frame) then
+			return -1;
+		end
+		if(decode_message(frame, out_msg)) then
+			return 0;
+		end
+	end
+end
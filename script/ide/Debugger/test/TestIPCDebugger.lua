@@ -0,0 +1,258 @@
+--[[
+Title: tests of IPCDebugger
+Date: 2026/10/17
+Desc: tests of the breakpoint logic of the debug hook, which run in any NPL state without visual studio. 
+They set and remove breakpoints of a file that does not exist, so do not run them while visual studio is attached. 
+Each test raises an error when it fails. RunAll() runs all of them and logs the failures. 
+Use Lib:
+-------------------------------------------------------
+NPL.load("(gl)script/ide/Debugger/test/TestIPCDebugger.lua");
+IPCDebugger.Test.RunAll();
+-------------------------------------------------------
+]]
+NPL.load("(gl)script/ide/commonlib.lua");
+NPL.load("(gl)script/ide/Debugger/IPCDebugger.lua");
+
+local Test = commonlib.gettable("IPCDebugger.Test");
+
+-- array of {name, func} in the order they run
+local tests = {};
+
+local function add_test(name, func)
+	tests[#tests+1] = {name = name, func = func};
+end
+
+local function check_equal(expected, actual, what)
+	if(expected ~= actual) then
+		error(string.format("%s: expected %s, got %s", what or "value", tostring(expected), tostring(actual)), 2);
+	end
+end
+
+-- run func with IPCDebugger.WriteOutput() and IPCDebugger.WriteDebugOutput() captured
+-- @return array of the output messages
+local function capture_output(func)
+	local output = {};
+	local WriteOutput, WriteDebugOutput = IPCDebugger.WriteOutput, IPCDebugger.WriteDebugOutput;
+	IPCDebugger.WriteOutput = function(msg) output[#output+1] = msg end
+	IPCDebugger.WriteDebugOutput = IPCDebugger.WriteOutput;
+	local bSucceed, err = pcall(func);
+	IPCDebugger.WriteOutput, IPCDebugger.WriteDebugOutput = WriteOutput, WriteDebugOutput;
+	if(not bSucceed) then
+		error(err, 0);
+	end
+	return output;
+end
+
+-- a file that no script is loaded from
+local test_file = "script/ide/debugger/test/nonexistent.lua";
+local test_source = "@Script/IDE/Debugger/test/NonExistent.lua";
+
+add_test("source_breakpoints", function()
+	IPCDebugger.set_breakpoint(test_file, 10);
+	IPCDebugger.set_breakpoint(test_file, 20, IPCDebugger.NewBreakpointCondition("x > 1"));
+	-- raw sources are lower cased and lose the "@" prefix
+	local lines = IPCDebugger.GetSourceBreakpoints(test_source);
+	check_equal(true, lines[10], "breakpoint");
+	check_equal("x > 1", type(lines[20]) == "table" and lines[20].cond, "conditional breakpoint");
+	check_equal(nil, lines[11], "line without breakpoint");
+	check_equal(nil, next(IPCDebugger.GetSourceBreakpoints("@script/ide/debugger/test/other.lua")), "lines of another source");
+	-- the lines of a source are built once until breakpoints change
+	check_equal(lines, IPCDebugger.GetSourceBreakpoints(test_source), "cached lines");
+
+	IPCDebugger.remove_breakpoint(test_file, 10);
+	local new_lines = IPCDebugger.GetSourceBreakpoints(test_source);
+	check_equal(nil, new_lines[10], "removed breakpoint");
+	check_equal(lines[20], new_lines[20], "kept breakpoint");
+	IPCDebugger.remove_breakpoint(test_file, 20);
+	check_equal(nil, next(IPCDebugger.GetSourceBreakpoints(test_source)), "lines after all breakpoints are removed");
+end);
+
+-- hit count predicates, the same as enum_BP_PASSCOUNT_STYLE of visual studio
+local PASSCOUNT_NONE, PASSCOUNT_EQUAL, PASSCOUNT_EQUAL_OR_GREATER, PASSCOUNT_MOD = 0, 1, 2, 3;
+
+add_test("new_condition", function()
+	local new_condition = IPCDebugger.NewBreakpointCondition;
+	check_equal(true, new_condition(), "no condition");
+	check_equal(true, new_condition("", "0", "5", ""), "empty condition");
+	-- the fields are sent as strings
+	local bp = new_condition("a == 1", tostring(PASSCOUNT_EQUAL), "3");
+	check_equal("a == 1", bp.cond, "cond");
+	check_equal(PASSCOUNT_EQUAL, bp.passcount_style, "passcount_style");
+	check_equal(3, bp.passcount, "passcount");
+	check_equal(0, bp.hits, "hits");
+	check_equal(nil, bp.log, "log");
+	bp = new_condition(nil, nil, nil, "a is {a}");
+	check_equal(PASSCOUNT_NONE, bp.passcount_style, "passcount_style of a logpoint");
+	check_equal("a is {a}", bp.log, "log");
+end);
+
+add_test("check_condition", function()
+	local new_condition, check = IPCDebugger.NewBreakpointCondition, IPCDebugger.CheckBreakpointCondition;
+	-- conditions see the locals of the frame at level 1, i.e. this function
+	local a = 1;
+	check_equal(true, check(true, 1), "breakpoint");
+	check_equal(true, check(new_condition("a == 1"), 1), "true condition");
+	check_equal(false, check(new_condition("a == 2"), 1), "false condition");
+	check_equal(true, check(new_condition("string.len('ab') == 2"), 1), "condition using the environment");
+
+	-- invalid conditions and errors stop, so that they are noticed
+	local bStopped;
+	local output = capture_output(function()
+		bStopped = check(new_condition("a =="), 1);
+	end);
+	check_equal(true, bStopped, "invalid condition");
+	check_equal(1, #output, "message of an invalid condition");
+	output = capture_output(function()
+		bStopped = check(new_condition("a.b"), 1);
+	end);
+	check_equal(true, bStopped, "condition that raises an error");
+	check_equal(1, #output, "message of an error");
+
+	local function check_hits(bp, expected)
+		for i, bExpected in ipairs(expected) do
+			check_equal(bExpected, check(bp, 2), "hit "..i);
+		end
+	end
+	check_hits(new_condition(nil, PASSCOUNT_EQUAL, 3), {false, false, true, false});
+	check_hits(new_condition(nil, PASSCOUNT_EQUAL_OR_GREATER, 2), {false, true, true});
+	check_hits(new_condition(nil, PASSCOUNT_MOD, 2), {false, true, false, true});
+	-- hits are only counted when the condition passes
+	local bp = new_condition("a == 2", PASSCOUNT_EQUAL, 1);
+	check_equal(false, check(bp, 1), "false condition with hit count");
+	check_equal(0, bp.hits, "hits of a false condition");
+	a = 2;
+	check_equal(true, check(bp, 1), "first hit after the condition passes");
+end);
+
+add_test("compile_log_message", function()
+	local parts = IPCDebugger.CompileLogMessage("x={x}, next={x + 1}!");
+	check_equal(5, #parts, "number of parts");
+	check_equal("x=", parts[1], "literal");
+	check_equal(", next=", parts[3], "literal");
+	check_equal("!", parts[5], "literal");
+	check_equal("function", type(parts[2]), "expression");
+	setfenv(parts[2], {x = 2});
+	setfenv(parts[4], {x = 2});
+	check_equal(2, parts[2](), "value of an expression");
+	check_equal(3, parts[4](), "value of an expression");
+
+	parts = IPCDebugger.CompileLogMessage("{x}{y}");
+	check_equal(2, #parts, "adjacent expressions");
+	check_equal("function", type(parts[1]), "expression");
+	check_equal("function", type(parts[2]), "expression");
+	parts = IPCDebugger.CompileLogMessage("no expression");
+	check_equal(1, #parts, "message without expressions");
+	check_equal("no expression", parts[1], "literal");
+	-- an expression that does not compile is printed as its error
+	parts = IPCDebugger.CompileLogMessage("{x +}");
+	check_equal(1, #parts, "invalid expression");
+	check_equal("<", type(parts[1]) == "string" and string.sub(parts[1], 1, 1), "error of an invalid expression");
+end);
+
+add_test("logpoint", function()
+	local rate, burst = IPCDebugger.logpoint_rate, IPCDebugger.logpoint_burst;
+	IPCDebugger.logpoint_rate, IPCDebugger.logpoint_burst = 0, 2;
+	local bp = IPCDebugger.NewBreakpointCondition(nil, nil, nil, "x is {x}");
+	local results = {};
+	local bSucceed, output = pcall(capture_output, function()
+		local x = 5;
+		-- without a refill, only the burst is printed
+		for i = 1, 3 do
+			results[i] = IPCDebugger.CheckBreakpointCondition(bp, 1);
+		end
+		-- as if a second has passed at 10 messages per second
+		IPCDebugger.logpoint_rate = 10;
+		bp.token_time = bp.token_time - 1000;
+		x = 6;
+		results[4] = IPCDebugger.CheckBreakpointCondition(bp, 1);
+	end);
+	IPCDebugger.logpoint_rate, IPCDebugger.logpoint_burst = rate, burst;
+	if(not bSucceed) then
+		error(output, 0);
+	end
+	for i = 1, 4 do
+		check_equal(false, results[i], "logpoints never stop");
+	end
+	check_equal(3, #output, "printed messages");
+	check_equal("x is 5\n", output[1], "message");
+	check_equal("x is 5\n", output[2], "message");
+	check_equal("x is 6 [1 messages dropped]\n", output[3], "message after dropping");
+end);
+
+add_test("setbs_batch", function()
+	-- a batch like the one NPL_SendBreakpoints sends when a large project is loaded
+	local count = 1000;
+	local add, cond, log = {}, {}, {};
+	for line = 1, count do
+		add[#add+1] = test_file.."|"..line.."\n";
+		if(line % 3 == 0) then
+			cond[#cond+1] = test_file.."|"..line.."|"..PASSCOUNT_EQUAL.."|"..line.."|x == "..line.."\n";
+		end
+		if(line % 5 == 0) then
+			log[#log+1] = test_file.."|"..line.."|line {x}\n";
+		end
+	end
+	local nAdded, nRemoved = IPCDebugger.apply_breakpoints({mode = "delta", add = table.concat(add), cond = table.concat(cond), log = table.concat(log)});
+	check_equal(count, nAdded, "added breakpoints");
+	check_equal(0, nRemoved, "removed breakpoints");
+	local lines = IPCDebugger.GetSourceBreakpoints(test_source);
+	for line = 1, count do
+		local bp = lines[line];
+		if(line % 3 == 0) then
+			check_equal("x == "..line, type(bp) == "table" and bp.cond, "condition of line "..line);
+			check_equal(PASSCOUNT_EQUAL, bp.passcount_style, "passcount_style of line "..line);
+			check_equal(line, bp.passcount, "passcount of line "..line);
+			check_equal(line % 5 == 0 and "line {x}" or nil, bp.log, "log of conditional line "..line);
+		elseif(line % 5 == 0) then
+			check_equal("line {x}", type(bp) == "table" and bp.log, "log of line "..line);
+			check_equal(nil, bp.cond, "condition of logpoint "..line);
+		else
+			check_equal(true, bp, "breakpoint of line "..line);
+		end
+	end
+
+	-- remove every other breakpoint in one delta
+	local del = {};
+	for line = 2, count, 2 do
+		del[#del+1] = test_file.."|"..line.."\n";
+	end
+	nAdded, nRemoved = IPCDebugger.apply_breakpoints({mode = "delta", del = table.concat(del)});
+	check_equal(0, nAdded, "added breakpoints of a delete");
+	check_equal(count / 2, nRemoved, "removed breakpoints");
+	lines = IPCDebugger.GetSourceBreakpoints(test_source);
+	for line = 1, count do
+		check_equal(line % 2 == 1, lines[line] ~= nil, "breakpoint of line "..line.." after the delete");
+	end
+
+	-- a full table replaces all of them
+	IPCDebugger.apply_breakpoints({mode = "full", add = test_file.."|7\n"});
+	lines = IPCDebugger.GetSourceBreakpoints(test_source);
+	check_equal(true, lines[7], "breakpoint of a full table");
+	check_equal(nil, lines[1], "breakpoint replaced by a full table");
+	IPCDebugger.apply_breakpoints({mode = "delta", del = test_file.."|7\n"});
+	check_equal(nil, next(IPCDebugger.GetSourceBreakpoints(test_source)), "lines after all breakpoints are removed");
+end);
+
+add_test("escaped_condition", function()
+	-- the line break ends the comment, so it must not become a space
+	IPCDebugger.apply_breakpoints({mode = "delta", add = test_file.."|30\n", cond = test_file.."|30|0|0|x -- comment\\nor y == [[a\\\\b]]\n"});
+	local bp = IPCDebugger.GetSourceBreakpoints(test_source)[30];
+	IPCDebugger.apply_breakpoints({mode = "delta", del = test_file.."|30\n"});
+	check_equal("x -- comment\nor y == [[a\\b]]", type(bp) == "table" and bp.cond, "unescaped condition");
+	local x, y = false, "a\\b";
+	check_equal(true, IPCDebugger.CheckBreakpointCondition(bp, 1), "condition with a comment and a long string");
+end);
+
+-- @return the number of failed tests
+function Test.RunAll()
+	local failed = 0;
+	for _, test in ipairs(tests) do
+		local bSucceed, err = pcall(test.func);
+		if(not bSucceed) then
+			failed = failed + 1;
+			commonlib.log("IPCDebugger test %s failed: %s\n", test.name, tostring(err));
+		end
+	end
+	commonlib.log("IPCDebugger tests: %d of %d failed\n", failed, #tests);
+	return failed;
+end